@@ -0,0 +1,105 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+
+/**
+ * The stream a recording process sends to symbolcollector over its Unix
+ * socket at exit, instead of writing a database.
+ *
+ *   char magic[8]
+ *   frames: uint32_t size, then size bytes of whole records
+ *   uint32_t 0, ending the stream
+ *
+ * Each record is a CollectorRecord byte followed by its fields:
+ *
+ *   kCollectorLibrary  uint32_t id, string name, string path
+ *   kCollectorString   uint32_t id, string value
+ *   kCollectorSymbol   uint32_t id, uint32_t library, uint32_t name (a
+ *                      string id), uint64_t size
+ *   kCollectorUsage    uint32_t library, uint32_t symbol
+ *
+ * Strings are a uint32_t length and the bytes. Integers are in host byte
+ * order, as both ends are on one machine. Ids are the positive ids of the
+ * recording's own tables and only mean something within the stream; a
+ * record only refers to records before it. A stream is delivered once
+ * the sender has written all of it, as the collector still reads what is
+ * queued on a connection whose sender has exited; streams that end early
+ * are ignored.
+ */
+enum CollectorRecord : uint8_t {
+  kCollectorLibrary = 1,
+  kCollectorString = 2,
+  kCollectorSymbol = 3,
+  kCollectorUsage = 4,
+};
+
+static constexpr char kCollectorMagic[8] = {'R', 'S', 'C', 'O',
+                                            'L', 'L', '0', '1'};
+
+// Senders cut frames once they reach this size.
+static constexpr uint32_t kCollectorFrameSize = 64 << 10;
+
+// The longest stream the collector takes; a sender with more to send
+// writes its recording to a file instead.
+static constexpr size_t kCollectorMaxStream = 64 << 20;
+
+// How long a sender waits at exit for the collector to take its recording
+// before writing it to a file after all.
+static constexpr std::chrono::milliseconds kCollectorTimeout{250};
+
+/** Appends fields to a frame being built. */
+inline void collector_put(std::string *out, uint32_t value) {
+  out->append(reinterpret_cast<const char *>(&value), sizeof(value));
+}
+
+inline void collector_put(std::string *out, uint64_t value) {
+  out->append(reinterpret_cast<const char *>(&value), sizeof(value));
+}
+
+inline void collector_put(std::string *out, std::string_view value) {
+  collector_put(out, static_cast<uint32_t>(value.size()));
+  out->append(value);
+}
+
+/**
+ * Reads the fields of the records in one frame, checking every read
+ * against its end. Strings are views into the frame.
+ */
+class CollectorReader {
+ public:
+  CollectorReader(const char *data, size_t size)
+      : p_(data), end_(data + size) {}
+
+  bool done() const { return p_ == end_; }
+
+  bool read(uint8_t *value) { return read_bytes(value, sizeof(*value)); }
+  bool read(uint32_t *value) { return read_bytes(value, sizeof(*value)); }
+  bool read(uint64_t *value) { return read_bytes(value, sizeof(*value)); }
+
+  bool read(std::string_view *value) {
+    uint32_t size;
+    if (!read(&size) || size > static_cast<size_t>(end_ - p_)) {
+      return false;
+    }
+    *value = std::string_view(p_, size);
+    p_ += size;
+    return true;
+  }
+
+ private:
+  bool read_bytes(void *value, size_t size) {
+    if (size > static_cast<size_t>(end_ - p_)) {
+      return false;
+    }
+    memcpy(value, p_, size);
+    p_ += size;
+    return true;
+  }
+
+  const char *p_;
+  const char *end_;
+};
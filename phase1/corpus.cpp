@@ -0,0 +1,605 @@
+#include "corpus.h"
+
+#include <cxxabi.h>
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+
+void sqlite_fail(sqlite3 *db) {
+  std::cerr << sqlite3_errmsg(db) << std::endl;
+  sqlite3_close(db);
+  exit(1);
+}
+
+std::string demangle(const std::string &mangled) {
+  int status;
+  char *demangled =
+      abi::__cxa_demangle(mangled.c_str(), nullptr, nullptr, &status);
+  if (status != 0) {
+    return mangled;
+  }
+  std::string result(demangled);
+  free(demangled);
+  return result;
+}
+
+uint32_t Corpus::library_id(const std::string &name, const std::string &path) {
+  auto [it, inserted] = library_ids_.try_emplace(name, libraries.size());
+  if (inserted) {
+    libraries.push_back({name, path});
+  }
+  return it->second;
+}
+
+uint32_t Corpus::symbol_id(uint32_t library, const std::string &name,
+                           uint64_t size) {
+  // Library ids are dense, so prefixing the name with one is unambiguous.
+  std::string key = std::to_string(library) + ":" + name;
+  auto [it, inserted] = symbol_ids_.try_emplace(key, symbols.size());
+  if (inserted) {
+    symbols.push_back({library, name, size});
+    consumers.emplace_back();
+  } else {
+    // Versioned symbols may appear more than once under the same name.
+    symbols[it->second].size = std::max(symbols[it->second].size, size);
+  }
+  return it->second;
+}
+
+const char *column_text(sqlite3_stmt *stmt, int column) {
+  const unsigned char *text = sqlite3_column_text(stmt, column);
+  return text == nullptr ? "" : reinterpret_cast<const char *>(text);
+}
+
+/**
+ * Set *found to whether db has table. Returns false on an error, which is
+ * left in db.
+ */
+static bool find_table(sqlite3 *db, const char *table, bool *found) {
+  sqlite3_stmt *stmt;
+  if (sqlite3_prepare_v2(db,
+                         "SELECT 1 FROM sqlite_master WHERE type = 'table' "
+                         "AND name = ?;",
+                         -1, &stmt, nullptr) != SQLITE_OK) {
+    return false;
+  }
+  sqlite3_bind_text(stmt, 1, table, -1, SQLITE_STATIC);
+  int result = sqlite3_step(stmt);
+  *found = result == SQLITE_ROW;
+  sqlite3_finalize(stmt);
+  return result == SQLITE_ROW || result == SQLITE_DONE;
+}
+
+static bool has_table(sqlite3 *db, const char *table) {
+  bool found;
+  if (!find_table(db, table, &found)) {
+    sqlite_fail(db);
+  }
+  return found;
+}
+
+/** Recordings made before names were moved to Strings. */
+static bool read_text_recording(
+    sqlite3 *db,
+    const std::function<void(const char *library, const char *name,
+                             uint64_t size)> &symbol,
+    const std::function<void(const char *library, const char *symbol,
+                             const char *provider)> &usage) {
+  sqlite3_stmt *stmt;
+  if (sqlite3_prepare_v2(db, "SELECT Library, Name, Size FROM Symbols;", -1,
+                         &stmt, nullptr) != SQLITE_OK) {
+    return false;
+  }
+  while (sqlite3_step(stmt) == SQLITE_ROW) {
+    symbol(column_text(stmt, 0), column_text(stmt, 1),
+           sqlite3_column_int64(stmt, 2));
+  }
+  // Finalizing reports an error that ended the loop early.
+  if (sqlite3_finalize(stmt) != SQLITE_OK) {
+    return false;
+  }
+
+  if (sqlite3_prepare_v2(db, "SELECT Library, Symbol, Provider FROM Usages;",
+                         -1, &stmt, nullptr) != SQLITE_OK) {
+    return false;
+  }
+  while (sqlite3_step(stmt) == SQLITE_ROW) {
+    usage(column_text(stmt, 0), column_text(stmt, 1), column_text(stmt, 2));
+  }
+  return sqlite3_finalize(stmt) == SQLITE_OK;
+}
+
+/**
+ * The symbols of the objects recorded with a catalog, which the recording
+ * only has if they were bound to.
+ */
+static bool read_catalog(
+    sqlite3 *db, const std::function<void(const char *library,
+                                          const char *name, uint64_t size)>
+                     &symbol) {
+  sqlite3_stmt *stmt;
+  if (sqlite3_prepare_v2(db, "ATTACH DATABASE (SELECT Path FROM Catalog) "
+                         "AS catalog;",
+                         -1, &stmt, nullptr) != SQLITE_OK) {
+    return false;
+  }
+  bool attached = sqlite3_step(stmt) == SQLITE_DONE;
+  sqlite3_finalize(stmt);
+  if (!attached) {
+    return false;
+  }
+  if (sqlite3_prepare_v2(db,
+                         "SELECT l.Name, c.Name, c.Size FROM Libraries l "
+                         "JOIN catalog.Builds b ON b.BuildId = l.BuildId "
+                         "JOIN catalog.Symbols c ON c.Build = b.Id;",
+                         -1, &stmt, nullptr) != SQLITE_OK) {
+    return false;
+  }
+  while (sqlite3_step(stmt) == SQLITE_ROW) {
+    symbol(column_text(stmt, 0), column_text(stmt, 1),
+           sqlite3_column_int64(stmt, 2));
+  }
+  if (sqlite3_finalize(stmt) != SQLITE_OK) {
+    return false;
+  }
+  return sqlite3_exec(db, "DETACH DATABASE catalog;", 0, 0, nullptr) ==
+         SQLITE_OK;
+}
+
+void read_recording(
+    sqlite3 *db,
+    const std::function<void(const char *name, const char *path)> &library,
+    const std::function<void(const char *library, const char *name,
+                             uint64_t size)> &symbol,
+    const std::function<void(const char *library, const char *symbol,
+                             const char *provider)> &usage) {
+  std::string error;
+  if (!try_read_recording(db, library, symbol, usage, &error)) {
+    std::cerr << error << std::endl;
+    sqlite3_close(db);
+    exit(1);
+  }
+}
+
+bool try_read_recording(
+    sqlite3 *db,
+    const std::function<void(const char *name, const char *path)> &library,
+    const std::function<void(const char *library, const char *name,
+                             uint64_t size)> &symbol,
+    const std::function<void(const char *library, const char *symbol,
+                             const char *provider)> &usage,
+    std::string *error) {
+  auto fail = [&] {
+    *error = sqlite3_errmsg(db);
+    return false;
+  };
+  bool merged, interned, catalog;
+  if (!find_table(db, "Recordings", &merged) ||
+      !find_table(db, "Strings", &interned) ||
+      !find_table(db, "Catalog", &catalog)) {
+    return fail();
+  }
+  if (merged) {
+    *error = "a merged corpus, not a recording";
+    return false;
+  }
+  sqlite3_stmt *stmt;
+  if (sqlite3_prepare_v2(db,
+                         "SELECT Name, Path, rowid FROM Libraries "
+                         "ORDER BY rowid;",
+                         -1, &stmt, nullptr) != SQLITE_OK) {
+    return fail();
+  }
+  // The names of libraries and strings, by id. Ids are dense.
+  std::vector<std::string> libraries(1);
+  while (sqlite3_step(stmt) == SQLITE_ROW) {
+    library(column_text(stmt, 0), column_text(stmt, 1));
+    size_t id = sqlite3_column_int64(stmt, 2);
+    if (id >= libraries.size()) {
+      libraries.resize(id + 1);
+    }
+    libraries[id] = column_text(stmt, 0);
+  }
+  if (sqlite3_finalize(stmt) != SQLITE_OK) {
+    return fail();
+  }
+  if (!interned) {
+    return read_text_recording(db, symbol, usage) || fail();
+  }
+
+  std::vector<std::string> strings(1);
+  if (sqlite3_prepare_v2(db, "SELECT Id, Value FROM Strings;", -1, &stmt,
+                         nullptr) != SQLITE_OK) {
+    return fail();
+  }
+  while (sqlite3_step(stmt) == SQLITE_ROW) {
+    size_t id = sqlite3_column_int64(stmt, 0);
+    if (id >= strings.size()) {
+      strings.resize(id + 1);
+    }
+    strings[id] = column_text(stmt, 1);
+  }
+  if (sqlite3_finalize(stmt) != SQLITE_OK) {
+    return fail();
+  }
+
+  // By symbol id, its library and name.
+  std::vector<std::pair<size_t, size_t>> symbols(1);
+  auto valid = [](size_t id, size_t size) { return id > 0 && id < size; };
+  if (sqlite3_prepare_v2(db, "SELECT Id, Library, Name, Size FROM Symbols;",
+                         -1, &stmt, nullptr) != SQLITE_OK) {
+    return fail();
+  }
+  while (sqlite3_step(stmt) == SQLITE_ROW) {
+    size_t id = sqlite3_column_int64(stmt, 0);
+    size_t library = sqlite3_column_int64(stmt, 1);
+    size_t name = sqlite3_column_int64(stmt, 2);
+    if (!valid(library, libraries.size()) || !valid(name, strings.size())) {
+      continue;
+    }
+    if (id >= symbols.size()) {
+      symbols.resize(id + 1);
+    }
+    symbols[id] = {library, name};
+    symbol(libraries[library].c_str(), strings[name].c_str(),
+           sqlite3_column_int64(stmt, 3));
+  }
+  if (sqlite3_finalize(stmt) != SQLITE_OK) {
+    return fail();
+  }
+
+  if (catalog && !read_catalog(db, symbol)) {
+    return fail();
+  }
+
+  if (sqlite3_prepare_v2(db, "SELECT Library, Symbol FROM Usages;", -1, &stmt,
+                         nullptr) != SQLITE_OK) {
+    return fail();
+  }
+  while (sqlite3_step(stmt) == SQLITE_ROW) {
+    size_t library = sqlite3_column_int64(stmt, 0);
+    size_t id = sqlite3_column_int64(stmt, 1);
+    if (!valid(library, libraries.size()) || !valid(id, symbols.size()) ||
+        symbols[id].first == 0) {
+      continue;
+    }
+    usage(libraries[library].c_str(), strings[symbols[id].second].c_str(),
+          libraries[symbols[id].first].c_str());
+  }
+  return sqlite3_finalize(stmt) == SQLITE_OK || fail();
+}
+
+bool is_merged_corpus(sqlite3 *db) { return has_table(db, "Recordings"); }
+
+const char *const kMergedCorpusSchema = R"(
+CREATE TABLE IF NOT EXISTS Strings(Id INTEGER PRIMARY KEY, Value TEXT);
+CREATE TABLE IF NOT EXISTS Recordings(Id INTEGER PRIMARY KEY,
+                                      Source TEXT UNIQUE, Program INTEGER,
+                                      Modified INTEGER, Bytes INTEGER);
+CREATE TABLE IF NOT EXISTS Libraries(Id INTEGER PRIMARY KEY, Name INTEGER,
+                                     Path INTEGER);
+CREATE TABLE IF NOT EXISTS Symbols(Id INTEGER PRIMARY KEY, Library INTEGER,
+                                   Name INTEGER, Size INTEGER);
+CREATE TABLE IF NOT EXISTS Loads(Recording INTEGER, Library INTEGER);
+CREATE TABLE IF NOT EXISTS Usages(Recording INTEGER, Library INTEGER,
+                                  Symbol INTEGER);
+CREATE VIEW IF NOT EXISTS NamedUsages AS
+  SELECT Program.Value AS Program, Consumer.Value AS Library,
+         Name.Value AS Symbol, Provider.Value AS Provider
+  FROM Usages
+  JOIN Recordings ON Recordings.Id = Usages.Recording
+  JOIN Strings AS Program ON Program.Id = Recordings.Program
+  JOIN Libraries AS ConsumerLibrary ON ConsumerLibrary.Id = Usages.Library
+  JOIN Strings AS Consumer ON Consumer.Id = ConsumerLibrary.Name
+  JOIN Symbols ON Symbols.Id = Usages.Symbol
+  JOIN Strings AS Name ON Name.Id = Symbols.Name
+  JOIN Libraries AS ProviderLibrary ON ProviderLibrary.Id = Symbols.Library
+  JOIN Strings AS Provider ON Provider.Id = ProviderLibrary.Name;
+)";
+
+const char *const kMergedCorpusIndexes = R"(
+CREATE UNIQUE INDEX IF NOT EXISTS StringsValue ON Strings(Value);
+CREATE UNIQUE INDEX IF NOT EXISTS LibrariesName ON Libraries(Name);
+CREATE UNIQUE INDEX IF NOT EXISTS SymbolsLibrary ON Symbols(Library, Name);
+CREATE INDEX IF NOT EXISTS LoadsLibrary ON Loads(Library);
+CREATE INDEX IF NOT EXISTS UsagesRecording ON Usages(Recording);
+CREATE INDEX IF NOT EXISTS UsagesSymbol ON Usages(Symbol);
+)";
+
+void Corpus::load(const std::string &database) {
+  sqlite3 *db;
+  if (sqlite3_open_v2(database.c_str(), &db, SQLITE_OPEN_READONLY, nullptr) !=
+      SQLITE_OK) {
+    sqlite_fail(db);
+  }
+  if (is_merged_corpus(db)) {
+    load_merged(db);
+    sqlite3_close(db);
+    return;
+  }
+
+  uint32_t program = programs.size();
+  programs.push_back(database);
+  program_libraries.emplace_back();
+  // The program itself is not shared, so it is named after its path.
+  auto name_of = [&](const char *library) -> std::string {
+    return strcmp(library, "main") == 0 ? programs[program] : library;
+  };
+  read_recording(
+      db,
+      [&](const char *name, const char *path) {
+        if (strcmp(name, "main") == 0 && *path != '\0') {
+          programs[program] = path;
+        }
+        program_libraries[program].push_back(library_id(name_of(name), path));
+      },
+      [&](const char *library, const char *name, uint64_t size) {
+        symbol_id(library_id(name_of(library), ""), name, size);
+      },
+      [&](const char *library, const char *symbol, const char *provider) {
+        uint32_t id = symbol_id(library_id(name_of(provider), ""), symbol, 0);
+        consumers[id].push_back(program);
+      });
+  sqlite3_close(db);
+}
+
+void Corpus::load_merged(sqlite3 *db) {
+  std::vector<std::string> strings;
+  sqlite3_stmt *stmt;
+  if (sqlite3_prepare_v2(db, "SELECT Id, Value FROM Strings;", -1, &stmt,
+                         nullptr) != SQLITE_OK) {
+    sqlite_fail(db);
+  }
+  while (sqlite3_step(stmt) == SQLITE_ROW) {
+    size_t id = sqlite3_column_int64(stmt, 0);
+    if (id >= strings.size()) {
+      strings.resize(id + 1);
+    }
+    strings[id] = column_text(stmt, 1);
+  }
+  sqlite3_finalize(stmt);
+  auto string = [&](sqlite3_stmt *stmt, int column) -> const std::string & {
+    size_t id = sqlite3_column_int64(stmt, column);
+    if (id >= strings.size()) {
+      std::cerr << "Unknown string " << id << std::endl;
+      exit(1);
+    }
+    return strings[id];
+  };
+
+  // Ids in the merged corpus to ids here.
+  std::unordered_map<int64_t, uint32_t> library_ids;
+  std::unordered_map<int64_t, uint32_t> symbol_ids;
+  std::unordered_map<int64_t, uint32_t> program_ids;
+  if (sqlite3_prepare_v2(db, "SELECT Id, Name, Path FROM Libraries;", -1,
+                         &stmt, nullptr) != SQLITE_OK) {
+    sqlite_fail(db);
+  }
+  while (sqlite3_step(stmt) == SQLITE_ROW) {
+    library_ids[sqlite3_column_int64(stmt, 0)] =
+        library_id(string(stmt, 1), string(stmt, 2));
+  }
+  sqlite3_finalize(stmt);
+
+  if (sqlite3_prepare_v2(db, "SELECT Id, Library, Name, Size FROM Symbols;",
+                         -1, &stmt, nullptr) != SQLITE_OK) {
+    sqlite_fail(db);
+  }
+  while (sqlite3_step(stmt) == SQLITE_ROW) {
+    symbol_ids[sqlite3_column_int64(stmt, 0)] =
+        symbol_id(library_ids.at(sqlite3_column_int64(stmt, 1)),
+                  string(stmt, 2), sqlite3_column_int64(stmt, 3));
+  }
+  sqlite3_finalize(stmt);
+
+  if (sqlite3_prepare_v2(db, "SELECT Id, Program FROM Recordings;", -1, &stmt,
+                         nullptr) != SQLITE_OK) {
+    sqlite_fail(db);
+  }
+  while (sqlite3_step(stmt) == SQLITE_ROW) {
+    program_ids[sqlite3_column_int64(stmt, 0)] = programs.size();
+    programs.push_back(string(stmt, 1));
+    program_libraries.emplace_back();
+  }
+  sqlite3_finalize(stmt);
+
+  if (sqlite3_prepare_v2(db, "SELECT Recording, Library FROM Loads;", -1,
+                         &stmt, nullptr) != SQLITE_OK) {
+    sqlite_fail(db);
+  }
+  while (sqlite3_step(stmt) == SQLITE_ROW) {
+    program_libraries[program_ids.at(sqlite3_column_int64(stmt, 0))]
+        .push_back(library_ids.at(sqlite3_column_int64(stmt, 1)));
+  }
+  sqlite3_finalize(stmt);
+
+  if (sqlite3_prepare_v2(db, "SELECT Recording, Symbol FROM Usages;", -1,
+                         &stmt, nullptr) != SQLITE_OK) {
+    sqlite_fail(db);
+  }
+  while (sqlite3_step(stmt) == SQLITE_ROW) {
+    consumers[symbol_ids.at(sqlite3_column_int64(stmt, 1))].push_back(
+        program_ids.at(sqlite3_column_int64(stmt, 0)));
+  }
+  sqlite3_finalize(stmt);
+}
+
+void Corpus::finish() {
+  for (auto &ids : consumers) {
+    std::sort(ids.begin(), ids.end());
+    ids.erase(std::unique(ids.begin(), ids.end()), ids.end());
+  }
+  for (auto &ids : program_libraries) {
+    std::sort(ids.begin(), ids.end());
+    ids.erase(std::unique(ids.begin(), ids.end()), ids.end());
+  }
+}
+
+int64_t Corpus::find_library(const std::string &name) const {
+  auto it = library_ids_.find(name);
+  return it == library_ids_.end() ? -1 : it->second;
+}
+
+std::vector<std::vector<uint32_t>> Corpus::symbols_by_library() const {
+  std::vector<std::vector<uint32_t>> by_library(libraries.size());
+  for (uint32_t i = 0; i < symbols.size(); ++i) {
+    by_library[symbols[i].library].push_back(i);
+  }
+  return by_library;
+}
+
+uint64_t Corpus::library_bytes(uint32_t library) const {
+  uint64_t bytes = 0;
+  for (const Symbol &symbol : symbols) {
+    if (symbol.library == library) {
+      bytes += symbol.size;
+    }
+  }
+  return bytes;
+}
+
+std::string SplitPlan::part_name(const std::string &library,
+                                 const std::string &suffix) {
+  std::string base = library.substr(0, library.find(".so"));
+  return base + "-" + suffix + ".so";
+}
+
+void SplitPlan::save(const std::string &database) const {
+  sqlite3 *db;
+  if (sqlite3_open(database.c_str(), &db) != SQLITE_OK) {
+    sqlite_fail(db);
+  }
+  const char *schema = R""""(
+      DROP TABLE IF EXISTS SplitParts;
+      DROP TABLE IF EXISTS SplitSymbols;
+      DROP TABLE IF EXISTS SplitLoads;
+      CREATE TABLE SplitParts(Library TEXT, Part TEXT, Bytes INTEGER,
+                              Consumers INTEGER);
+      CREATE TABLE SplitSymbols(Library TEXT, Part TEXT, Symbol TEXT);
+      CREATE TABLE SplitLoads(Program TEXT, Library TEXT,
+                              OriginalBytes INTEGER, SplitBytes INTEGER);
+      BEGIN TRANSACTION;
+      )"""";
+  if (sqlite3_exec(db, schema, nullptr, nullptr, nullptr) != SQLITE_OK) {
+    sqlite_fail(db);
+  }
+
+  sqlite3_stmt *part_stmt;
+  sqlite3_stmt *symbol_stmt;
+  sqlite3_stmt *load_stmt;
+  if (sqlite3_prepare_v2(db,
+                         "INSERT INTO SplitParts(Library, Part, Bytes, "
+                         "Consumers) VALUES (?, ?, ?, ?);",
+                         -1, &part_stmt, nullptr) != SQLITE_OK ||
+      sqlite3_prepare_v2(db,
+                         "INSERT INTO SplitSymbols(Library, Part, Symbol) "
+                         "VALUES (?, ?, ?);",
+                         -1, &symbol_stmt, nullptr) != SQLITE_OK ||
+      sqlite3_prepare_v2(db,
+                         "INSERT INTO SplitLoads(Program, Library, "
+                         "OriginalBytes, SplitBytes) VALUES (?, ?, ?, ?);",
+                         -1, &load_stmt, nullptr) != SQLITE_OK) {
+    sqlite_fail(db);
+  }
+  for (const Part &part : parts) {
+    sqlite3_bind_text(part_stmt, 1, part.library.c_str(), -1, SQLITE_STATIC);
+    sqlite3_bind_text(part_stmt, 2, part.name.c_str(), -1, SQLITE_STATIC);
+    sqlite3_bind_int64(part_stmt, 3, part.bytes);
+    sqlite3_bind_int64(part_stmt, 4, part.consumers);
+    if (sqlite3_step(part_stmt) != SQLITE_DONE) {
+      sqlite_fail(db);
+    }
+    sqlite3_reset(part_stmt);
+    for (const std::string &symbol : part.symbols) {
+      sqlite3_bind_text(symbol_stmt, 1, part.library.c_str(), -1,
+                        SQLITE_STATIC);
+      sqlite3_bind_text(symbol_stmt, 2, part.name.c_str(), -1, SQLITE_STATIC);
+      sqlite3_bind_text(symbol_stmt, 3, symbol.c_str(), -1, SQLITE_STATIC);
+      if (sqlite3_step(symbol_stmt) != SQLITE_DONE) {
+        sqlite_fail(db);
+      }
+      sqlite3_reset(symbol_stmt);
+    }
+  }
+  for (const Load &load : loads) {
+    sqlite3_bind_text(load_stmt, 1, load.program.c_str(), -1, SQLITE_STATIC);
+    sqlite3_bind_text(load_stmt, 2, load.library.c_str(), -1, SQLITE_STATIC);
+    sqlite3_bind_int64(load_stmt, 3, load.original_bytes);
+    sqlite3_bind_int64(load_stmt, 4, load.split_bytes);
+    if (sqlite3_step(load_stmt) != SQLITE_DONE) {
+      sqlite_fail(db);
+    }
+    sqlite3_reset(load_stmt);
+  }
+  sqlite3_finalize(part_stmt);
+  sqlite3_finalize(symbol_stmt);
+  sqlite3_finalize(load_stmt);
+
+  if (sqlite3_exec(db, "COMMIT;", nullptr, nullptr, nullptr) != SQLITE_OK) {
+    sqlite_fail(db);
+  }
+  sqlite3_close(db);
+}
+
+SplitPlan SplitPlan::read(const std::string &database) {
+  sqlite3 *db;
+  if (sqlite3_open_v2(database.c_str(), &db, SQLITE_OPEN_READONLY, nullptr) !=
+      SQLITE_OK) {
+    sqlite_fail(db);
+  }
+  SplitPlan plan;
+  std::unordered_map<std::string, size_t> part_index;
+
+  sqlite3_stmt *stmt;
+  if (sqlite3_prepare_v2(db,
+                         "SELECT Library, Part, Bytes, Consumers FROM "
+                         "SplitParts ORDER BY rowid;",
+                         -1, &stmt, nullptr) != SQLITE_OK) {
+    sqlite_fail(db);
+  }
+  while (sqlite3_step(stmt) == SQLITE_ROW) {
+    Part part;
+    part.library = column_text(stmt, 0);
+    part.name = column_text(stmt, 1);
+    part.bytes = sqlite3_column_int64(stmt, 2);
+    part.consumers = sqlite3_column_int64(stmt, 3);
+    part_index[part.library + "/" + part.name] = plan.parts.size();
+    plan.parts.push_back(std::move(part));
+  }
+  sqlite3_finalize(stmt);
+
+  if (sqlite3_prepare_v2(db,
+                         "SELECT Library, Part, Symbol FROM SplitSymbols "
+                         "ORDER BY rowid;",
+                         -1, &stmt, nullptr) != SQLITE_OK) {
+    sqlite_fail(db);
+  }
+  while (sqlite3_step(stmt) == SQLITE_ROW) {
+    std::string key = std::string(column_text(stmt, 0)) + "/" +
+                      column_text(stmt, 1);
+    auto it = part_index.find(key);
+    if (it == part_index.end()) {
+      std::cerr << "SplitSymbols refers to unknown part " << key << std::endl;
+      exit(1);
+    }
+    plan.parts[it->second].symbols.push_back(column_text(stmt, 2));
+  }
+  sqlite3_finalize(stmt);
+
+  if (sqlite3_prepare_v2(db,
+                         "SELECT Program, Library, OriginalBytes, SplitBytes "
+                         "FROM SplitLoads ORDER BY rowid;",
+                         -1, &stmt, nullptr) != SQLITE_OK) {
+    sqlite_fail(db);
+  }
+  while (sqlite3_step(stmt) == SQLITE_ROW) {
+    plan.loads.push_back(
+        {column_text(stmt, 0), column_text(stmt, 1),
+         static_cast<uint64_t>(sqlite3_column_int64(stmt, 2)),
+         static_cast<uint64_t>(sqlite3_column_int64(stmt, 3))});
+  }
+  sqlite3_finalize(stmt);
+  sqlite3_close(db);
+  return plan;
+}
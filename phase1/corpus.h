@@ -0,0 +1,166 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "sqlite3.h"
+
+/**
+ * The recordings of many processes, loaded for offline analysis.
+ *
+ * Every database written by recordsymbolslib.so describes one run of one
+ * program. A Corpus merges any number of them, or of corpora already merged
+ * by mergecorpus: libraries are identified by name and symbols by (library,
+ * name), and every program that bound to a symbol is one of its consumers.
+ * Everything is referred to by a dense integer id so analyses can scale to
+ * millions of symbols.
+ */
+class Corpus {
+ public:
+  struct Library {
+    std::string name;
+    std::string path;
+  };
+
+  struct Symbol {
+    uint32_t library;
+    std::string name;
+    uint64_t size;
+  };
+
+  // The path of every program recorded, indexed by program id.
+  std::vector<std::string> programs;
+  std::vector<Library> libraries;
+  std::vector<Symbol> symbols;
+  // For each symbol, the sorted ids of the programs that bound to it.
+  std::vector<std::vector<uint32_t>> consumers;
+  // For each program, the sorted ids of the libraries it loaded.
+  std::vector<std::vector<uint32_t>> program_libraries;
+
+  /**
+   * Add the recording, or every recording of the merged corpus, in the
+   * given database. Exits on error.
+   */
+  void load(const std::string &database);
+
+  /** Sort and deduplicate the per-symbol and per-program id lists. */
+  void finish();
+
+  /** The id of the named library, or -1 if it was never recorded. */
+  int64_t find_library(const std::string &name) const;
+
+  /** The ids of the symbols exported by each library. */
+  std::vector<std::vector<uint32_t>> symbols_by_library() const;
+
+  /** The bytes of all symbols exported by the library. */
+  uint64_t library_bytes(uint32_t library) const;
+
+ private:
+  void load_merged(sqlite3 *db);
+  uint32_t library_id(const std::string &name, const std::string &path);
+  uint32_t symbol_id(uint32_t library, const std::string &name,
+                     uint64_t size);
+
+  std::unordered_map<std::string, uint32_t> library_ids_;
+  std::unordered_map<std::string, uint32_t> symbol_ids_;
+};
+
+/**
+ * A proposed split of libraries into parts, as produced by splitlibrary.
+ *
+ * Each part is a set of exported symbols that would move into its own shared
+ * object. Plans are stored in their own SQLite database so that later tools
+ * (e.g. a shim generator) can consume them.
+ */
+struct SplitPlan {
+  struct Part {
+    std::string library;
+    std::string name;
+    std::vector<std::string> symbols;
+    uint64_t bytes = 0;
+    // How many programs need this part loaded.
+    uint64_t consumers = 0;
+  };
+
+  /** What a program loads from a library before and after the split. */
+  struct Load {
+    std::string program;
+    std::string library;
+    uint64_t original_bytes;
+    uint64_t split_bytes;
+  };
+
+  std::vector<Part> parts;
+  std::vector<Load> loads;
+
+  /** Replace the plan stored in the given database. Exits on error. */
+  void save(const std::string &database) const;
+
+  /** Read a plan written by save(). Exits on error. */
+  static SplitPlan read(const std::string &database);
+
+  /**
+   * The file name of a part of library, e.g. libfoo-2.so for part 2 of
+   * libfoo.so.1. Exports nobody uses go in libfoo-unused.so.
+   */
+  static std::string part_name(const std::string &library,
+                               const std::string &suffix);
+};
+
+/** Print the last error of db and exit. */
+[[noreturn]] void sqlite_fail(sqlite3 *db);
+
+/** A text column of the current row, or "" if it is NULL. */
+const char *column_text(sqlite3_stmt *stmt, int column);
+
+/**
+ * Read the recording of one process, as written by recordsymbolslib.so.
+ *
+ * library(name, path) is called for every object in the order it was
+ * loaded, symbol(library, name, size) for every export and usage(library,
+ * symbol, provider) for every binding, in that order. The program itself
+ * is named "main". This is the one place that knows the recording schema.
+ * Exits on error.
+ */
+void read_recording(
+    sqlite3 *db,
+    const std::function<void(const char *name, const char *path)> &library,
+    const std::function<void(const char *library, const char *name,
+                             uint64_t size)> &symbol,
+    const std::function<void(const char *library, const char *symbol,
+                             const char *provider)> &usage);
+
+/**
+ * As read_recording(), but returns false with the reason in *error instead
+ * of exiting, for threads that must not end the process.
+ */
+bool try_read_recording(
+    sqlite3 *db,
+    const std::function<void(const char *name, const char *path)> &library,
+    const std::function<void(const char *library, const char *name,
+                             uint64_t size)> &symbol,
+    const std::function<void(const char *library, const char *symbol,
+                             const char *provider)> &usage,
+    std::string *error);
+
+/** Whether db is a corpus merged by mergecorpus rather than a recording. */
+bool is_merged_corpus(sqlite3 *db);
+
+/**
+ * The tables and NamedUsages view of a merged corpus, created if missing,
+ * as written by mergecorpus and symbolcollector (see mergecorpus.cpp).
+ */
+extern const char *const kMergedCorpusSchema;
+
+/** The secondary indexes of a merged corpus, created if missing. */
+extern const char *const kMergedCorpusIndexes;
+
+/**
+ * Demangle a symbol name the way the recorder does, so names read from an
+ * object on disk can be matched against the recorded ones. Names that are
+ * not mangled are returned as is.
+ */
+std::string demangle(const std::string &mangled);
@@ -0,0 +1,235 @@
+#include <algorithm>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "corpus.h"
+
+/**
+ * Rank libraries by how many bytes of their exports no recorded program uses.
+ *
+ * Unlike the other tools this does not build a Corpus: each database is read
+ * once, front to back, and only a running total per exported symbol is kept
+ * (its largest st_size and whether anybody bound to it), so memory is
+ * bounded by the number of distinct exports rather than by the number of
+ * bindings and thousands of recordings take seconds. Corpora merged by
+ * mergecorpus are loaded whole and added in.
+ */
+
+static void usage() {
+  std::cerr << "Usage: deadexports [-s bytes|fraction|consumers] [-n count] "
+               "database.db..."
+            << std::endl;
+  exit(1);
+}
+
+struct Export {
+  uint64_t size = 0;
+  bool used = false;
+};
+
+struct LibraryTotals {
+  std::unordered_map<std::string, Export> exports;
+  // Programs that loaded the library, and those that bound to it.
+  std::unordered_set<uint32_t> loaded_by;
+  std::unordered_set<uint32_t> consumers;
+};
+
+struct Row {
+  std::string library;
+  size_t exports = 0;
+  size_t unused = 0;
+  uint64_t bytes = 0;
+  uint64_t unused_bytes = 0;
+  size_t loaded_by = 0;
+  size_t consumers = 0;
+
+  double unused_fraction() const {
+    return bytes == 0 ? 0 : static_cast<double>(unused_bytes) / bytes;
+  }
+};
+
+/** Add every recording of a merged corpus to the totals. */
+static void add_corpus(
+    const std::string &database,
+    std::unordered_map<std::string, LibraryTotals> &libraries,
+    std::unordered_map<std::string, uint32_t> &program_ids) {
+  Corpus corpus;
+  corpus.load(database);
+  corpus.finish();
+  // Programs are libraries named after their path in a corpus.
+  std::unordered_set<std::string> programs(corpus.programs.begin(),
+                                           corpus.programs.end());
+  std::vector<uint32_t> ids;
+  for (const std::string &program : corpus.programs) {
+    ids.push_back(
+        program_ids.try_emplace(program, program_ids.size()).first->second);
+  }
+  for (uint32_t program = 0; program < ids.size(); ++program) {
+    for (uint32_t library : corpus.program_libraries[program]) {
+      const std::string &name = corpus.libraries[library].name;
+      if (!programs.count(name)) {
+        libraries[name].loaded_by.insert(ids[program]);
+      }
+    }
+  }
+  for (uint32_t id = 0; id < corpus.symbols.size(); ++id) {
+    const Corpus::Symbol &symbol = corpus.symbols[id];
+    const std::string &name = corpus.libraries[symbol.library].name;
+    if (programs.count(name)) {
+      continue;
+    }
+    LibraryTotals &totals = libraries[name];
+    Export &exported = totals.exports[symbol.name];
+    exported.size = std::max(exported.size, symbol.size);
+    exported.used |= !corpus.consumers[id].empty();
+    for (uint32_t program : corpus.consumers[id]) {
+      totals.consumers.insert(ids[program]);
+    }
+  }
+}
+
+int main(int argc, char **argv) {
+  std::string sort = "bytes";
+  size_t limit = SIZE_MAX;
+  std::vector<std::string> databases;
+  for (int i = 1; i < argc; ++i) {
+    if (strcmp(argv[i], "-s") == 0 && i + 1 < argc) {
+      sort = argv[++i];
+    } else if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+      limit = strtoul(argv[++i], nullptr, 10);
+    } else if (argv[i][0] == '-') {
+      usage();
+    } else {
+      databases.push_back(argv[i]);
+    }
+  }
+  if (databases.empty() ||
+      (sort != "bytes" && sort != "fraction" && sort != "consumers")) {
+    usage();
+  }
+
+  std::unordered_map<std::string, LibraryTotals> libraries;
+  std::unordered_map<std::string, uint32_t> program_ids;
+  for (const std::string &database : databases) {
+    sqlite3 *db;
+    if (sqlite3_open_v2(database.c_str(), &db, SQLITE_OPEN_READONLY,
+                        nullptr) != SQLITE_OK) {
+      sqlite_fail(db);
+    }
+    if (is_merged_corpus(db)) {
+      sqlite3_close(db);
+      add_corpus(database, libraries, program_ids);
+      continue;
+    }
+
+    // Repeated runs of one program count as a single consumer.
+    std::string program = database;
+    std::vector<std::string> loaded;
+    std::unordered_set<LibraryTotals *> providers;
+    // Rows mostly come grouped by library, so the last lookup is reused.
+    std::string current;
+    LibraryTotals *totals = nullptr;
+    auto totals_of = [&](const char *library) {
+      if (totals == nullptr || current != library) {
+        current = library;
+        totals = &libraries[current];
+      }
+      return totals;
+    };
+    // The program's own exports are not shared, so they are not counted.
+    read_recording(
+        db,
+        [&](const char *name, const char *path) {
+          if (strcmp(name, "main") != 0) {
+            loaded.push_back(name);
+          } else if (*path != '\0') {
+            program = path;
+          }
+        },
+        [&](const char *library, const char *name, uint64_t size) {
+          if (strcmp(library, "main") != 0) {
+            Export &symbol = totals_of(library)->exports[name];
+            symbol.size = std::max(symbol.size, size);
+          }
+        },
+        [&](const char *library, const char *symbol, const char *provider) {
+          if (strcmp(provider, "main") != 0) {
+            LibraryTotals *provided = totals_of(provider);
+            provided->exports[symbol].used = true;
+            providers.insert(provided);
+          }
+        });
+    sqlite3_close(db);
+
+    uint32_t program_id =
+        program_ids.try_emplace(program, program_ids.size()).first->second;
+    for (const std::string &name : loaded) {
+      libraries[name].loaded_by.insert(program_id);
+    }
+    for (LibraryTotals *provider : providers) {
+      provider->consumers.insert(program_id);
+    }
+  }
+
+  std::vector<Row> rows;
+  for (const auto &[name, totals] : libraries) {
+    Row row;
+    row.library = name;
+    row.loaded_by = totals.loaded_by.size();
+    row.consumers = totals.consumers.size();
+    for (const auto &[symbol, exported] : totals.exports) {
+      ++row.exports;
+      row.bytes += exported.size;
+      if (!exported.used) {
+        ++row.unused;
+        row.unused_bytes += exported.size;
+      }
+    }
+    if (row.exports > 0) {
+      rows.push_back(std::move(row));
+    }
+  }
+  std::sort(rows.begin(), rows.end(), [&](const Row &a, const Row &b) {
+    if (sort == "fraction" && a.unused_fraction() != b.unused_fraction()) {
+      return a.unused_fraction() > b.unused_fraction();
+    }
+    if (sort == "consumers" && a.consumers != b.consumers) {
+      return a.consumers > b.consumers;
+    }
+    if (a.unused_bytes != b.unused_bytes) {
+      return a.unused_bytes > b.unused_bytes;
+    }
+    return a.library < b.library;
+  });
+
+  std::cout << std::left << std::setw(32) << "library" << std::right
+            << std::setw(9) << "exports" << std::setw(9) << "unused"
+            << std::setw(12) << "bytes" << std::setw(12) << "unused"
+            << std::setw(8) << "%" << std::setw(10) << "loaded"
+            << std::setw(10) << "consumers" << std::endl;
+  uint64_t total_bytes = 0, total_unused = 0;
+  for (size_t i = 0; i < rows.size(); ++i) {
+    const Row &row = rows[i];
+    total_bytes += row.bytes;
+    total_unused += row.unused_bytes;
+    if (i >= limit) {
+      continue;
+    }
+    std::cout << std::left << std::setw(32) << row.library << std::right
+              << std::setw(9) << row.exports << std::setw(9) << row.unused
+              << std::setw(12) << row.bytes << std::setw(12)
+              << row.unused_bytes << std::setw(8) << std::fixed
+              << std::setprecision(1) << 100 * row.unused_fraction()
+              << std::setw(10) << row.loaded_by << std::setw(10)
+              << row.consumers << std::endl;
+  }
+  std::cout << total_unused << " of " << total_bytes << " exported bytes in "
+            << rows.size() << " libraries are unused by " << program_ids.size()
+            << " programs." << std::endl;
+  return 0;
+}
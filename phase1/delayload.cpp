@@ -0,0 +1,340 @@
+#include <cctype>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "corpus.h"
+#include "elffile.h"
+
+/**
+ * Generate delay-load trampolines for the cold part of a split library.
+ *
+ * The output is a C++ file to compile into the hot part (or the program).
+ * It defines every selected function of the cold part as a stub that jumps
+ * through its own slot. Each slot starts out pointing at a resolver which,
+ * on the first call, dlopen()s the cold part, looks the function up, patches
+ * the slot and jumps to it, keeping the caller's argument registers intact.
+ * Later calls cost one indirect jump, and until one happens the cold part
+ * is neither mapped nor relocated, much like a delay-loaded DLL.
+ *
+ * The functions are either the symbols of a part in a split plan (-p/-P)
+ * or given with -s, by mangled or demangled name; a demangled name without
+ * parameters selects every overload. The original library is read for the
+ * mangled names and symbol types. Data cannot be delay-loaded, so data
+ * symbols are reported and must stay in the hot part.
+ */
+
+static void usage() {
+  std::cerr << "Usage: delayload [-o file.cpp] [-d cold.so] "
+               "(-p plan.db -P part | -s symbol...) library.so"
+            << std::endl;
+  exit(1);
+}
+
+#if defined(__x86_64__)
+// Saves the argument registers (including %al for varargs and the vector
+// registers), calls the resolver with the slot in %r11 and the name in %r10
+// and jumps to the function it returns.
+static const char *const kBind = R"(
+	.text
+	.p2align 4
+	.type @BIND@, @function
+@BIND@:
+	push %rbp
+	mov %rsp, %rbp
+	push %rdi
+	push %rsi
+	push %rdx
+	push %rcx
+	push %r8
+	push %r9
+	push %rax
+	sub $136, %rsp
+	movaps %xmm0, 0(%rsp)
+	movaps %xmm1, 16(%rsp)
+	movaps %xmm2, 32(%rsp)
+	movaps %xmm3, 48(%rsp)
+	movaps %xmm4, 64(%rsp)
+	movaps %xmm5, 80(%rsp)
+	movaps %xmm6, 96(%rsp)
+	movaps %xmm7, 112(%rsp)
+	mov %r11, %rdi
+	mov %r10, %rsi
+	call @RESOLVE@
+	mov %rax, %r11
+	movaps 0(%rsp), %xmm0
+	movaps 16(%rsp), %xmm1
+	movaps 32(%rsp), %xmm2
+	movaps 48(%rsp), %xmm3
+	movaps 64(%rsp), %xmm4
+	movaps 80(%rsp), %xmm5
+	movaps 96(%rsp), %xmm6
+	movaps 112(%rsp), %xmm7
+	add $136, %rsp
+	pop %rax
+	pop %r9
+	pop %r8
+	pop %rcx
+	pop %rdx
+	pop %rsi
+	pop %rdi
+	pop %rbp
+	jmp *%r11
+	.size @BIND@, .-@BIND@
+)";
+
+static const char *const kStub = R"(
+	.text
+	.p2align 4
+	.globl @NAME@
+	.type @NAME@, @function
+@NAME@:
+	jmp *@SLOT@(%rip)
+@RESOLVE_STUB@:
+	lea @SLOT@(%rip), %r11
+	lea @STRING@(%rip), %r10
+	jmp @BIND@
+	.size @NAME@, .-@NAME@
+	.data
+	.p2align 3
+@SLOT@:
+	.quad @RESOLVE_STUB@
+	.section .rodata.str1.1, "aMS", @progbits, 1
+@STRING@:
+	.asciz "@NAME@"
+)";
+#elif defined(__aarch64__)
+// Saves x0-x8 and q0-q7, calls the resolver with the slot in x16 and the
+// name in x17 and branches to the function it returns.
+static const char *const kBind = R"(
+	.text
+	.p2align 4
+	.type @BIND@, %function
+@BIND@:
+	stp x29, x30, [sp, #-224]!
+	mov x29, sp
+	stp x0, x1, [sp, #16]
+	stp x2, x3, [sp, #32]
+	stp x4, x5, [sp, #48]
+	stp x6, x7, [sp, #64]
+	str x8, [sp, #80]
+	stp q0, q1, [sp, #96]
+	stp q2, q3, [sp, #128]
+	stp q4, q5, [sp, #160]
+	stp q6, q7, [sp, #192]
+	mov x0, x16
+	mov x1, x17
+	bl @RESOLVE@
+	mov x16, x0
+	ldp q6, q7, [sp, #192]
+	ldp q4, q5, [sp, #160]
+	ldp q2, q3, [sp, #128]
+	ldp q0, q1, [sp, #96]
+	ldr x8, [sp, #80]
+	ldp x6, x7, [sp, #64]
+	ldp x4, x5, [sp, #48]
+	ldp x2, x3, [sp, #32]
+	ldp x0, x1, [sp, #16]
+	ldp x29, x30, [sp], #224
+	br x16
+	.size @BIND@, .-@BIND@
+)";
+
+static const char *const kStub = R"(
+	.text
+	.p2align 4
+	.globl @NAME@
+	.type @NAME@, %function
+@NAME@:
+	adrp x16, @SLOT@
+	ldr x16, [x16, :lo12:@SLOT@]
+	br x16
+@RESOLVE_STUB@:
+	adrp x16, @SLOT@
+	add x16, x16, :lo12:@SLOT@
+	adrp x17, @STRING@
+	add x17, x17, :lo12:@STRING@
+	b @BIND@
+	.size @NAME@, .-@NAME@
+	.data
+	.p2align 3
+@SLOT@:
+	.xword @RESOLVE_STUB@
+	.section .rodata.str1.1, "aMS", %progbits, 1
+@STRING@:
+	.asciz "@NAME@"
+)";
+#else
+#error "Unsupported architecture"
+#endif
+
+static const char *const kResolve = R"(
+extern "C" __attribute__((visibility("hidden"), used)) void *@RESOLVE@(
+    void **slot, const char *name) {
+  static void *handle = nullptr;
+  void *library = __atomic_load_n(&handle, __ATOMIC_ACQUIRE);
+  if (library == nullptr) {
+    // Racing threads get the same handle; dlopen() counts references.
+    library = dlopen("@LIBRARY@", RTLD_NOW | RTLD_LOCAL);
+    if (library == nullptr) {
+      fprintf(stderr, "delayload: %s\n", dlerror());
+      abort();
+    }
+    __atomic_store_n(&handle, library, __ATOMIC_RELEASE);
+  }
+  void *target = dlsym(library, name);
+  if (target == nullptr) {
+    fprintf(stderr, "delayload: %s\n", dlerror());
+    abort();
+  }
+  __atomic_store_n(slot, target, __ATOMIC_RELEASE);
+  return target;
+}
+)";
+
+/** text with every @KEY@ placeholder replaced by its value. */
+static std::string substitute(
+    std::string text,
+    const std::vector<std::pair<std::string, std::string>> &replacements) {
+  for (const auto &[key, value] : replacements) {
+    for (size_t at = text.find(key); at != std::string::npos;
+         at = text.find(key, at + value.size())) {
+      text.replace(at, key.size(), value);
+    }
+  }
+  return text;
+}
+
+int main(int argc, char **argv) {
+  std::string output;
+  std::string cold;
+  std::string plan_database;
+  std::string part_name;
+  std::vector<std::string> wanted;
+  std::string library;
+  for (int i = 1; i < argc; ++i) {
+    if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+      output = argv[++i];
+    } else if (strcmp(argv[i], "-d") == 0 && i + 1 < argc) {
+      cold = argv[++i];
+    } else if (strcmp(argv[i], "-p") == 0 && i + 1 < argc) {
+      plan_database = argv[++i];
+    } else if (strcmp(argv[i], "-P") == 0 && i + 1 < argc) {
+      part_name = argv[++i];
+    } else if (strcmp(argv[i], "-s") == 0 && i + 1 < argc) {
+      wanted.push_back(argv[++i]);
+    } else if (argv[i][0] == '-' || !library.empty()) {
+      usage();
+    } else {
+      library = argv[i];
+    }
+  }
+  if (library.empty() || plan_database.empty() != part_name.empty() ||
+      plan_database.empty() == wanted.empty()) {
+    usage();
+  }
+  if (!plan_database.empty()) {
+    SplitPlan plan = SplitPlan::read(plan_database);
+    for (const SplitPlan::Part &part : plan.parts) {
+      if (part.name == part_name) {
+        wanted.insert(wanted.end(), part.symbols.begin(), part.symbols.end());
+      }
+    }
+    if (wanted.empty()) {
+      std::cerr << "No part " << part_name << " in " << plan_database
+                << std::endl;
+      return 1;
+    }
+  }
+  if (cold.empty()) {
+    cold = part_name.empty() ? library : part_name;
+  }
+  if (output.empty()) {
+    output = cold + ".delay.cpp";
+  }
+  std::set<std::string> selected(wanted.begin(), wanted.end());
+
+  ElfFile elf;
+  if (!elf.open(library)) {
+    return 1;
+  }
+  std::set<std::string> functions;
+  std::set<std::string> found;
+  size_t data = 0;
+  for (size_t i = 1; i < elf.dynamic_symbol_count(); ++i) {
+    const ElfW(Sym) &sym = elf.dynamic_symbols()[i];
+    if (sym.st_shndx == SHN_UNDEF) {
+      continue;
+    }
+    std::string name = elf.symbol_name(sym);
+    std::string demangled = demangle(name);
+    std::string match;
+    if (selected.count(name)) {
+      match = name;
+    } else if (selected.count(demangled)) {
+      match = demangled;
+    } else if (demangled.find('(') != std::string::npos &&
+               selected.count(demangled.substr(0, demangled.find('(')))) {
+      match = demangled.substr(0, demangled.find('('));
+    } else {
+      continue;
+    }
+    found.insert(match);
+    unsigned char type = ELF64_ST_TYPE(sym.st_info);
+    if (type != STT_FUNC && type != STT_GNU_IFUNC) {
+      std::cerr << demangled << " is not a function and stays in the hot part"
+                << std::endl;
+      ++data;
+      continue;
+    }
+    functions.insert(name);
+  }
+  for (const std::string &symbol : selected) {
+    if (!found.count(symbol)) {
+      std::cerr << symbol << " is not exported by " << library << std::endl;
+    }
+  }
+
+  // Symbols generated here are named after the cold part so that the stubs
+  // of several parts can be linked together.
+  std::string tag;
+  for (char c : cold) {
+    tag += isalnum(static_cast<unsigned char>(c)) ? c : '_';
+  }
+  std::string resolve = "__delayload_resolve_" + tag;
+  std::string bind = ".Ldelayload_bind_" + tag;
+
+  std::ofstream out(output);
+  if (!out) {
+    std::cerr << "Could not write " << output << std::endl;
+    return 1;
+  }
+  out << "// Delay-load trampolines for " << cold << ", generated by "
+      << "delayload from " << library << ".\n"
+      << "#include <dlfcn.h>\n\n#include <cstdio>\n#include <cstdlib>\n"
+      << substitute(kResolve, {{"@RESOLVE@", resolve}, {"@LIBRARY@", cold}})
+      << "\nasm(R\"("
+      << substitute(kBind, {{"@BIND@", bind}, {"@RESOLVE@", resolve}});
+  size_t index = 0;
+  for (const std::string &name : functions) {
+    std::string suffix = tag + "_" + std::to_string(index++);
+    out << substitute(kStub, {{"@RESOLVE_STUB@", ".Ldelayload_stub_" + suffix},
+                              {"@SLOT@", ".Ldelayload_slot_" + suffix},
+                              {"@STRING@", ".Ldelayload_name_" + suffix},
+                              {"@BIND@", bind},
+                              {"@NAME@", name}});
+  }
+  out << ")\");\n";
+  out.close();
+
+  std::cout << output << ": " << functions.size() << " functions of " << cold
+            << " delay-loaded";
+  if (data > 0) {
+    std::cout << ", " << data << " data symbols left out";
+  }
+  std::cout << std::endl;
+  return 0;
+}
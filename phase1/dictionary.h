@@ -0,0 +1,227 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+
+/**
+ * The file format of a sorted dictionary of symbol names.
+ *
+ * Demangled C++ names are long and share long prefixes, so names are
+ * sorted and front-coded: each name is stored as the length of the prefix
+ * it shares with the previous one and the rest. Every block_size names the
+ * coding restarts with a full name, and a sparse index of block offsets
+ * makes every block reachable by binary search, so lookups decode at most
+ * one block and the file is used as mapped:
+ *
+ *   DictionaryHeader
+ *   uint64_t block_offsets[blocks], from the start of the blocks
+ *   blocks: varint length, name
+ *           then block_size - 1 times: varint shared, varint length, suffix
+ *
+ * A name's id is its rank in byte order, so ids are only meaningful for
+ * one dictionary file: adding a name renumbers every later one. Recordings
+ * and merged corpora keep their own Strings ids for that reason. Varints
+ * are LEB128.
+ */
+struct DictionaryHeader {
+  char magic[8];
+  uint32_t size;
+  uint32_t block_size;
+  uint64_t data_size;
+};
+
+static constexpr char kDictionaryMagic[8] = {'R', 'S', 'D', 'I',
+                                             'C', 'T', '0', '1'};
+
+/**
+ * A read-only view of a dictionary, e.g. one that was mmap'd.
+ */
+class SymbolDictionary {
+ public:
+  SymbolDictionary() = default;
+
+  /**
+   * View the dictionary in data. Returns false if it is not a complete
+   * dictionary. Only the header and index are checked; names are decoded
+   * with bounds checks as they are read.
+   */
+  bool open(const void *data, size_t size) {
+    if (size < sizeof(DictionaryHeader)) {
+      return false;
+    }
+    header_ = static_cast<const DictionaryHeader *>(data);
+    if (memcmp(header_->magic, kDictionaryMagic, sizeof(kDictionaryMagic)) !=
+            0 ||
+        header_->block_size == 0) {
+      return false;
+    }
+    blocks_ = (uint64_t{header_->size} + header_->block_size - 1) /
+              header_->block_size;
+    size_t index = sizeof(DictionaryHeader) + blocks_ * sizeof(uint64_t);
+    if (index > size || size - index < header_->data_size) {
+      return false;
+    }
+    offsets_ = reinterpret_cast<const uint64_t *>(header_ + 1);
+    data_ = reinterpret_cast<const uint8_t *>(offsets_ + blocks_);
+    for (uint64_t block = 0; block < blocks_; ++block) {
+      if (offsets_[block] >= header_->data_size ||
+          (block > 0 && offsets_[block] <= offsets_[block - 1])) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  uint32_t size() const { return header_ == nullptr ? 0 : header_->size; }
+
+  /** The name with the given id, which must be below size(). */
+  std::string name(uint32_t id) const {
+    Cursor cursor(this, id / header_->block_size);
+    while (cursor.id() < id && cursor.next()) {
+    }
+    return cursor.name();
+  }
+
+  /** The id of name, or -1. */
+  int64_t find(std::string_view name) const {
+    Cursor cursor = seek(name);
+    if (!cursor.valid() || cursor.name() != name) {
+      return -1;
+    }
+    return cursor.id();
+  }
+
+  /** The id of the first name not less than name, or size(). */
+  uint32_t lower_bound(std::string_view name) const {
+    Cursor cursor = seek(name);
+    return cursor.valid() ? cursor.id() : size();
+  }
+
+  /**
+   * Call f(id, name) for every name starting with prefix, in order, until
+   * it returns false. Only the names visited are decoded.
+   */
+  template <typename F>
+  void scan(std::string_view prefix, F f) const {
+    for (Cursor cursor = seek(prefix); cursor.valid(); cursor.next()) {
+      std::string_view name = cursor.name();
+      if (name.substr(0, prefix.size()) != prefix ||
+          !f(cursor.id(), name)) {
+        return;
+      }
+    }
+  }
+
+ private:
+  /** Read a varint at *p, before end. */
+  static bool read_varint(const uint8_t **p, const uint8_t *end,
+                          uint64_t *value) {
+    *value = 0;
+    for (int shift = 0; *p < end && shift < 64; shift += 7) {
+      uint8_t byte = *(*p)++;
+      *value |= uint64_t{byte & 0x7fu} << shift;
+      if ((byte & 0x80) == 0) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  /** Decodes the names from the start of a block onwards. */
+  class Cursor {
+   public:
+    Cursor(const SymbolDictionary *dictionary, uint64_t block)
+        : dictionary_(dictionary) {
+      if (block >= dictionary_->blocks_) {
+        return;
+      }
+      id_ = block * dictionary_->header_->block_size;
+      p_ = dictionary_->data_ + dictionary_->offsets_[block];
+      end_ = dictionary_->data_ + dictionary_->header_->data_size;
+      valid_ = decode(0);
+    }
+
+    bool valid() const { return valid_; }
+    uint32_t id() const { return id_; }
+    const std::string &name() const { return name_; }
+
+    /** Move to the next name; false past the last one. */
+    bool next() {
+      if (!valid_) {
+        return false;
+      }
+      ++id_;
+      if (id_ >= dictionary_->size()) {
+        valid_ = false;
+      } else if (id_ % dictionary_->header_->block_size == 0) {
+        *this = Cursor(dictionary_, id_ / dictionary_->header_->block_size);
+      } else {
+        uint64_t shared;
+        valid_ = read_varint(&p_, end_, &shared) && shared <= name_.size() &&
+                 decode(shared);
+      }
+      return valid_;
+    }
+
+   private:
+    /** Read a suffix following the first shared bytes of the last name. */
+    bool decode(uint64_t shared) {
+      uint64_t length;
+      if (!read_varint(&p_, end_, &length) ||
+          length > static_cast<uint64_t>(end_ - p_)) {
+        return false;
+      }
+      name_.resize(shared);
+      name_.append(reinterpret_cast<const char *>(p_), length);
+      p_ += length;
+      return true;
+    }
+
+    const SymbolDictionary *dictionary_;
+    const uint8_t *p_ = nullptr;
+    const uint8_t *end_ = nullptr;
+    uint32_t id_ = 0;
+    std::string name_;
+    bool valid_ = false;
+  };
+
+  /** The first full name of a block, read in place. */
+  std::string_view first_name(uint64_t block) const {
+    const uint8_t *p = data_ + offsets_[block];
+    const uint8_t *end = data_ + header_->data_size;
+    uint64_t length = 0;
+    read_varint(&p, end, &length);
+    length = std::min<uint64_t>(length, end - p);
+    return std::string_view(reinterpret_cast<const char *>(p), length);
+  }
+
+  /** A cursor at the first name not less than name, if any. */
+  Cursor seek(std::string_view name) const {
+    if (size() == 0) {
+      return Cursor(this, 0);
+    }
+    // The last block starting at or before name; name can only be there.
+    uint64_t low = 0, high = blocks_;
+    while (high - low > 1) {
+      uint64_t middle = low + (high - low) / 2;
+      if (first_name(middle) <= name) {
+        low = middle;
+      } else {
+        high = middle;
+      }
+    }
+    Cursor cursor(this, low);
+    while (cursor.valid() && std::string_view(cursor.name()) < name) {
+      cursor.next();
+    }
+    return cursor;
+  }
+
+  const DictionaryHeader *header_ = nullptr;
+  const uint64_t *offsets_ = nullptr;
+  const uint8_t *data_ = nullptr;
+  uint64_t blocks_ = 0;
+};
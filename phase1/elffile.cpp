@@ -0,0 +1,276 @@
+#include "elffile.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+
+ElfFile::~ElfFile() {
+  if (data_ != nullptr) {
+    munmap(const_cast<unsigned char *>(data_), size_);
+  }
+}
+
+bool ElfFile::open(const std::string &path) {
+  path_ = path;
+  int fd = ::open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    std::cerr << "Could not open " << path << ": " << strerror(errno)
+              << std::endl;
+    return false;
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0 ||
+      static_cast<size_t>(st.st_size) < sizeof(ElfW(Ehdr))) {
+    std::cerr << path << " is not an ELF file" << std::endl;
+    close(fd);
+    return false;
+  }
+  size_ = st.st_size;
+  void *mapping = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (mapping == MAP_FAILED) {
+    std::cerr << "Could not map " << path << ": " << strerror(errno)
+              << std::endl;
+    return false;
+  }
+  data_ = static_cast<const unsigned char *>(mapping);
+
+  const ElfW(Ehdr) *ehdr = header();
+  if (memcmp(ehdr->e_ident, ELFMAG, SELFMAG) != 0 ||
+      ehdr->e_ident[EI_CLASS] != ELFCLASS64 || ehdr->e_shoff == 0 ||
+      ehdr->e_shoff + ehdr->e_shnum * sizeof(ElfW(Shdr)) > size_) {
+    std::cerr << path << " is not a 64-bit ELF file with section headers"
+              << std::endl;
+    return false;
+  }
+  sections_ = at<ElfW(Shdr)>(ehdr->e_shoff);
+  section_count_ = ehdr->e_shnum;
+  section_names_ = at<char>(sections_[ehdr->e_shstrndx].sh_offset);
+
+  if (const ElfW(Shdr) *dynsym = section(SHT_DYNSYM)) {
+    dynsym_ = at<ElfW(Sym)>(dynsym->sh_offset);
+    dynsym_count_ = dynsym->sh_size / sizeof(ElfW(Sym));
+    dynstr_ = at<char>(sections_[dynsym->sh_link].sh_offset);
+  }
+  for (const VersionDefinition &definition : version_definitions()) {
+    if (definition.index >= version_names_.size()) {
+      version_names_.resize(definition.index + 1);
+    }
+    if (!definition.base) {
+      version_names_[definition.index] = definition.name;
+    }
+  }
+  return true;
+}
+
+const ElfW(Shdr) * ElfFile::section(uint32_t type) const {
+  for (size_t i = 0; i < section_count_; ++i) {
+    if (sections_[i].sh_type == type) {
+      return &sections_[i];
+    }
+  }
+  return nullptr;
+}
+
+const ElfW(Shdr) * ElfFile::section(const std::string &name) const {
+  for (size_t i = 0; i < section_count_; ++i) {
+    if (name == section_names_ + sections_[i].sh_name) {
+      return &sections_[i];
+    }
+  }
+  return nullptr;
+}
+
+std::string ElfFile::soname() const {
+  if (const ElfW(Shdr) *dynamic = section(SHT_DYNAMIC)) {
+    const ElfW(Dyn) *dyn = at<ElfW(Dyn)>(dynamic->sh_offset);
+    const char *strtab = at<char>(sections_[dynamic->sh_link].sh_offset);
+    for (; dyn->d_tag != DT_NULL; ++dyn) {
+      if (dyn->d_tag == DT_SONAME) {
+        return strtab + dyn->d_un.d_val;
+      }
+    }
+  }
+  return std::filesystem::path(path_).filename().string();
+}
+
+std::vector<std::string> ElfFile::needed() const {
+  std::vector<std::string> result;
+  if (const ElfW(Shdr) *dynamic = section(SHT_DYNAMIC)) {
+    const ElfW(Dyn) *dyn = at<ElfW(Dyn)>(dynamic->sh_offset);
+    const char *strtab = at<char>(sections_[dynamic->sh_link].sh_offset);
+    for (; dyn->d_tag != DT_NULL; ++dyn) {
+      if (dyn->d_tag == DT_NEEDED) {
+        result.push_back(strtab + dyn->d_un.d_val);
+      }
+    }
+  }
+  return result;
+}
+
+std::vector<ElfFile::VersionDefinition> ElfFile::version_definitions() const {
+  std::vector<VersionDefinition> result;
+  const ElfW(Shdr) *verdef_section = section(SHT_GNU_verdef);
+  if (verdef_section == nullptr) {
+    return result;
+  }
+  const char *strtab = at<char>(sections_[verdef_section->sh_link].sh_offset);
+  ElfW(Off) offset = verdef_section->sh_offset;
+  for (size_t i = 0; i < verdef_section->sh_info; ++i) {
+    const ElfW(Verdef) *verdef = at<ElfW(Verdef)>(offset);
+    VersionDefinition definition{verdef->vd_ndx, "", {},
+                                 (verdef->vd_flags & VER_FLG_BASE) != 0};
+    ElfW(Off) aux_offset = offset + verdef->vd_aux;
+    for (size_t j = 0; j < verdef->vd_cnt; ++j) {
+      const ElfW(Verdaux) *aux = at<ElfW(Verdaux)>(aux_offset);
+      if (j == 0) {
+        definition.name = strtab + aux->vda_name;
+      } else {
+        definition.parents.push_back(strtab + aux->vda_name);
+      }
+      aux_offset += aux->vda_next;
+    }
+    result.push_back(std::move(definition));
+    if (verdef->vd_next == 0) {
+      break;
+    }
+    offset += verdef->vd_next;
+  }
+  return result;
+}
+
+std::string ElfFile::symbol_version(size_t index, bool *hidden) const {
+  const ElfW(Shdr) *versym_section = section(SHT_GNU_versym);
+  if (hidden != nullptr) {
+    *hidden = false;
+  }
+  if (versym_section == nullptr || index >= dynsym_count_) {
+    return "";
+  }
+  ElfW(Half) versym = at<ElfW(Half)>(versym_section->sh_offset)[index];
+  if (hidden != nullptr) {
+    *hidden = (versym & 0x8000) != 0;
+  }
+  versym &= 0x7fff;
+  // Imported symbols are versioned through .gnu.version_r instead.
+  return versym < version_names_.size() ? version_names_[versym] : "";
+}
+
+std::vector<ElfFile::RelocationCounts> ElfFile::relocation_counts() const {
+  std::vector<RelocationCounts> counts(dynsym_count_);
+  for (size_t i = 0; i < section_count_; ++i) {
+    const ElfW(Shdr) &shdr = sections_[i];
+    if (shdr.sh_type != SHT_RELA || sections_[shdr.sh_link].sh_type !=
+                                        SHT_DYNSYM) {
+      continue;
+    }
+    const ElfW(Rela) *rela = at<ElfW(Rela)>(shdr.sh_offset);
+    for (size_t j = 0; j < shdr.sh_size / sizeof(ElfW(Rela)); ++j) {
+      size_t symbol = ELF64_R_SYM(rela[j].r_info);
+      if (symbol == 0 || symbol >= counts.size()) {
+        continue;
+      }
+#if defined(__aarch64__)
+      bool plt = ELF64_R_TYPE(rela[j].r_info) == R_AARCH64_JUMP_SLOT;
+#else
+      bool plt = ELF64_R_TYPE(rela[j].r_info) == R_X86_64_JUMP_SLOT;
+#endif
+      ++(plt ? counts[symbol].plt : counts[symbol].other);
+    }
+  }
+  return counts;
+}
+
+const uint32_t *ElfFile::gnu_hash() const {
+  const ElfW(Shdr) *hash = section(SHT_GNU_HASH);
+  return hash == nullptr ? nullptr : at<uint32_t>(hash->sh_offset);
+}
+
+ElfFile::GnuHashLayout ElfFile::gnu_hash_layout(size_t nsyms) {
+  static const uint32_t elf_buckets[] = {1,    3,    17,   37,    67,    97,
+                                         131,  197,  263,  521,   1031,  2053,
+                                         4099, 8209, 16411, 32771, 0};
+  GnuHashLayout layout;
+  layout.nbuckets = 1;
+  for (size_t i = 0; elf_buckets[i] != 0; ++i) {
+    layout.nbuckets = elf_buckets[i];
+    if (nsyms < elf_buckets[i + 1]) {
+      break;
+    }
+  }
+
+  // bfd_log2() rounds up.
+  uint32_t maskbitslog2 = 0;
+  while ((size_t{1} << maskbitslog2) < nsyms) {
+    ++maskbitslog2;
+  }
+  maskbitslog2 += 1;
+  if (maskbitslog2 < 3) {
+    maskbitslog2 = 5;
+  } else if ((size_t{1} << (maskbitslog2 - 2)) & nsyms) {
+    maskbitslog2 += 3;
+  } else {
+    maskbitslog2 += 2;
+  }
+  // 64 bits per bloom word on ELFCLASS64.
+  layout.bloom_words = maskbitslog2 > 6 ? 1u << (maskbitslog2 - 6) : 1;
+  layout.bloom_shift = maskbitslog2;
+  return layout;
+}
+
+// A node that hides nothing.
+static const std::set<std::string> kNoNames;
+
+void write_version_script(
+    std::ostream &out,
+    const std::vector<ElfFile::VersionDefinition> &versions,
+    const std::map<std::string, std::set<std::string>> &names,
+    const std::set<std::string> &hidden) {
+  // A null local hides everything the script does not name.
+  auto write_node = [&out](const std::string &version,
+                           const std::set<std::string> *node_names,
+                           const std::set<std::string> *local,
+                           const std::vector<std::string> &parents) {
+    out << (version.empty() ? "" : version + " ") << "{\n";
+    if (node_names != nullptr && !node_names->empty()) {
+      out << "  global:\n";
+      for (const std::string &name : *node_names) {
+        out << "    " << name << ";\n";
+      }
+    }
+    if (local == nullptr) {
+      out << "  local:\n    *;\n";
+    } else if (!local->empty()) {
+      out << "  local:\n";
+      for (const std::string &name : *local) {
+        out << "    " << name << ";\n";
+      }
+    }
+    out << "}";
+    for (const std::string &parent : parents) {
+      out << " " << parent;
+    }
+    out << ";\n";
+  };
+  auto node_names = [&names](const std::string &version) {
+    auto it = names.find(version);
+    return it == names.end() ? nullptr : &it->second;
+  };
+
+  bool named = false;
+  for (const auto &version : versions) {
+    if (!version.base) {
+      write_node(version.name, node_names(version.name),
+                 named ? &kNoNames : &hidden, version.parents);
+      named = true;
+    }
+  }
+  if (!named) {
+    write_node("", node_names(""), nullptr, {});
+  }
+}
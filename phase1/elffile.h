@@ -0,0 +1,140 @@
+#pragma once
+
+#include <elf.h>
+#include <link.h>
+
+#include <cstdint>
+#include <map>
+#include <ostream>
+#include <set>
+#include <string>
+#include <vector>
+
+/**
+ * A read-only view of a shared object on disk.
+ *
+ * The audit library sees objects through the dynamic section once they are
+ * mapped; the offline tools instead open the recorded Path and find the same
+ * tables (.dynsym, .dynstr, .gnu.hash, symbol versions and relocations)
+ * through the section headers. The file is mmap'd so nothing is copied.
+ */
+class ElfFile {
+ public:
+  /** A version node from .gnu.version_d, e.g. GLIBC_2.2.5. */
+  struct VersionDefinition {
+    uint16_t index;
+    std::string name;
+    // The nodes this one inherits from, as listed after its name.
+    std::vector<std::string> parents;
+    // The node naming the object itself rather than a version.
+    bool base;
+  };
+
+  ElfFile() = default;
+  ElfFile(const ElfFile &) = delete;
+  ElfFile &operator=(const ElfFile &) = delete;
+  ~ElfFile();
+
+  /** Map the file at path. Returns false (and says why) if it is unusable. */
+  bool open(const std::string &path);
+
+  const std::string &path() const { return path_; }
+
+  /** The section of the given type (e.g. SHT_DYNSYM), or nullptr. */
+  const ElfW(Shdr) * section(uint32_t type) const;
+
+  /** The section with the given name (e.g. .text), or nullptr. */
+  const ElfW(Shdr) * section(const std::string &name) const;
+
+  template <typename T>
+  const T *at(ElfW(Off) offset) const {
+    return reinterpret_cast<const T *>(data_ + offset);
+  }
+
+  const ElfW(Ehdr) * header() const { return at<ElfW(Ehdr)>(0); }
+
+  const ElfW(Sym) * dynamic_symbols() const { return dynsym_; }
+  size_t dynamic_symbol_count() const { return dynsym_count_; }
+  const char *symbol_name(const ElfW(Sym) & sym) const {
+    return dynstr_ + sym.st_name;
+  }
+
+  /** The DT_SONAME, or the file name when there is none. */
+  std::string soname() const;
+
+  /** The DT_NEEDED entries in order. */
+  std::vector<std::string> needed() const;
+
+  std::vector<VersionDefinition> version_definitions() const;
+
+  /**
+   * The version node of the dynamic symbol at index, or "" if unversioned.
+   * hidden is set for symbols only reachable as name@VERSION.
+   */
+  std::string symbol_version(size_t index, bool *hidden = nullptr) const;
+
+  /** The dynamic relocations that refer to one dynamic symbol. */
+  struct RelocationCounts {
+    // PLT slots, which go away once the symbol is local: calls to it are
+    // then made directly.
+    uint32_t plt = 0;
+    // Everything else, e.g. GOT entries and pointers in data. Once the
+    // symbol is local these become relative relocations, which need no
+    // symbol lookup but are still applied.
+    uint32_t other = 0;
+  };
+
+  /** For each dynamic symbol, the dynamic relocations that refer to it. */
+  std::vector<RelocationCounts> relocation_counts() const;
+
+  /** The contents of .gnu.hash, or nullptr if there is none. */
+  const uint32_t *gnu_hash() const;
+
+  /** The shape of a .gnu.hash table, see gnu_hash_layout(). */
+  struct GnuHashLayout {
+    uint32_t nbuckets;
+    uint32_t bloom_words;
+    uint32_t bloom_shift;
+
+    /** The size of the section for nsyms hashed symbols. */
+    size_t bytes(size_t nsyms) const {
+      return 16 + bloom_words * sizeof(ElfW(Addr)) + nbuckets * 4 + nsyms * 4;
+    }
+  };
+
+  /**
+   * The .gnu.hash shape GNU ld picks for nsyms exported symbols, from
+   * bfd's compute_bucket_count() and bfd_elf_size_dynamic_sections().
+   */
+  static GnuHashLayout gnu_hash_layout(size_t nsyms);
+
+ private:
+  std::string path_;
+  const unsigned char *data_ = nullptr;
+  size_t size_ = 0;
+  const ElfW(Shdr) *sections_ = nullptr;
+  size_t section_count_ = 0;
+  const char *section_names_ = nullptr;
+  const ElfW(Sym) *dynsym_ = nullptr;
+  size_t dynsym_count_ = 0;
+  const char *dynstr_ = nullptr;
+  // Version node names indexed by their .gnu.version index.
+  std::vector<std::string> version_names_;
+};
+
+/**
+ * Write a --version-script that exports names and hides everything else.
+ *
+ * names holds mangled names by the version node of versions they belong to,
+ * "" for unversioned ones. Every node of versions is written, even if
+ * empty, so binaries that require one still find it, and no other: the
+ * unversioned names are left out of every node, which keeps them
+ * unversioned. For a versioned object `local: *` would hide them as well,
+ * so it is only used without nodes; otherwise the first node lists hidden,
+ * the mangled names to hide, under `local:`.
+ */
+void write_version_script(
+    std::ostream &out,
+    const std::vector<ElfFile::VersionDefinition> &versions,
+    const std::map<std::string, std::set<std::string>> &names,
+    const std::set<std::string> &hidden);
@@ -0,0 +1,7 @@
+#include "simpleshared.h"
+
+#include <iostream>
+
+void StandardOutPrinter::print(std::string val) const {
+  std::cout << val << std::endl;
+}
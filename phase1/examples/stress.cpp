@@ -0,0 +1,212 @@
+#include <dlfcn.h>
+#include <spawn.h>
+#include <sys/wait.h>
+
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "sqlite3.h"
+#include "stressshared.h"
+
+/**
+ * Stress benchmark for the audit library under lazy binding.
+ *
+ * Run as `stress worker` it starts kThreads threads which wait on a common
+ * start signal and then call every function in libstressshared.so, so that
+ * they race each other through the unresolved PLT slots and la_symbind64 runs
+ * concurrently. Each thread then looks every function up with dlsym(), which
+ * binds through la_symbind64 on every call, so each thread makes at least
+ * kStressFunctionCount bindings of its own. Last, each thread looks up
+ * kOwnFunctions functions that no other thread binds.
+ *
+ * Run as `stress [path/to/recordsymbolslib.so]` it times the worker with and
+ * without LD_AUDIT and then checks that database.db recorded a usage for
+ * every one of the functions, including every thread's own ones, which go
+ * missing if a thread's buffer is lost, and that the bindings of every
+ * thread were counted.
+ */
+
+extern char **environ;
+
+constexpr int kThreads = 64;
+constexpr int kRuns = 5;
+// Thread i binds stress_own_fn_ followed by i in two octal digits and then
+// each octal digit, as STRESS_OWN_FUNCTIONS() names them.
+constexpr int kOwnFunctions = 8;
+static_assert(kThreads * kOwnFunctions == kStressFunctionCount,
+              "every own function belongs to exactly one thread");
+
+#define STRESS_CALL(name) total += name(x);
+static long call_all(int x) {
+  long total = 0;
+  STRESS_FUNCTIONS(STRESS_CALL)
+  return total;
+}
+
+#define STRESS_LOOKUP(name) found += dlsym(RTLD_DEFAULT, #name) != nullptr;
+static int look_up_all() {
+  int found = 0;
+  STRESS_FUNCTIONS(STRESS_LOOKUP)
+  return found;
+}
+
+static int look_up_own(int thread) {
+  int found = 0;
+  for (int i = 0; i < kOwnFunctions; ++i) {
+    std::string name = "stress_own_fn_" + std::to_string(thread / 8) +
+                       std::to_string(thread % 8) + std::to_string(i);
+    found += dlsym(RTLD_DEFAULT, name.c_str()) != nullptr;
+  }
+  return found;
+}
+
+static int worker() {
+  std::mutex mutex;
+  std::condition_variable start;
+  bool started = false;
+  std::vector<long> totals(kThreads);
+  std::vector<int> found(kThreads);
+
+  std::vector<std::thread> threads;
+  for (int i = 0; i < kThreads; ++i) {
+    threads.emplace_back([&, i]() {
+      {
+        std::unique_lock<std::mutex> lock(mutex);
+        start.wait(lock, [&]() { return started; });
+      }
+      totals[i] = call_all(i);
+      found[i] = look_up_all() + look_up_own(i);
+    });
+  }
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    started = true;
+  }
+  start.notify_all();
+  for (auto &thread : threads) {
+    thread.join();
+  }
+
+  for (int i = 0; i < kThreads; ++i) {
+    if (totals[i] != static_cast<long>(i + 1) * kStressFunctionCount) {
+      std::cerr << "Thread " << i << " computed " << totals[i] << std::endl;
+      return 1;
+    }
+    if (found[i] != kStressFunctionCount + kOwnFunctions) {
+      std::cerr << "Thread " << i << " found " << found[i] << " functions"
+                << std::endl;
+      return 1;
+    }
+  }
+  return 0;
+}
+
+/** Spawn `self worker`, adding audit_library to LD_AUDIT when non-empty. */
+static double run_worker(const char *self, const std::string &audit_library) {
+  std::vector<std::string> env_storage;
+  for (char **env = environ; *env != nullptr; ++env) {
+    if (strncmp(*env, "LD_AUDIT=", 9) == 0 ||
+        strncmp(*env, "LD_BIND_NOW=", 12) == 0) {
+      continue;
+    }
+    env_storage.emplace_back(*env);
+  }
+  if (!audit_library.empty()) {
+    env_storage.push_back("LD_AUDIT=" + audit_library);
+  }
+  std::vector<char *> envp;
+  for (auto &entry : env_storage) {
+    envp.push_back(entry.data());
+  }
+  envp.push_back(nullptr);
+
+  std::string worker_arg = "worker";
+  char *argv[] = {const_cast<char *>(self), worker_arg.data(), nullptr};
+
+  auto begin = std::chrono::steady_clock::now();
+  pid_t pid;
+  if (posix_spawn(&pid, self, nullptr, nullptr, argv, envp.data()) != 0) {
+    std::cerr << "Could not spawn " << self << std::endl;
+    exit(1);
+  }
+  int status;
+  waitpid(pid, &status, 0);
+  auto end = std::chrono::steady_clock::now();
+  if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+    std::cerr << "Worker failed with status " << status << std::endl;
+    exit(1);
+  }
+  return std::chrono::duration<double, std::milli>(end - begin).count();
+}
+
+/** The single integer the query returns from database.db. */
+static int64_t query_recording(const char *sql) {
+  sqlite3 *db;
+  if (sqlite3_open_v2("database.db", &db, SQLITE_OPEN_READONLY, nullptr) !=
+      SQLITE_OK) {
+    std::cerr << sqlite3_errmsg(db) << std::endl;
+    exit(1);
+  }
+  sqlite3_stmt *stmt;
+  int error = sqlite3_prepare_v2(db, sql, -1, &stmt, nullptr);
+  if (error != SQLITE_OK || sqlite3_step(stmt) != SQLITE_ROW) {
+    std::cerr << sqlite3_errmsg(db) << std::endl;
+    exit(1);
+  }
+  int64_t value = sqlite3_column_int64(stmt, 0);
+  sqlite3_finalize(stmt);
+  sqlite3_close(db);
+  return value;
+}
+
+int main(int argc, char **argv) {
+  if (argc > 1 && std::string(argv[1]) == "worker") {
+    return worker();
+  }
+  std::string audit_library = argc > 1 ? argv[1] : "../recordsymbolslib.so";
+
+  double plain = 0;
+  double audited = 0;
+  for (int run = 0; run < kRuns; ++run) {
+    plain += run_worker(argv[0], "");
+    audited += run_worker(argv[0], audit_library);
+  }
+  plain /= kRuns;
+  audited /= kRuns;
+
+  std::cout << kThreads << " threads x " << kStressFunctionCount
+            << " lazily bound functions" << std::endl;
+  std::cout << "plain:   " << plain << " ms" << std::endl;
+  std::cout << "audited: " << audited << " ms (+" << (audited - plain)
+            << " ms)" << std::endl;
+
+  int64_t recorded = query_recording(
+      "SELECT COUNT(DISTINCT Symbol) FROM NamedUsages "
+      "WHERE Library = 'main' AND Symbol LIKE 'stress_fn_%';");
+  std::cout << "recorded " << recorded << "/" << kStressFunctionCount
+            << " functions" << std::endl;
+  // A thread's own functions are only recorded from its own buffer.
+  int64_t own = query_recording(
+      "SELECT COUNT(DISTINCT Symbol) FROM NamedUsages "
+      "WHERE Library = 'main' AND Symbol LIKE 'stress_own_fn_%';");
+  std::cout << "recorded " << own << "/" << kThreads * kOwnFunctions
+            << " functions bound by a single thread" << std::endl;
+  // Every lazily bound call site, and every lookup of every thread. Races
+  // through the same PLT slot may bind it more than once.
+  int64_t expected = (kThreads + 1) * int64_t{kStressFunctionCount};
+  int64_t bindings = query_recording(
+      "SELECT COALESCE(SUM(Calls), 0) FROM AuditOverhead "
+      "WHERE Callback LIKE 'la_symbind%';");
+  std::cout << "recorded " << bindings << " bindings, expected at least "
+            << expected << std::endl;
+  return recorded == kStressFunctionCount &&
+                 own == kThreads * kOwnFunctions && bindings >= expected
+             ? 0
+             : 1;
+}
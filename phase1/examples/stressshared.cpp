@@ -0,0 +1,8 @@
+#include "stressshared.h"
+
+#define STRESS_DEFINE(name) \
+  int name(int x) { return x + 1; }
+extern "C" {
+STRESS_FUNCTIONS(STRESS_DEFINE)
+STRESS_OWN_FUNCTIONS(STRESS_DEFINE)
+}
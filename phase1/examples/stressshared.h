@@ -0,0 +1,28 @@
+#pragma once
+
+/**
+ * X-macros over the functions exported by libstressshared.so.
+ * Names are built digit by digit so the list never has to be spelled out.
+ */
+#define STRESS_EXPAND8(F, p) \
+  F(p##0) F(p##1) F(p##2) F(p##3) F(p##4) F(p##5) F(p##6) F(p##7)
+#define STRESS_EXPAND64(F, p)                                            \
+  STRESS_EXPAND8(F, p##0) STRESS_EXPAND8(F, p##1) STRESS_EXPAND8(F, p##2) \
+  STRESS_EXPAND8(F, p##3) STRESS_EXPAND8(F, p##4) STRESS_EXPAND8(F, p##5) \
+  STRESS_EXPAND8(F, p##6) STRESS_EXPAND8(F, p##7)
+#define STRESS_EXPAND512(F, p)                                              \
+  STRESS_EXPAND64(F, p##0) STRESS_EXPAND64(F, p##1) STRESS_EXPAND64(F, p##2) \
+  STRESS_EXPAND64(F, p##3) STRESS_EXPAND64(F, p##4) STRESS_EXPAND64(F, p##5) \
+  STRESS_EXPAND64(F, p##6) STRESS_EXPAND64(F, p##7)
+#define STRESS_FUNCTIONS(F) STRESS_EXPAND512(F, stress_fn_)
+// As many again, which stress hands out to its threads a few each so that
+// every thread binds some symbols no other thread does.
+#define STRESS_OWN_FUNCTIONS(F) STRESS_EXPAND512(F, stress_own_fn_)
+
+constexpr int kStressFunctionCount = 512;
+
+#define STRESS_DECLARE(name) int name(int x);
+extern "C" {
+STRESS_FUNCTIONS(STRESS_DECLARE)
+STRESS_OWN_FUNCTIONS(STRESS_DECLARE)
+}
@@ -0,0 +1,140 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+/**
+ * Read the cheapest monotonic counter the platform offers.
+ *
+ * The time stamp counter and cntvct_el0 tick at one rate on every core and
+ * in every process, so recordsymbols-top can convert the cycles a recorder
+ * publishes with its own reading.
+ */
+static inline uint64_t read_cycles() {
+#if defined(__x86_64__) || defined(__i386__)
+  return __rdtsc();
+#elif defined(__aarch64__)
+  uint64_t cycles;
+  asm volatile("mrs %0, cntvct_el0" : "=r"(cycles));
+  return cycles;
+#else
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+#endif
+}
+
+/**
+ * The shared-memory segment a recorder publishes its counters in while the
+ * process runs, with RECORDSYMBOLS_LIVE, for recordsymbols-top to read.
+ *
+ *   LiveHeader
+ *   LiveLibrary libraries[capacity]
+ *
+ * Only the audited process writes. Counters are relaxed atomics that are
+ * bumped in place, so a reader never blocks it or makes it wait and each
+ * counter it reads is exact, though two counters may be from slightly
+ * different moments.
+ *
+ * A library's slot is claimed in la_objopen(), which publishes it by
+ * raising libraries with release ordering. Its name and symbol count are
+ * written under the slot's sequence number: it is odd while la_objopen()
+ * runs and even once they are complete. Readers copy them, then check the
+ * sequence was even and unchanged, and retry otherwise; see
+ * read_live_library().
+ */
+struct LiveHeader {
+  char magic[8];
+  uint32_t capacity;
+  int32_t pid;
+  // read_cycles() and the steady clock in nanoseconds when the recorder was
+  // loaded, to convert cycles into time.
+  uint64_t start_cycles;
+  uint64_t start_nanoseconds;
+  // Slots in use.
+  std::atomic<uint32_t> libraries;
+  // Libraries loaded once every slot was in use; they are not counted.
+  std::atomic<uint32_t> dropped;
+  // Set once the process has exited.
+  std::atomic<uint32_t> exited;
+  // Time spent in every callback, including those not charged to a library.
+  std::atomic<uint64_t> callback_cycles;
+};
+
+struct alignas(64) LiveLibrary {
+  std::atomic<uint32_t> sequence;
+  // NUL-terminated, cut short if needed.
+  char name[116];
+  // The symbols the library defines.
+  uint64_t symbols;
+  // Bindings the library provided and made.
+  std::atomic<uint64_t> bindings;
+  std::atomic<uint64_t> imports;
+  // Calls into the library through a PLT slot; only the RECORD_PLT_CALLS
+  // build counts these.
+  std::atomic<uint64_t> plt_calls;
+  // Time spent opening the library and binding or calling into it.
+  std::atomic<uint64_t> callback_cycles;
+};
+
+static_assert(std::atomic<uint64_t>::is_always_lock_free,
+              "counters must be lock-free to be shared between processes");
+
+static constexpr char kLiveMagic[8] = {'R', 'S', 'L', 'I', 'V', 'E', '0', '1'};
+
+/** The size of a segment with room for capacity libraries. */
+inline size_t live_counters_size(uint32_t capacity) {
+  return sizeof(LiveHeader) + size_t{capacity} * sizeof(LiveLibrary);
+}
+
+inline LiveLibrary *live_libraries(LiveHeader *header) {
+  return reinterpret_cast<LiveLibrary *>(
+      reinterpret_cast<char *>(header) + sizeof(LiveHeader));
+}
+
+inline const LiveLibrary *live_libraries(const LiveHeader *header) {
+  return live_libraries(const_cast<LiveHeader *>(header));
+}
+
+/** A copy of a slot taken by a reader. */
+struct LiveLibrarySnapshot {
+  std::string name;
+  uint64_t symbols = 0;
+  uint64_t bindings = 0;
+  uint64_t imports = 0;
+  uint64_t plt_calls = 0;
+  uint64_t callback_cycles = 0;
+};
+
+/**
+ * Copy a slot published by the header. Returns false if la_objopen() has
+ * not finished with it yet.
+ */
+inline bool read_live_library(const LiveLibrary &library,
+                              LiveLibrarySnapshot *snapshot) {
+  uint32_t sequence = library.sequence.load(std::memory_order_acquire);
+  if (sequence % 2 != 0) {
+    return false;
+  }
+  char name[sizeof(library.name)];
+  memcpy(name, library.name, sizeof(name));
+  uint64_t symbols = library.symbols;
+  std::atomic_thread_fence(std::memory_order_acquire);
+  if (library.sequence.load(std::memory_order_relaxed) != sequence) {
+    return false;
+  }
+  snapshot->name.assign(name, strnlen(name, sizeof(name)));
+  snapshot->symbols = symbols;
+  snapshot->bindings = library.bindings.load(std::memory_order_relaxed);
+  snapshot->imports = library.imports.load(std::memory_order_relaxed);
+  snapshot->plt_calls = library.plt_calls.load(std::memory_order_relaxed);
+  snapshot->callback_cycles =
+      library.callback_cycles.load(std::memory_order_relaxed);
+  return true;
+}
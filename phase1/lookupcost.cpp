@@ -0,0 +1,490 @@
+#include <algorithm>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "corpus.h"
+#include "elffile.h"
+
+/**
+ * Predict what a split does to symbol lookup in the dynamic linker.
+ *
+ * Every recorded binding is looked up again the way ld.so does it: through
+ * the global scope in load order (the program first, the dynamic linker
+ * last), checking each object's .gnu.hash bloom filter, then walking its
+ * hash chain and comparing the names whose hashes match, until the object
+ * defining the symbol is reached. The tables are read from the recorded
+ * paths on disk, so the counts are those of the real objects.
+ *
+ * With a split plan (-p) the same bindings are replayed once more with each
+ * split library replaced, at its place in the scope, by the parts the
+ * program binds to, each given the .gnu.hash GNU ld would build for it. This
+ * is the layout of programs relinked against the parts; shims add a lookup
+ * in the filter before each forwarded one.
+ */
+
+static void usage() {
+  std::cerr << "Usage: lookupcost [-p plan.db] database.db..." << std::endl;
+  exit(1);
+}
+
+/** What one process looked up, in the order of its global scope. */
+struct Workload {
+  std::string program;
+  // The name and path of every object loaded, the program first.
+  std::vector<std::pair<std::string, std::string>> scope;
+  // The symbol and the library providing it, for every binding.
+  std::vector<std::pair<std::string, std::string>> bindings;
+};
+
+/** The work done by lookups, as counted by lookup(). */
+struct Cost {
+  uint64_t bindings = 0;
+  uint64_t objects = 0;
+  uint64_t bloom_passes = 0;
+  uint64_t chain_entries = 0;
+  uint64_t names = 0;
+  uint64_t not_found = 0;
+};
+
+/** A .gnu.hash table and the names of the symbols it indexes. */
+struct HashTable {
+  uint32_t shift = 0;
+  std::vector<uint64_t> bloom;
+  std::vector<uint32_t> buckets;
+  uint32_t symoffset = 0;
+  // The hash of symbol i, with the low bit marking the end of its chain,
+  // is chain[i - symoffset].
+  std::vector<uint32_t> chain;
+  std::vector<std::string_view> names;
+  // Backs names for tables that were not read from a file.
+  std::vector<std::string> storage;
+};
+
+/** dl_new_hash() from glibc. */
+static uint32_t gnu_hash(std::string_view name) {
+  uint32_t h = 5381;
+  for (unsigned char c : name) {
+    h = h * 33 + c;
+  }
+  return h;
+}
+
+/** Fill table from the .gnu.hash of elf. Returns false if it has none. */
+static bool read_table(const ElfFile &elf, HashTable &table) {
+  const uint32_t *hash = elf.gnu_hash();
+  if (hash == nullptr) {
+    return false;
+  }
+  uint32_t nbuckets = hash[0];
+  table.symoffset = hash[1];
+  uint32_t bloom_words = hash[2];
+  table.shift = hash[3];
+  const uint64_t *bloom = reinterpret_cast<const uint64_t *>(hash + 4);
+  table.bloom.assign(bloom, bloom + bloom_words);
+  const uint32_t *buckets = reinterpret_cast<const uint32_t *>(bloom +
+                                                               bloom_words);
+  table.buckets.assign(buckets, buckets + nbuckets);
+  const uint32_t *chain = buckets + nbuckets;
+  size_t count = elf.dynamic_symbol_count();
+  if (count > table.symoffset) {
+    table.chain.assign(chain, chain + (count - table.symoffset));
+  }
+  for (size_t i = 0; i < count; ++i) {
+    const ElfW(Sym) &sym = elf.dynamic_symbols()[i];
+    table.names.push_back(sym.st_shndx == SHN_UNDEF ? std::string_view()
+                                                    : elf.symbol_name(sym));
+  }
+  return true;
+}
+
+/** Fill table the way GNU ld would for the given exports. */
+static void build_table(std::vector<std::string> names, HashTable &table) {
+  ElfFile::GnuHashLayout layout = ElfFile::gnu_hash_layout(names.size());
+  table.shift = layout.bloom_shift;
+  table.bloom.assign(layout.bloom_words, 0);
+  table.buckets.assign(layout.nbuckets, 0);
+  // Symbol 0 is the null symbol, and ld sorts the rest by bucket.
+  table.symoffset = 1;
+  std::stable_sort(names.begin(), names.end(),
+                   [&](const std::string &a, const std::string &b) {
+                     return gnu_hash(a) % layout.nbuckets <
+                            gnu_hash(b) % layout.nbuckets;
+                   });
+  table.storage = std::move(names);
+  table.names.assign(1, std::string_view());
+  for (size_t i = 0; i < table.storage.size(); ++i) {
+    const std::string &name = table.storage[i];
+    uint32_t h = gnu_hash(name);
+    uint32_t bucket = h % layout.nbuckets;
+    table.names.push_back(name);
+    uint64_t &word = table.bloom[(h / 64) % layout.bloom_words];
+    word |= uint64_t{1} << (h % 64);
+    word |= uint64_t{1} << ((h >> layout.bloom_shift) % 64);
+    if (table.buckets[bucket] == 0) {
+      table.buckets[bucket] = i + table.symoffset;
+    }
+    bool last = i + 1 == table.storage.size() ||
+                gnu_hash(table.storage[i + 1]) % layout.nbuckets != bucket;
+    table.chain.push_back((h & ~1u) | (last ? 1 : 0));
+  }
+}
+
+/**
+ * Look name up in the objects of scope as do_lookup_x() does, adding the
+ * work done to cost. Returns the index of the defining object, or -1.
+ */
+static int64_t lookup(const std::vector<const HashTable *> &scope,
+                      std::string_view name, Cost &cost) {
+  uint32_t h = gnu_hash(name);
+  for (size_t i = 0; i < scope.size(); ++i) {
+    const HashTable &table = *scope[i];
+    ++cost.objects;
+    if (table.bloom.empty() || table.buckets.empty()) {
+      continue;
+    }
+    uint64_t word = table.bloom[(h / 64) & (table.bloom.size() - 1)];
+    if (((word >> (h % 64)) & (word >> ((h >> table.shift) % 64)) & 1) == 0) {
+      continue;
+    }
+    ++cost.bloom_passes;
+    uint32_t symbol = table.buckets[h % table.buckets.size()];
+    if (symbol < table.symoffset) {
+      continue;
+    }
+    for (; symbol - table.symoffset < table.chain.size(); ++symbol) {
+      uint32_t entry = table.chain[symbol - table.symoffset];
+      ++cost.chain_entries;
+      if (((entry ^ h) >> 1) == 0 && symbol < table.names.size() &&
+          !table.names[symbol].empty()) {
+        ++cost.names;
+        if (table.names[symbol] == name) {
+          return i;
+        }
+      }
+      if (entry & 1) {
+        break;
+      }
+    }
+  }
+  return -1;
+}
+
+/** An object of the corpus as found on disk. */
+struct Object {
+  bool usable = false;
+  ElfFile elf;
+  HashTable table;
+  // The mangled names of the defined exports by their recorded name, the
+  // default version first.
+  std::unordered_map<std::string, std::vector<std::string>> mangled;
+  std::string interpreter;
+};
+
+static Object &object(
+    std::unordered_map<std::string, std::unique_ptr<Object>> &objects,
+    const std::string &path) {
+  std::unique_ptr<Object> &object = objects[path];
+  if (object != nullptr) {
+    return *object;
+  }
+  object = std::make_unique<Object>();
+  if (path.empty() || !object->elf.open(path)) {
+    return *object;
+  }
+  const ElfFile &elf = object->elf;
+  object->usable = read_table(elf, object->table);
+  for (size_t i = 1; i < elf.dynamic_symbol_count(); ++i) {
+    const ElfW(Sym) &sym = elf.dynamic_symbols()[i];
+    if (sym.st_shndx == SHN_UNDEF) {
+      continue;
+    }
+    bool hidden = false;
+    elf.symbol_version(i, &hidden);
+    std::vector<std::string> &names =
+        object->mangled[demangle(elf.symbol_name(sym))];
+    names.insert(hidden ? names.end() : names.begin(), elf.symbol_name(sym));
+  }
+  const ElfW(Ehdr) *header = elf.header();
+  for (size_t i = 0; i < header->e_phnum; ++i) {
+    const ElfW(Phdr) &phdr =
+        *elf.at<ElfW(Phdr)>(header->e_phoff + i * header->e_phentsize);
+    if (phdr.p_type == PT_INTERP) {
+      object->interpreter = elf.at<char>(phdr.p_offset);
+    }
+  }
+  return *object;
+}
+
+/** The workloads in a recording or in every recording of a merged corpus. */
+static std::vector<Workload> read_workloads(const std::string &database) {
+  sqlite3 *db;
+  if (sqlite3_open_v2(database.c_str(), &db, SQLITE_OPEN_READONLY, nullptr) !=
+      SQLITE_OK) {
+    sqlite_fail(db);
+  }
+  std::vector<Workload> workloads;
+  auto text = [](sqlite3_stmt *stmt, int column) {
+    const unsigned char *value = sqlite3_column_text(stmt, column);
+    return value == nullptr ? "" : reinterpret_cast<const char *>(value);
+  };
+  if (!is_merged_corpus(db)) {
+    Workload workload;
+    workload.program = database;
+    read_recording(
+        db,
+        [&](const char *name, const char *path) {
+          if (strcmp(name, "main") == 0 && *path != '\0') {
+            workload.program = path;
+          }
+          workload.scope.emplace_back(name, path);
+        },
+        [&](const char *library, const char *name, uint64_t size) {},
+        [&](const char *library, const char *symbol, const char *provider) {
+          workload.bindings.emplace_back(symbol, provider);
+        });
+    // The program is named after its path, as in a merged corpus.
+    for (auto &[name, path] : workload.scope) {
+      if (name == "main") {
+        name = workload.program;
+      }
+    }
+    for (auto &[symbol, provider] : workload.bindings) {
+      if (provider == "main") {
+        provider = workload.program;
+      }
+    }
+    workloads.push_back(std::move(workload));
+    sqlite3_close(db);
+    return workloads;
+  }
+
+  std::unordered_map<int64_t, size_t> recordings;
+  sqlite3_stmt *stmt;
+  auto query = [&](const char *sql) {
+    if (sqlite3_prepare_v2(db, sql, -1, &stmt, nullptr) != SQLITE_OK) {
+      sqlite_fail(db);
+    }
+  };
+  query(
+      "SELECT Recordings.Id, Program.Value FROM Recordings "
+      "JOIN Strings AS Program ON Program.Id = Recordings.Program;");
+  while (sqlite3_step(stmt) == SQLITE_ROW) {
+    recordings[sqlite3_column_int64(stmt, 0)] = workloads.size();
+    workloads.emplace_back();
+    workloads.back().program = text(stmt, 1);
+  }
+  sqlite3_finalize(stmt);
+  query(
+      "SELECT Loads.Recording, Name.Value, Path.Value FROM Loads "
+      "JOIN Libraries ON Libraries.Id = Loads.Library "
+      "JOIN Strings AS Name ON Name.Id = Libraries.Name "
+      "JOIN Strings AS Path ON Path.Id = Libraries.Path "
+      "ORDER BY Loads.rowid;");
+  while (sqlite3_step(stmt) == SQLITE_ROW) {
+    workloads[recordings.at(sqlite3_column_int64(stmt, 0))]
+        .scope.emplace_back(text(stmt, 1), text(stmt, 2));
+  }
+  sqlite3_finalize(stmt);
+  query(
+      "SELECT Usages.Recording, Name.Value, Provider.Value FROM Usages "
+      "JOIN Symbols ON Symbols.Id = Usages.Symbol "
+      "JOIN Strings AS Name ON Name.Id = Symbols.Name "
+      "JOIN Libraries ON Libraries.Id = Symbols.Library "
+      "JOIN Strings AS Provider ON Provider.Id = Libraries.Name;");
+  while (sqlite3_step(stmt) == SQLITE_ROW) {
+    workloads[recordings.at(sqlite3_column_int64(stmt, 0))]
+        .bindings.emplace_back(text(stmt, 1), text(stmt, 2));
+  }
+  sqlite3_finalize(stmt);
+  sqlite3_close(db);
+  return workloads;
+}
+
+/** The parts of a split library, with their simulated tables. */
+struct SplitLibrary {
+  std::vector<const SplitPlan::Part *> parts;
+  // The part of every planned symbol, by its recorded name.
+  std::unordered_map<std::string, size_t> part_of;
+  std::vector<HashTable> tables;
+  bool built = false;
+};
+
+int main(int argc, char **argv) {
+  std::string plan_database;
+  std::vector<std::string> databases;
+  for (int i = 1; i < argc; ++i) {
+    if (strcmp(argv[i], "-p") == 0 && i + 1 < argc) {
+      plan_database = argv[++i];
+    } else if (argv[i][0] == '-') {
+      usage();
+    } else {
+      databases.push_back(argv[i]);
+    }
+  }
+  if (databases.empty()) {
+    usage();
+  }
+
+  SplitPlan plan;
+  std::map<std::string, SplitLibrary> split;
+  if (!plan_database.empty()) {
+    plan = SplitPlan::read(plan_database);
+    for (const SplitPlan::Part &part : plan.parts) {
+      SplitLibrary &library = split[part.library];
+      for (const std::string &symbol : part.symbols) {
+        library.part_of.emplace(symbol, library.parts.size());
+      }
+      library.parts.push_back(&part);
+    }
+  }
+
+  std::unordered_map<std::string, std::unique_ptr<Object>> objects;
+  Cost current;
+  Cost after;
+  size_t programs = 0;
+  for (const std::string &database : databases) {
+    for (Workload &workload : read_workloads(database)) {
+      ++programs;
+      // ld.so is loaded first but searched last, after every dependency.
+      const Object &program = object(objects, workload.scope[0].second);
+      auto interpreter = std::find_if(
+          workload.scope.begin(), workload.scope.end(), [&](const auto &entry) {
+            return !program.interpreter.empty() &&
+                   (entry.second == program.interpreter ||
+                    entry.first == program.interpreter.substr(
+                                       program.interpreter.rfind('/') + 1));
+          });
+      if (interpreter != workload.scope.end()) {
+        std::rotate(interpreter, interpreter + 1, workload.scope.end());
+      }
+
+      std::vector<const HashTable *> scope;
+      std::unordered_map<std::string, const Object *> by_name;
+      for (const auto &[name, path] : workload.scope) {
+        const Object &loaded = object(objects, path);
+        by_name.emplace(name, &loaded);
+        if (loaded.usable) {
+          scope.push_back(&loaded.table);
+        }
+      }
+
+      // The parts this program needs of every split library.
+      std::map<std::string, std::vector<bool>> needed;
+      std::vector<std::string> names;
+      for (const auto &[symbol, provider] : workload.bindings) {
+        // Recorded names are demangled; the provider has the mangled one.
+        names.push_back(symbol);
+        auto definer = by_name.find(provider);
+        if (definer != by_name.end()) {
+          auto mangled = definer->second->mangled.find(symbol);
+          if (mangled != definer->second->mangled.end()) {
+            names.back() = mangled->second.front();
+          }
+        }
+        ++current.bindings;
+        if (lookup(scope, names.back(), current) < 0) {
+          ++current.not_found;
+        }
+        auto library = split.find(provider);
+        if (library != split.end()) {
+          auto part = library->second.part_of.find(symbol);
+          std::vector<bool> &parts = needed[provider];
+          parts.resize(library->second.parts.size());
+          if (part != library->second.part_of.end()) {
+            parts[part->second] = true;
+          }
+        }
+      }
+      if (plan_database.empty()) {
+        continue;
+      }
+
+      std::vector<const HashTable *> split_scope;
+      for (const auto &[name, path] : workload.scope) {
+        const Object &loaded = object(objects, path);
+        auto library = split.find(name);
+        if (library == split.end()) {
+          if (loaded.usable) {
+            split_scope.push_back(&loaded.table);
+          }
+          continue;
+        }
+        SplitLibrary &parts = library->second;
+        if (!parts.built) {
+          parts.built = true;
+          parts.tables.resize(parts.parts.size());
+          for (size_t i = 0; i < parts.parts.size(); ++i) {
+            std::vector<std::string> exports;
+            for (const std::string &symbol : parts.parts[i]->symbols) {
+              auto mangled = loaded.mangled.find(symbol);
+              if (mangled != loaded.mangled.end()) {
+                exports.insert(exports.end(), mangled->second.begin(),
+                               mangled->second.end());
+              } else {
+                exports.push_back(symbol);
+              }
+            }
+            build_table(std::move(exports), parts.tables[i]);
+          }
+        }
+        const std::vector<bool> &wanted = needed[name];
+        for (size_t i = 0; i < wanted.size(); ++i) {
+          if (wanted[i]) {
+            split_scope.push_back(&parts.tables[i]);
+          }
+        }
+      }
+      for (const std::string &name : names) {
+        ++after.bindings;
+        if (lookup(split_scope, name, after) < 0) {
+          ++after.not_found;
+        }
+      }
+    }
+  }
+
+  std::cout << current.bindings << " bindings of " << programs
+            << " recordings replayed" << std::endl;
+  std::cout << std::left << std::setw(24) << "" << std::right << std::setw(12)
+            << "current" << std::setw(12) << "per bind";
+  if (!plan_database.empty()) {
+    std::cout << std::setw(12) << "split" << std::setw(12) << "per bind"
+              << std::setw(10) << "change";
+  }
+  std::cout << std::endl;
+  auto row = [&](const char *label, uint64_t Cost::*field) {
+    auto average = [](const Cost &cost, uint64_t value) {
+      return cost.bindings == 0 ? 0.0 : static_cast<double>(value) /
+                                            cost.bindings;
+    };
+    std::cout << std::left << std::setw(24) << label << std::right
+              << std::setw(12) << current.*field << std::setw(12)
+              << std::fixed << std::setprecision(2)
+              << average(current, current.*field);
+    if (!plan_database.empty()) {
+      double change =
+          current.*field == 0
+              ? 0.0
+              : 100.0 * (static_cast<double>(after.*field) - current.*field) /
+                    current.*field;
+      std::cout << std::setw(12) << after.*field << std::setw(12)
+                << average(after, after.*field) << std::setw(9)
+                << std::setprecision(1) << std::showpos << change << "%"
+                << std::noshowpos;
+    }
+    std::cout << std::endl;
+  };
+  row("objects searched", &Cost::objects);
+  row("bloom filter passes", &Cost::bloom_passes);
+  row("chain entries walked", &Cost::chain_entries);
+  row("names compared", &Cost::names);
+  row("not found", &Cost::not_found);
+  return 0;
+}
@@ -0,0 +1,199 @@
+#include <algorithm>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "corpus.h"
+
+/**
+ * Model the system-wide memory of the recorded libraries, before and after
+ * a split, from the Memory tables written with RECORDSYMBOLS_SMAPS.
+ *
+ * Clean pages are backed by the file and shared by every process mapping
+ * it, so a library's clean memory is counted once, at the most any process
+ * had resident. Dirty pages (relocated data, .bss) are private to each
+ * process and add up. When every process mapping a library was recorded,
+ * clean plus dirty is the sum of their Pss.
+ *
+ * With a split plan (-p), clean memory is scaled by the share of the
+ * library's export bytes in parts any program loads, and each process's
+ * dirty memory by the share of the bytes it would load itself. This is a
+ * linear model: it assumes memory follows the exports.
+ */
+
+static void usage() {
+  std::cerr << "Usage: memorymodel [-p plan.db] [-n count] database.db..."
+            << std::endl;
+  exit(1);
+}
+
+/** A library across every recorded process, in bytes. */
+struct LibraryMemory {
+  size_t processes = 0;
+  uint64_t rss = 0;
+  uint64_t pss = 0;
+  uint64_t clean = 0;
+  uint64_t dirty = 0;
+  // Dirty memory scaled by what each process would load after the split.
+  double split_dirty = 0;
+};
+
+int main(int argc, char **argv) {
+  std::string plan_database;
+  size_t limit = SIZE_MAX;
+  std::vector<std::string> databases;
+  for (int i = 1; i < argc; ++i) {
+    if (strcmp(argv[i], "-p") == 0 && i + 1 < argc) {
+      plan_database = argv[++i];
+    } else if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+      limit = strtoul(argv[++i], nullptr, 10);
+    } else if (argv[i][0] == '-') {
+      usage();
+    } else {
+      databases.push_back(argv[i]);
+    }
+  }
+  if (databases.empty()) {
+    usage();
+  }
+
+  // For split libraries, the share of export bytes loaded by anybody and
+  // by each program.
+  std::unordered_map<std::string, double> loaded_share;
+  std::map<std::pair<std::string, std::string>, double> program_share;
+  if (!plan_database.empty()) {
+    SplitPlan plan = SplitPlan::read(plan_database);
+    std::unordered_map<std::string, std::pair<uint64_t, uint64_t>> bytes;
+    for (const SplitPlan::Part &part : plan.parts) {
+      bytes[part.library].first += part.consumers > 0 ? part.bytes : 0;
+      bytes[part.library].second += part.bytes;
+    }
+    for (const auto &[library, loaded] : bytes) {
+      loaded_share[library] =
+          loaded.second == 0
+              ? 1.0
+              : static_cast<double>(loaded.first) / loaded.second;
+    }
+    for (const SplitPlan::Load &load : plan.loads) {
+      program_share[{load.program, load.library}] =
+          load.original_bytes == 0
+              ? 1.0
+              : static_cast<double>(load.split_bytes) / load.original_bytes;
+    }
+  }
+
+  std::map<std::string, LibraryMemory> libraries;
+  size_t recorded = 0;
+  for (const std::string &database : databases) {
+    sqlite3 *db;
+    if (sqlite3_open_v2(database.c_str(), &db, SQLITE_OPEN_READONLY,
+                        nullptr) != SQLITE_OK) {
+      sqlite_fail(db);
+    }
+    sqlite3_stmt *stmt;
+    if (sqlite3_prepare_v2(db,
+                           "SELECT Path FROM Libraries WHERE Name = 'main';",
+                           -1, &stmt, nullptr) != SQLITE_OK) {
+      std::cerr << database << ": " << sqlite3_errmsg(db) << std::endl;
+      sqlite3_close(db);
+      continue;
+    }
+    std::string program = database;
+    if (sqlite3_step(stmt) == SQLITE_ROW && *column_text(stmt, 0) != '\0') {
+      program = column_text(stmt, 0);
+    }
+    sqlite3_finalize(stmt);
+
+    // The program's own memory is not shared, so it is not counted.
+    if (sqlite3_prepare_v2(db,
+                           "SELECT Library, Rss, Pss, SharedClean, "
+                           "SharedDirty, PrivateClean, PrivateDirty "
+                           "FROM Memory WHERE Library != 'main';",
+                           -1, &stmt, nullptr) != SQLITE_OK) {
+      std::cerr << database << " was not recorded with RECORDSYMBOLS_SMAPS"
+                << std::endl;
+      sqlite3_close(db);
+      continue;
+    }
+    ++recorded;
+    while (sqlite3_step(stmt) == SQLITE_ROW) {
+      std::string library = column_text(stmt, 0);
+      LibraryMemory &memory = libraries[library];
+      uint64_t clean =
+          sqlite3_column_int64(stmt, 3) + sqlite3_column_int64(stmt, 5);
+      uint64_t dirty =
+          sqlite3_column_int64(stmt, 4) + sqlite3_column_int64(stmt, 6);
+      ++memory.processes;
+      memory.rss += sqlite3_column_int64(stmt, 1);
+      memory.pss += sqlite3_column_int64(stmt, 2);
+      memory.clean = std::max(memory.clean, clean);
+      memory.dirty += dirty;
+      auto share = program_share.find({program, library});
+      memory.split_dirty +=
+          dirty * (share == program_share.end() ? 1.0 : share->second);
+    }
+    sqlite3_finalize(stmt);
+    sqlite3_close(db);
+  }
+
+  struct Row {
+    std::string library;
+    const LibraryMemory *memory;
+    uint64_t before;
+    uint64_t after;
+  };
+  std::vector<Row> rows;
+  uint64_t total_before = 0, total_after = 0;
+  for (const auto &[library, memory] : libraries) {
+    auto share = loaded_share.find(library);
+    uint64_t before = memory.clean + memory.dirty;
+    uint64_t after =
+        memory.clean * (share == loaded_share.end() ? 1.0 : share->second) +
+        memory.split_dirty;
+    rows.push_back({library, &memory, before, after});
+    total_before += before;
+    total_after += after;
+  }
+  // Largest savings first.
+  std::sort(rows.begin(), rows.end(), [](const Row &a, const Row &b) {
+    int64_t a_saved = static_cast<int64_t>(a.before - a.after);
+    int64_t b_saved = static_cast<int64_t>(b.before - b.after);
+    if (a_saved != b_saved) {
+      return a_saved > b_saved;
+    }
+    return a.before > b.before;
+  });
+
+  auto kib = [](uint64_t bytes) { return bytes / 1024; };
+  std::cout << std::left << std::setw(32) << "library (KiB)" << std::right
+            << std::setw(10) << "processes" << std::setw(10) << "rss"
+            << std::setw(10) << "pss" << std::setw(10) << "clean"
+            << std::setw(10) << "dirty" << std::setw(10) << "total";
+  if (!plan_database.empty()) {
+    std::cout << std::setw(10) << "split";
+  }
+  std::cout << std::endl;
+  for (size_t i = 0; i < rows.size() && i < limit; ++i) {
+    const Row &row = rows[i];
+    std::cout << std::left << std::setw(32) << row.library << std::right
+              << std::setw(10) << row.memory->processes << std::setw(10)
+              << kib(row.memory->rss) << std::setw(10) << kib(row.memory->pss)
+              << std::setw(10) << kib(row.memory->clean) << std::setw(10)
+              << kib(row.memory->dirty) << std::setw(10) << kib(row.before);
+    if (!plan_database.empty()) {
+      std::cout << std::setw(10) << kib(row.after);
+    }
+    std::cout << std::endl;
+  }
+  std::cout << recorded << " processes use " << kib(total_before)
+            << " KiB of library memory";
+  if (!plan_database.empty()) {
+    std::cout << ", " << kib(total_after) << " KiB after the split";
+  }
+  std::cout << "." << std::endl;
+  return 0;
+}
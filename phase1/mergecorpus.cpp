@@ -0,0 +1,545 @@
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <filesystem>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "corpus.h"
+
+/**
+ * Merge any number of recordings into one indexed corpus database.
+ *
+ * Every tool accepts the merged corpus in place of the recordings, and
+ * reading one database with integer keys is much faster than opening
+ * thousands of small ones. Recordings are parsed by one thread per core.
+ * Names are interned into a global dictionary as they are read, so each
+ * string is stored once and the workers hand over rows of integers, which
+ * the main thread appends in a single transaction while the next recordings
+ * are being parsed. Secondary indexes are dropped during the load and
+ * rebuilt once at the end.
+ *
+ * Merging into an existing corpus appends to it, so a corpus can be kept up
+ * to date by merging new recordings as they arrive. Recordings are known by
+ * their canonical path with the modification time and size of the file:
+ * one merged before is skipped, however its path is spelled, unless it has
+ * been rewritten since, in which case it replaces the earlier copy.
+ *
+ * The corpus schema is:
+ *
+ *   Strings(Id, Value)                every name and path, once
+ *   Recordings(Id, Source, Program,   one per merged database, Source being
+ *              Modified, Bytes)       its canonical path
+ *   Libraries(Id, Name, Path)         Name and Path refer to Strings
+ *   Symbols(Id, Library, Name, Size)  one per exported (library, name)
+ *   Loads(Recording, Library)
+ *   Usages(Recording, Library, Symbol), Library being the consumer
+ *
+ * As in Corpus, the program itself is a library named after its path.
+ */
+
+static void usage() {
+  std::cerr << "Usage: mergecorpus -o corpus.db [-j threads] database.db..."
+            << std::endl;
+  exit(1);
+}
+
+// Indexes are rebuilt once the load is done.
+static const char *const kDropIndexes = R"(
+DROP INDEX IF EXISTS StringsValue;
+DROP INDEX IF EXISTS LibrariesName;
+DROP INDEX IF EXISTS SymbolsLibrary;
+DROP INDEX IF EXISTS LoadsLibrary;
+DROP INDEX IF EXISTS UsagesRecording;
+DROP INDEX IF EXISTS UsagesSymbol;
+)";
+
+/**
+ * Dense ids for keys, shared by all threads.
+ *
+ * The keys are spread over shards with a lock each, so workers interning
+ * different keys rarely wait for one another. Ids are handed out in the
+ * order keys are first seen, starting after those added with add().
+ */
+template <typename Key>
+class Interner {
+ public:
+  /** The id of key, assigning the next one if it is new. */
+  uint32_t id(const Key &key) {
+    Shard &shard = shards_[std::hash<Key>()(key) % kShards];
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    auto [it, inserted] = shard.ids.try_emplace(key, 0);
+    if (inserted) {
+      it->second = next_++;
+    }
+    return it->second;
+  }
+
+  /** Add a key with a known id, before any call to id(). */
+  void add(const Key &key, uint32_t id) {
+    shards_[std::hash<Key>()(key) % kShards].ids.emplace(key, id);
+    next_ = std::max<uint32_t>(next_, id + 1);
+  }
+
+  /** One past the largest id. */
+  uint32_t size() const { return next_; }
+
+  /** Every key by its id, once no thread is adding any. */
+  std::vector<const Key *> keys() const {
+    std::vector<const Key *> keys(next_, nullptr);
+    for (const Shard &shard : shards_) {
+      for (const auto &[key, id] : shard.ids) {
+        keys[id] = &key;
+      }
+    }
+    return keys;
+  }
+
+ private:
+  static constexpr size_t kShards = 64;
+
+  struct Shard {
+    std::mutex mutex;
+    std::unordered_map<Key, uint32_t> ids;
+  };
+
+  Shard shards_[kShards];
+  std::atomic<uint32_t> next_{0};
+};
+
+/** Libraries and symbols are keyed by the ids of their names. */
+static uint64_t symbol_key(uint32_t library, uint32_t name) {
+  return static_cast<uint64_t>(library) << 32 | name;
+}
+
+/** A recording file as found on disk. */
+struct Source {
+  std::string path;
+  // Nanoseconds since the epoch.
+  int64_t modified = 0;
+  int64_t bytes = 0;
+};
+
+/** One recording, reduced to integers by a worker. */
+struct Parsed {
+  Source source;
+  // Why the recording could not be read, if it could not.
+  std::string error;
+  uint32_t program = 0;
+  // Library ids, with the string id of the path each was loaded from.
+  std::vector<std::pair<uint32_t, uint32_t>> loads;
+  std::vector<std::pair<uint32_t, uint64_t>> sizes;
+  // symbol_key(consumer library, symbol), sorted and without duplicates.
+  std::vector<uint64_t> usages;
+};
+
+struct Dictionary {
+  Interner<std::string> strings;
+  Interner<uint32_t> libraries;
+  Interner<uint64_t> symbols;
+};
+
+/**
+ * Read one recording on a worker thread. Errors are left in Parsed::error
+ * for the main thread, which holds the transaction, to report.
+ */
+static Parsed parse(const Source &source, Dictionary &dictionary) {
+  Parsed parsed;
+  parsed.source = source;
+  sqlite3 *db;
+  if (sqlite3_open_v2(source.path.c_str(), &db, SQLITE_OPEN_READONLY,
+                      nullptr) != SQLITE_OK) {
+    parsed.error = sqlite3_errmsg(db);
+    sqlite3_close(db);
+    return parsed;
+  }
+  std::string program = source.path;
+  // Libraries by name; few per recording, so this saves most locking.
+  std::unordered_map<std::string, uint32_t> libraries;
+  auto library_id = [&](const char *name) {
+    auto it = libraries.find(name);
+    if (it != libraries.end()) {
+      return it->second;
+    }
+    uint32_t id = dictionary.libraries.id(dictionary.strings.id(
+        strcmp(name, "main") == 0 ? program : std::string(name)));
+    libraries.emplace(name, id);
+    return id;
+  };
+  std::vector<std::string> loaded;
+  bool read = try_read_recording(
+      db,
+      [&](const char *name, const char *path) {
+        if (strcmp(name, "main") == 0 && *path != '\0') {
+          program = path;
+        }
+        parsed.loads.emplace_back(0, dictionary.strings.id(path));
+        loaded.emplace_back(name);
+      },
+      [&](const char *library, const char *name, uint64_t size) {
+        uint32_t symbol = dictionary.symbols.id(symbol_key(
+            library_id(library), dictionary.strings.id(name)));
+        parsed.sizes.emplace_back(symbol, size);
+      },
+      [&](const char *library, const char *symbol, const char *provider) {
+        uint32_t id = dictionary.symbols.id(symbol_key(
+            library_id(provider), dictionary.strings.id(symbol)));
+        parsed.usages.push_back(symbol_key(library_id(library), id));
+      },
+      &parsed.error);
+  sqlite3_close(db);
+  if (!read) {
+    return parsed;
+  }
+
+  // The program's path is only known once every library was read.
+  parsed.program = dictionary.strings.id(program);
+  for (size_t i = 0; i < loaded.size(); ++i) {
+    parsed.loads[i].first = library_id(loaded[i].c_str());
+  }
+  std::sort(parsed.usages.begin(), parsed.usages.end());
+  parsed.usages.erase(std::unique(parsed.usages.begin(), parsed.usages.end()),
+                      parsed.usages.end());
+  return parsed;
+}
+
+/** A prepared statement, run once per row. */
+class Statement {
+ public:
+  Statement(sqlite3 *db, const char *sql) : db_(db) {
+    if (sqlite3_prepare_v2(db, sql, -1, &stmt_, nullptr) != SQLITE_OK) {
+      sqlite_fail(db);
+    }
+  }
+  ~Statement() { sqlite3_finalize(stmt_); }
+
+  template <typename... Values>
+  void run(Values... values) {
+    int column = 0;
+    (bind(++column, values), ...);
+    if (sqlite3_step(stmt_) != SQLITE_DONE) {
+      sqlite_fail(db_);
+    }
+    sqlite3_reset(stmt_);
+  }
+
+ private:
+  void bind(int column, int64_t value) {
+    sqlite3_bind_int64(stmt_, column, value);
+  }
+  void bind(int column, const std::string &value) {
+    sqlite3_bind_text(stmt_, column, value.c_str(), value.size(),
+                      SQLITE_STATIC);
+  }
+
+  sqlite3 *db_;
+  sqlite3_stmt *stmt_;
+};
+
+static void exec(sqlite3 *db, const char *sql) {
+  if (sqlite3_exec(db, sql, nullptr, nullptr, nullptr) != SQLITE_OK) {
+    sqlite_fail(db);
+  }
+}
+
+int main(int argc, char **argv) {
+  std::string output;
+  unsigned threads = std::max(1u, std::thread::hardware_concurrency());
+  std::vector<std::string> databases;
+  for (int i = 1; i < argc; ++i) {
+    if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+      output = argv[++i];
+    } else if (strcmp(argv[i], "-j") == 0 && i + 1 < argc) {
+      threads = std::max(1ul, strtoul(argv[++i], nullptr, 10));
+    } else if (argv[i][0] == '-') {
+      usage();
+    } else {
+      databases.push_back(argv[i]);
+    }
+  }
+  if (output.empty() || databases.empty()) {
+    usage();
+  }
+
+  // The same file may be named more than once, e.g. as a.db and ./a.db.
+  std::map<std::string, Source> sources;
+  for (const std::string &database : databases) {
+    std::error_code error;
+    Source source;
+    source.path = std::filesystem::canonical(database, error).string();
+    struct stat st;
+    if (error || stat(source.path.c_str(), &st) != 0) {
+      std::cerr << "Could not open " << database << std::endl;
+      return 1;
+    }
+    source.modified = st.st_mtim.tv_sec * 1000000000ll + st.st_mtim.tv_nsec;
+    source.bytes = st.st_size;
+    sources.emplace(source.path, source);
+  }
+
+  sqlite3 *db;
+  if (sqlite3_open(output.c_str(), &db) != SQLITE_OK) {
+    sqlite_fail(db);
+  }
+  exec(db, "PRAGMA synchronous = OFF;");
+  exec(db, "BEGIN;");
+  exec(db, kMergedCorpusSchema);
+  sqlite3_stmt *stmt;
+  auto query = [&](const char *sql) {
+    if (sqlite3_prepare_v2(db, sql, -1, &stmt, nullptr) != SQLITE_OK) {
+      sqlite_fail(db);
+    }
+  };
+  // Corpora merged before recordings were stamped lack the columns.
+  query("SELECT 1 FROM pragma_table_info('Recordings') "
+        "WHERE name = 'Modified';");
+  bool stamped = sqlite3_step(stmt) == SQLITE_ROW;
+  sqlite3_finalize(stmt);
+  if (!stamped) {
+    exec(db, "ALTER TABLE Recordings ADD COLUMN Modified INTEGER;"
+             "ALTER TABLE Recordings ADD COLUMN Bytes INTEGER;");
+  }
+
+  // Recordings merged before are skipped, and those rewritten since are
+  // removed to be merged again. This runs while the indexes still exist.
+  std::vector<Source> pending;
+  size_t skipped = 0;
+  size_t replaced = 0;
+  std::vector<int64_t> stale;
+  query("SELECT Id, Source, Modified, Bytes FROM Recordings;");
+  while (sqlite3_step(stmt) == SQLITE_ROW) {
+    std::string path = column_text(stmt, 1);
+    bool unstamped = sqlite3_column_type(stmt, 2) == SQLITE_NULL;
+    // Unstamped recordings were stored by the path they were given.
+    std::error_code error;
+    if (unstamped && !path.empty()) {
+      std::filesystem::path canonical =
+          std::filesystem::canonical(path, error);
+      if (!error) {
+        path = canonical.string();
+      }
+    }
+    auto it = sources.find(path);
+    if (it == sources.end()) {
+      continue;
+    }
+    if (!unstamped && sqlite3_column_int64(stmt, 2) == it->second.modified &&
+        sqlite3_column_int64(stmt, 3) == it->second.bytes) {
+      ++skipped;
+    } else {
+      stale.push_back(sqlite3_column_int64(stmt, 0));
+      pending.push_back(it->second);
+      ++replaced;
+    }
+    sources.erase(it);
+  }
+  sqlite3_finalize(stmt);
+  {
+    Statement delete_usages(db, "DELETE FROM Usages WHERE Recording = ?;");
+    Statement delete_loads(db, "DELETE FROM Loads WHERE Recording = ?;");
+    Statement delete_recording(db, "DELETE FROM Recordings WHERE Id = ?;");
+    for (int64_t recording : stale) {
+      delete_usages.run(recording);
+      delete_loads.run(recording);
+      delete_recording.run(recording);
+    }
+  }
+  for (const auto &[path, source] : sources) {
+    pending.push_back(source);
+  }
+  exec(db, kDropIndexes);
+
+  // Start from what the corpus already holds.
+  Dictionary dictionary;
+  std::vector<uint32_t> library_paths;
+  std::vector<uint64_t> symbol_sizes;
+  query("SELECT Id, Value FROM Strings;");
+  while (sqlite3_step(stmt) == SQLITE_ROW) {
+    const unsigned char *value = sqlite3_column_text(stmt, 1);
+    dictionary.strings.add(value == nullptr
+                               ? ""
+                               : reinterpret_cast<const char *>(value),
+                           sqlite3_column_int64(stmt, 0));
+  }
+  sqlite3_finalize(stmt);
+  query("SELECT Id, Name, Path FROM Libraries;");
+  while (sqlite3_step(stmt) == SQLITE_ROW) {
+    uint32_t id = sqlite3_column_int64(stmt, 0);
+    dictionary.libraries.add(sqlite3_column_int64(stmt, 1), id);
+    library_paths.resize(std::max<size_t>(library_paths.size(), id + 1));
+    library_paths[id] = sqlite3_column_int64(stmt, 2);
+  }
+  sqlite3_finalize(stmt);
+  query("SELECT Id, Library, Name, Size FROM Symbols;");
+  while (sqlite3_step(stmt) == SQLITE_ROW) {
+    uint32_t id = sqlite3_column_int64(stmt, 0);
+    dictionary.symbols.add(symbol_key(sqlite3_column_int64(stmt, 1),
+                                      sqlite3_column_int64(stmt, 2)),
+                           id);
+    symbol_sizes.resize(std::max<size_t>(symbol_sizes.size(), id + 1));
+    symbol_sizes[id] = sqlite3_column_int64(stmt, 3);
+  }
+  sqlite3_finalize(stmt);
+  uint32_t old_strings = dictionary.strings.size();
+  uint32_t old_libraries = dictionary.libraries.size();
+  uint32_t old_symbols = dictionary.symbols.size();
+  const std::vector<uint32_t> old_paths = library_paths;
+  const std::vector<uint64_t> old_sizes = symbol_sizes;
+  // The string id of an empty path, so known paths can be filled in later.
+  uint32_t no_path = dictionary.strings.id("");
+
+  // Workers parse; the main thread writes. The queue is bounded so that
+  // parsed recordings never pile up in memory faster than they are written.
+  std::mutex mutex;
+  std::condition_variable ready;
+  std::condition_variable room;
+  std::deque<Parsed> queue;
+  const size_t capacity = 2 * threads;
+  std::atomic<size_t> next{0};
+  std::atomic<unsigned> running{threads};
+  std::vector<std::thread> workers;
+  for (unsigned i = 0; i < threads; ++i) {
+    workers.emplace_back([&] {
+      for (size_t index; (index = next++) < pending.size();) {
+        Parsed parsed = parse(pending[index], dictionary);
+        // After a failure the rest are not parsed, only drained.
+        if (!parsed.error.empty()) {
+          next = pending.size();
+        }
+        std::unique_lock<std::mutex> lock(mutex);
+        room.wait(lock, [&] { return queue.size() < capacity; });
+        queue.push_back(std::move(parsed));
+        ready.notify_one();
+      }
+      std::lock_guard<std::mutex> lock(mutex);
+      --running;
+      ready.notify_one();
+    });
+  }
+
+  Statement insert_recording(
+      db,
+      "INSERT INTO Recordings(Source, Program, Modified, Bytes) "
+      "VALUES (?, ?, ?, ?);");
+  Statement insert_load(db,
+                        "INSERT INTO Loads(Recording, Library) VALUES (?, ?);");
+  Statement insert_usage(
+      db, "INSERT INTO Usages(Recording, Library, Symbol) VALUES (?, ?, ?);");
+  size_t usages = 0;
+  std::string failure;
+  for (size_t done = 0;; ++done) {
+    std::unique_lock<std::mutex> lock(mutex);
+    ready.wait(lock, [&] { return !queue.empty() || running == 0; });
+    if (queue.empty()) {
+      break;
+    }
+    Parsed parsed = std::move(queue.front());
+    queue.pop_front();
+    room.notify_one();
+    lock.unlock();
+
+    if (!failure.empty()) {
+      continue;
+    }
+    if (!parsed.error.empty()) {
+      failure = parsed.source.path + ": " + parsed.error;
+      continue;
+    }
+    insert_recording.run(parsed.source.path,
+                         static_cast<int64_t>(parsed.program),
+                         parsed.source.modified, parsed.source.bytes);
+    int64_t recording = sqlite3_last_insert_rowid(db);
+    for (const auto &[library, path] : parsed.loads) {
+      insert_load.run(recording, static_cast<int64_t>(library));
+      library_paths.resize(std::max<size_t>(library_paths.size(), library + 1),
+                           no_path);
+      if (library_paths[library] == no_path) {
+        library_paths[library] = path;
+      }
+    }
+    for (const auto &[symbol, size] : parsed.sizes) {
+      symbol_sizes.resize(std::max<size_t>(symbol_sizes.size(), symbol + 1));
+      // Versioned symbols may appear more than once under the same name.
+      symbol_sizes[symbol] = std::max(symbol_sizes[symbol], size);
+    }
+    for (uint64_t usage : parsed.usages) {
+      insert_usage.run(recording, static_cast<int64_t>(usage >> 32),
+                       static_cast<int64_t>(usage & UINT32_MAX));
+    }
+    usages += parsed.usages.size();
+    if ((done + 1) % 1000 == 0) {
+      std::cerr << done + 1 << " of " << pending.size() << " merged"
+                << std::endl;
+    }
+  }
+  for (std::thread &worker : workers) {
+    worker.join();
+  }
+  if (!failure.empty()) {
+    std::cerr << failure << std::endl;
+    exec(db, "ROLLBACK;");
+    sqlite3_close(db);
+    return 1;
+  }
+
+  // Append the names, libraries and symbols seen for the first time, and
+  // complete the ones merged before.
+  std::vector<const std::string *> strings = dictionary.strings.keys();
+  Statement insert_string(db, "INSERT INTO Strings(Id, Value) VALUES (?, ?);");
+  for (uint32_t id = old_strings; id < strings.size(); ++id) {
+    insert_string.run(static_cast<int64_t>(id), *strings[id]);
+  }
+  std::vector<const uint32_t *> libraries = dictionary.libraries.keys();
+  library_paths.resize(libraries.size(), no_path);
+  Statement insert_library(
+      db, "INSERT INTO Libraries(Id, Name, Path) VALUES (?, ?, ?);");
+  Statement update_library(db, "UPDATE Libraries SET Path = ? WHERE Id = ?;");
+  for (uint32_t id = 0; id < libraries.size(); ++id) {
+    if (id >= old_libraries) {
+      insert_library.run(static_cast<int64_t>(id),
+                         static_cast<int64_t>(*libraries[id]),
+                         static_cast<int64_t>(library_paths[id]));
+    } else if (library_paths[id] != old_paths[id]) {
+      update_library.run(static_cast<int64_t>(library_paths[id]),
+                         static_cast<int64_t>(id));
+    }
+  }
+  std::vector<const uint64_t *> symbols = dictionary.symbols.keys();
+  symbol_sizes.resize(symbols.size());
+  Statement insert_symbol(
+      db, "INSERT INTO Symbols(Id, Library, Name, Size) VALUES (?, ?, ?, ?);");
+  Statement update_symbol(db, "UPDATE Symbols SET Size = ? WHERE Id = ?;");
+  for (uint32_t id = 0; id < symbols.size(); ++id) {
+    int64_t size = symbol_sizes[id];
+    if (id >= old_symbols) {
+      insert_symbol.run(static_cast<int64_t>(id),
+                        static_cast<int64_t>(*symbols[id] >> 32),
+                        static_cast<int64_t>(*symbols[id] & UINT32_MAX), size);
+    } else if (symbol_sizes[id] != old_sizes[id]) {
+      update_symbol.run(size, static_cast<int64_t>(id));
+    }
+  }
+  exec(db, kMergedCorpusIndexes);
+  exec(db, "COMMIT;");
+  sqlite3_close(db);
+
+  std::cout << output << ": " << pending.size() << " recordings merged";
+  if (replaced > 0) {
+    std::cout << " (" << replaced << " replacing an older copy)";
+  }
+  if (skipped > 0) {
+    std::cout << ", " << skipped << " already in the corpus";
+  }
+  std::cout << "; " << libraries.size() << " libraries, " << symbols.size()
+            << " symbols, " << usages << " new usages" << std::endl;
+  return 0;
+}
@@ -0,0 +1,247 @@
+#pragma once
+
+#include <algorithm>
+#include <cctype>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <vector>
+
+/**
+ * The scopes (namespaces and classes) a demangled name is declared in,
+ * outermost first: std::vector<int>::push_back(int const&) is in std and
+ * vector<int>. Return types and prefixes such as "vtable for " are skipped,
+ * and parameter lists and operator names end the scopes.
+ */
+inline std::vector<std::string_view> name_scopes(std::string_view name) {
+  std::vector<std::string_view> scopes;
+  size_t start = 0;
+  int depth = 0;
+  for (size_t i = 0; i < name.size(); ++i) {
+    char c = name[i];
+    if (depth == 0 && i == start && name.compare(i, 8, "operator") == 0 &&
+        (i + 8 == name.size() ||
+         !(isalnum(static_cast<unsigned char>(name[i + 8])) ||
+           name[i + 8] == '_'))) {
+      // Operator names contain brackets and are never a scope.
+      break;
+    }
+    if (c == '(' && depth == 0 && i != start) {
+      // The parameters; "(anonymous namespace)" starts a component.
+      break;
+    }
+    if (c == '<' || c == '(' || c == '[' || c == '{') {
+      ++depth;
+    } else if (c == '>' || c == ')' || c == ']' || c == '}') {
+      depth = std::max(depth - 1, 0);
+    } else if (depth == 0 && c == ' ') {
+      // What came before was a return type or a "typeinfo for ".
+      scopes.clear();
+      start = i + 1;
+    } else if (depth == 0 && c == ':' && i + 1 < name.size() &&
+               name[i + 1] == ':') {
+      scopes.push_back(name.substr(start, i - start));
+      start = ++i + 1;
+    }
+  }
+  return scopes;
+}
+
+/**
+ * The file format of a scope index over a symbol dictionary (see
+ * dictionary.h), built offline by symbolindex.
+ *
+ * The scopes of every name form a trie whose edges are scope components,
+ * e.g. std -> __cxx11 -> basic_string<...>. Each node lists the ids of the
+ * names declared in it or its descendants as runs of consecutive ids; since
+ * names are sorted, a scope's names are almost always one run. Components
+ * are also indexed by their text, so the scopes named e.g. F14Table<...> at
+ * any depth are found by binary search:
+ *
+ *   NameIndexHeader
+ *   NameScope scopes[scopes], scope 0 being the root
+ *   uint32_t children[scopes - 1], each scope's sorted by component
+ *   NameComponent components[components], sorted by text
+ *   uint32_t postings[postings], the scopes of each component
+ *   NameRun runs[runs]
+ *   NUL-terminated strings, referred to by offset from their start; the
+ *   first is the root's empty component
+ */
+struct NameIndexHeader {
+  char magic[8];
+  // The size of the dictionary the ids refer to.
+  uint32_t names;
+  uint32_t scopes;
+  uint32_t components;
+  uint32_t postings;
+  uint32_t runs;
+  uint32_t strings_size;
+};
+
+struct NameScope {
+  uint32_t component;
+  uint32_t parent;
+  uint32_t first_child;
+  uint32_t child_count;
+  uint32_t first_run;
+  uint32_t run_count;
+};
+
+struct NameComponent {
+  uint32_t text;
+  uint32_t first_posting;
+  uint32_t posting_count;
+};
+
+/** The names with ids in [first, end). */
+struct NameRun {
+  uint32_t first;
+  uint32_t end;
+};
+
+static constexpr char kNameIndexMagic[8] = {'R', 'S', 'N', 'I',
+                                            'D', 'X', '0', '1'};
+
+/**
+ * A read-only view of a scope index, e.g. one that was mmap'd.
+ */
+class NameIndex {
+ public:
+  NameIndex() = default;
+
+  /** View the index in data. Returns false if it is not a complete index. */
+  bool open(const void *data, size_t size) {
+    if (size < sizeof(NameIndexHeader)) {
+      return false;
+    }
+    header_ = static_cast<const NameIndexHeader *>(data);
+    if (memcmp(header_->magic, kNameIndexMagic, sizeof(kNameIndexMagic)) !=
+            0 ||
+        header_->scopes == 0) {
+      return false;
+    }
+    uint64_t scopes = header_->scopes;
+    uint64_t expected = sizeof(NameIndexHeader) + scopes * sizeof(NameScope) +
+                        (scopes - 1 + header_->postings) * sizeof(uint32_t) +
+                        header_->components * sizeof(NameComponent) +
+                        header_->runs * sizeof(NameRun) + header_->strings_size;
+    if (expected != size || header_->strings_size == 0 ||
+        static_cast<const char *>(data)[size - 1] != '\0') {
+      return false;
+    }
+    scopes_ = reinterpret_cast<const NameScope *>(header_ + 1);
+    children_ = reinterpret_cast<const uint32_t *>(scopes_ + header_->scopes);
+    components_ = reinterpret_cast<const NameComponent *>(
+        children_ + header_->scopes - 1);
+    postings_ =
+        reinterpret_cast<const uint32_t *>(components_ + header_->components);
+    runs_ = reinterpret_cast<const NameRun *>(postings_ + header_->postings);
+    strings_ = reinterpret_cast<const char *>(runs_ + header_->runs);
+    for (uint32_t i = 0; i < header_->scopes; ++i) {
+      const NameScope &scope = scopes_[i];
+      if (scope.component >= header_->strings_size ||
+          scope.parent >= header_->scopes ||
+          uint64_t{scope.first_child} + scope.child_count >
+              header_->scopes - 1 ||
+          uint64_t{scope.first_run} + scope.run_count > header_->runs) {
+        return false;
+      }
+    }
+    for (uint32_t i = 0; i < header_->scopes - 1; ++i) {
+      if (children_[i] == 0 || children_[i] >= header_->scopes) {
+        return false;
+      }
+    }
+    for (uint32_t i = 0; i < header_->components; ++i) {
+      const NameComponent &component = components_[i];
+      if (component.text >= header_->strings_size ||
+          uint64_t{component.first_posting} + component.posting_count >
+              header_->postings) {
+        return false;
+      }
+    }
+    for (uint32_t i = 0; i < header_->postings; ++i) {
+      if (postings_[i] >= header_->scopes) {
+        return false;
+      }
+    }
+    for (uint32_t i = 0; i < header_->runs; ++i) {
+      if (runs_[i].first >= runs_[i].end || runs_[i].end > header_->names) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  /** The size of the dictionary the index was built from. */
+  uint32_t names() const { return header_->names; }
+
+  const NameScope &scope(uint32_t index) const { return scopes_[index]; }
+
+  /** The last component of a scope's name; empty for the root. */
+  std::string_view component(const NameScope &scope) const {
+    return strings_ + scope.component;
+  }
+
+  /** The runs of ids of the names in a scope. */
+  const NameRun *runs(const NameScope &scope) const {
+    return runs_ + scope.first_run;
+  }
+
+  /** The index of the scope named e.g. "std::__cxx11", or -1. */
+  int64_t find_scope(std::string_view name) const {
+    uint32_t index = 0;
+    std::string spelled(name);
+    // name_scopes() leaves out the last component, which is the one looked
+    // for here.
+    spelled += "::x";
+    for (std::string_view part : name_scopes(spelled)) {
+      const NameScope &scope = scopes_[index];
+      const uint32_t *begin = children_ + scope.first_child;
+      const uint32_t *end = begin + scope.child_count;
+      const uint32_t *child = std::lower_bound(
+          begin, end, part, [this](uint32_t child, std::string_view text) {
+            return component(scopes_[child]) < text;
+          });
+      if (child == end || component(scopes_[*child]) != part) {
+        return -1;
+      }
+      index = *child;
+    }
+    return index;
+  }
+
+  /**
+   * Call f(scope index) for every scope whose last component starts with
+   * prefix, at any depth, in order of the components' text.
+   */
+  template <typename F>
+  void scopes_named(std::string_view prefix, F f) const {
+    const NameComponent *begin = components_;
+    const NameComponent *end = begin + header_->components;
+    const NameComponent *component = std::lower_bound(
+        begin, end, prefix,
+        [this](const NameComponent &component, std::string_view text) {
+          return std::string_view(strings_ + component.text) < text;
+        });
+    for (; component != end; ++component) {
+      std::string_view text = strings_ + component->text;
+      if (text.substr(0, prefix.size()) != prefix) {
+        return;
+      }
+      for (uint32_t i = 0; i < component->posting_count; ++i) {
+        f(postings_[component->first_posting + i]);
+      }
+    }
+  }
+
+ private:
+  const NameIndexHeader *header_ = nullptr;
+  const NameScope *scopes_ = nullptr;
+  const uint32_t *children_ = nullptr;
+  const NameComponent *components_ = nullptr;
+  const uint32_t *postings_ = nullptr;
+  const NameRun *runs_ = nullptr;
+  const char *strings_ = nullptr;
+};
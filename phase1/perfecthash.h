@@ -0,0 +1,138 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <initializer_list>
+#include <string_view>
+#include <vector>
+
+/**
+ * A minimal perfect hash over a fixed set of strings.
+ *
+ * Uses hash and displace: keys are spread over buckets of about four, and
+ * each bucket, largest first, is given the first seed that places all of its
+ * keys in still free slots. A lookup is then two hashes and no probing,
+ * whatever the keys. Strings that were not in the set still map to some
+ * slot, so callers keep the key of every slot and compare against it.
+ *
+ * Only the seeds are needed to look keys up, so a table can be built once,
+ * written out next to its keys and later used straight from a mapping.
+ */
+class PerfectHash {
+ public:
+  /**
+   * Build the table for keys. Returns false if two keys are equal, since
+   * no seed can ever separate them.
+   */
+  bool build(const std::vector<std::string_view> &keys) {
+    size_ = keys.size();
+    seeds_.assign(std::max<size_t>(1, (keys.size() + 3) / 4), 0);
+    slots_.assign(keys.size(), kEmpty);
+
+    std::vector<std::vector<uint32_t>> buckets(seeds_.size());
+    for (uint32_t i = 0; i < keys.size(); ++i) {
+      buckets[hash(keys[i], 0) % buckets.size()].push_back(i);
+    }
+    std::vector<uint32_t> order(buckets.size());
+    for (uint32_t i = 0; i < order.size(); ++i) {
+      order[i] = i;
+    }
+    std::stable_sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) {
+      return buckets[a].size() > buckets[b].size();
+    });
+
+    std::vector<uint32_t> placed;
+    for (uint32_t bucket : order) {
+      const std::vector<uint32_t> &members = buckets[bucket];
+      if (members.empty()) {
+        break;
+      }
+      for (uint32_t a = 0; a < members.size(); ++a) {
+        for (uint32_t b = a + 1; b < members.size(); ++b) {
+          if (keys[members[a]] == keys[members[b]]) {
+            return false;
+          }
+        }
+      }
+      // A random placement of k keys into the remaining free slots succeeds
+      // often enough that this terminates quickly even for the last bucket.
+      for (uint32_t seed = 1;; ++seed) {
+        placed.clear();
+        for (uint32_t key : members) {
+          uint32_t slot = hash(keys[key], seed) % size_;
+          if (slots_[slot] != kEmpty ||
+              std::find(placed.begin(), placed.end(), slot) != placed.end()) {
+            break;
+          }
+          placed.push_back(slot);
+        }
+        if (placed.size() == members.size()) {
+          for (size_t i = 0; i < members.size(); ++i) {
+            slots_[placed[i]] = members[i];
+          }
+          seeds_[bucket] = seed;
+          break;
+        }
+      }
+    }
+    return true;
+  }
+
+  /** The number of slots, which is the number of keys. */
+  uint32_t size() const { return size_; }
+
+  /** The slot key is in if it is in the table at all. */
+  uint32_t slot(std::string_view key) const {
+    return slot(key, seeds_.data(), seeds_.size(), size_);
+  }
+
+  /** The same, for a table whose seeds were saved. size must not be 0. */
+  static uint32_t slot(std::string_view key, const uint32_t *seeds,
+                       uint32_t buckets, uint32_t size) {
+    return hash(key, seeds[hash(key, 0) % buckets]) % size;
+  }
+
+  /**
+   * The same for the key made of pieces one after another, which are never
+   * joined, so a compound key can be looked up without allocating.
+   */
+  static uint32_t slot(std::initializer_list<std::string_view> pieces,
+                       const uint32_t *seeds, uint32_t buckets,
+                       uint32_t size) {
+    return hash(pieces, seeds[hash(pieces, 0) % buckets]) % size;
+  }
+
+  /** The index, in the vector given to build(), of the key in each slot. */
+  const std::vector<uint32_t> &slots() const { return slots_; }
+
+  /** The seed of every bucket; all a saved table needs besides its keys. */
+  const std::vector<uint32_t> &seeds() const { return seeds_; }
+
+  /** FNV-1a with a seeded offset basis and a murmur3 finalizer. */
+  static uint64_t hash(std::string_view key, uint64_t seed) {
+    return hash({key}, seed);
+  }
+
+  /** The hash of pieces one after another, as if they were one key. */
+  static uint64_t hash(std::initializer_list<std::string_view> pieces,
+                       uint64_t seed) {
+    uint64_t h = 0xcbf29ce484222325ULL ^ (seed * 0x9e3779b97f4a7c15ULL);
+    for (std::string_view piece : pieces) {
+      for (unsigned char c : piece) {
+        h = (h ^ c) * 0x100000001b3ULL;
+      }
+    }
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    return h ^ (h >> 33);
+  }
+
+ private:
+  static constexpr uint32_t kEmpty = UINT32_MAX;
+
+  uint32_t size_ = 0;
+  std::vector<uint32_t> seeds_;
+  std::vector<uint32_t> slots_;
+};
@@ -1,22 +1,852 @@
 #include <assert.h>
 #include <cxxabi.h>
 #include <elf.h>
+#include <fcntl.h>
 #include <link.h>
+#include <poll.h>
+#include <sched.h>
+#include <signal.h>
+#include <sys/auxv.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
 
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
 #include <filesystem>
+#include <fstream>
 #include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
 #include <sstream>
+#include <string>
 #include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
 
+#include "collector.h"
+#include "livecounters.h"
+#include "perfecthash.h"
+#include "routetable.h"
 #include "sqlite3.h"
 
 // A pointer to the database that exists
 static sqlite3 *db;
+// The process that opened db. Children forked without exec inherit our
+// buffers and must leave writing them to the parent.
+static pid_t db_owner;
+// A second connection to the catalog, which is also attached to db, so
+// that new builds are written in transactions of their own.
+static sqlite3 *catalog_db;
 
-static std::unordered_map<uintptr_t, std::string> cookie_map;
+/**
+ * Optional collection modes, read from the environment in la_version().
+ */
+struct Options {
+  // RECORDSYMBOLS_DATABASE: where to write the recording, database.db by
+  // default. A %p is replaced with the process id so that every process of a
+  // corpus can record into its own file.
+  std::string database = "database.db";
+  // RECORDSYMBOLS_IN_MEMORY: record into an in-memory database and copy it
+  // to database only at exit; see backup_database().
+  bool in_memory = false;
+  // RECORDSYMBOLS_COLLECTOR: the Unix socket of a symbolcollector. Implies
+  // in_memory; the recording is sent there at exit and only written to
+  // database if that fails; see send_to_collector().
+  std::string collector;
+  // RECORDSYMBOLS_BIND_ORDER: record the order symbols are first bound in.
+  bool bind_order = false;
+  // RECORDSYMBOLS_ORDER_DIR: also write a --symbol-ordering-file per library
+  // into this directory. Implies bind_order.
+  std::string order_dir;
+  // RECORDSYMBOLS_FLAMEGRAPH: write folded cross-library call stacks here.
+  // Only honoured by the RECORD_PLT_CALLS build.
+  std::string flamegraph;
+  // RECORDSYMBOLS_REDIRECT: a file of "name replacement" lines. Libraries
+  // searched for under one of the names are loaded from the replacement
+  // instead; see la_objsearch().
+  std::string redirect;
+  // RECORDSYMBOLS_ROUTES: a table compiled by routetable. Bindings it lists
+  // are sent to another library's symbol; see route_binding().
+  std::string routes;
+  // RECORDSYMBOLS_PAGES: record which pages of every object are resident at
+  // exit; see flush_pages().
+  bool pages = false;
+  // RECORDSYMBOLS_SMAPS: record the memory of every object at exit; see
+  // flush_memory().
+  bool smaps = false;
+  // RECORDSYMBOLS_CATALOG: a database of the exports of every build seen,
+  // shared between recordings; see CatalogWriter.
+  std::string catalog;
+  // RECORDSYMBOLS_LIVE: the name of a shared-memory segment to publish
+  // counters in while the process runs, for recordsymbols-top. A %p is
+  // replaced with the process id; see open_live_counters().
+  std::string live;
+};
+
+static Options options;
+
+/**
+ * The replacements read from RECORDSYMBOLS_REDIRECT, indexed by a perfect
+ * hash of the name so every search costs two hashes and one comparison.
+ * Built in la_version() and only read afterwards.
+ */
+struct Redirects {
+  PerfectHash hash;
+  // (name, replacement) by slot of the name.
+  std::vector<std::pair<std::string, std::string>> entries;
+
+  /** The replacement for name, or nullptr. */
+  const char *find(std::string_view name) const {
+    if (entries.empty()) {
+      return nullptr;
+    }
+    const auto &entry = entries[hash.slot(name)];
+    return entry.first == name ? entry.second.c_str() : nullptr;
+  }
+};
+
+static Redirects redirects;
+
+/**
+ * Everything we remember about an object reported to la_objopen().
+ *
+ * A pointer to the record is handed back to the dynamic linker as the
+ * object's cookie, so la_symbind*() can reach it through *refcook without
+ * consulting a shared map. Records are never freed since the linker may
+ * present a cookie until the very end of the process.
+ */
+struct LibraryRecord {
+  LibraryRecord(std::string name, ElfW(Addr) base)
+      : name(std::move(name)), base(base) {}
+
+  std::string name;
+  // The load bias; symbol values are relative to this.
+  ElfW(Addr) base;
+  // The object's row in Libraries; 0 for objects that are not recorded.
+  int64_t id = 0;
+  // The object's .dynsym and .dynstr, as mapped.
+  const ElfW(Sym) *symbols = nullptr;
+  size_t symbol_count = 0;
+  const char *strings = nullptr;
+  // The PT_LOAD program headers, only kept for RECORDSYMBOLS_PAGES and
+  // RECORDSYMBOLS_SMAPS.
+  std::vector<ElfW(Phdr)> segments;
+  // The object's slot in the live counters, if any.
+  LiveLibrary *live = nullptr;
+#ifdef RECORD_PLT_CALLS
+  /** A defined function from the object's .dynsym. */
+  struct Function {
+    ElfW(Addr) start;
+    ElfW(Xword) size;
+    std::string name;
+  };
+  // Sorted by start so return addresses can be mapped to their caller.
+  std::vector<Function> functions;
+
+  /** The exported function containing address, if any. */
+  const Function *find_function(ElfW(Addr) address) const {
+    auto it = std::upper_bound(
+        functions.begin(), functions.end(), address,
+        [](ElfW(Addr) a, const Function &f) { return a < f.start; });
+    if (it == functions.begin()) {
+      return nullptr;
+    }
+    --it;
+    return address < it->start + it->size ? &*it : nullptr;
+  }
+#endif
+};
+
+/**
+ * The symbol routes mapped from RECORDSYMBOLS_ROUTES.
+ *
+ * The table itself stays in the mapping. Where each route leads is only
+ * known once its target library is loaded, so la_objopen() fills in the
+ * targets, and la_symbind*() reads them from any thread.
+ */
+struct Routes {
+  struct Target {
+    // Published with release ordering after library.
+    std::atomic<uintptr_t> address{0};
+    const LibraryRecord *library = nullptr;
+    std::atomic<bool> warned{false};
+  };
+
+  RouteTable table;
+  // Indexed like the table's entries.
+  std::unique_ptr<Target[]> targets;
+  // The routes into each library, by library name.
+  std::unordered_map<std::string, std::vector<uint32_t>> by_target_library;
+};
+
+static Routes routes;
+
+// Every object reported to la_objopen(), in load order. Only appended to by
+// la_objopen(), which the load lock serializes.
+static std::vector<LibraryRecord *> library_records;
+
+static void prepare(const char *sql, sqlite3_stmt **stmt) {
+  if (sqlite3_prepare_v2(db, sql, -1, stmt, nullptr) != SQLITE_OK) {
+    std::cerr << sqlite3_errmsg(db) << std::endl;
+  }
+}
+
+/** Run a statement that returns no rows and reset it for the next. */
+static void step(sqlite3_stmt *stmt) {
+  if (sqlite3_step(stmt) != SQLITE_DONE) {
+    std::cerr << sqlite3_errmsg(db) << std::endl;
+  }
+  sqlite3_reset(stmt);
+}
+
+/**
+ * A transaction on db that is rolled back unless committed, so a flush that
+ * gives up part way does not leave it open for the next one's BEGIN.
+ */
+class Transaction {
+ public:
+  Transaction() { open_ = exec("BEGIN TRANSACTION;"); }
+  Transaction(const Transaction &) = delete;
+  Transaction &operator=(const Transaction &) = delete;
+  ~Transaction() {
+    if (open_) {
+      exec("ROLLBACK;");
+    }
+  }
+
+  /** Whether BEGIN succeeded; if not, there is nothing to write in. */
+  bool open() const { return open_; }
+
+  void commit() {
+    // A failed COMMIT leaves the transaction open; it is rolled back.
+    open_ = !exec("COMMIT;");
+  }
+
+ private:
+  static bool exec(const char *sql) {
+    char *err_msg = nullptr;
+    if (sqlite3_exec(db, sql, 0, 0, &err_msg) != SQLITE_OK) {
+      std::cerr << err_msg << std::endl;
+      sqlite3_free(err_msg);
+      return false;
+    }
+    return true;
+  }
+
+  bool open_;
+};
+
+/**
+ * Writes symbol names to Strings and symbols to Symbols, each only once, so
+ * a Symbols or Usages row is a few integers however long the names are.
+ *
+ * Ids are handed out here rather than by SQLite so that no row has to be
+ * read back. Only used by la_objopen() and at exit, which never overlap.
+ */
+class SymbolWriter {
+ public:
+  SymbolWriter() {
+    prepare("INSERT INTO Strings(Id, Value) VALUES (?, ?);", &insert_string_);
+    prepare("INSERT INTO Symbols(Id, Library, Name, Size) VALUES (?, ?, ?, ?);",
+            &insert_symbol_);
+    prepare("UPDATE Symbols SET Size = ? WHERE Id = ? AND Size < ?;",
+            &grow_symbol_);
+  }
+  ~SymbolWriter() {
+    sqlite3_finalize(insert_string_);
+    sqlite3_finalize(insert_symbol_);
+    sqlite3_finalize(grow_symbol_);
+  }
+
+  /** The id of name in Strings, or 0 if it was never written. */
+  static int64_t find_string(const std::string &name) {
+    auto it = string_ids_.find(name);
+    return it == string_ids_.end() ? 0 : it->second;
+  }
+
+  int64_t string_id(const std::string &name) {
+    auto [it, inserted] = string_ids_.try_emplace(name, string_ids_.size() + 1);
+    if (inserted) {
+      sqlite3_bind_int64(insert_string_, 1, it->second);
+      sqlite3_bind_text(insert_string_, 2, name.c_str(), -1, SQLITE_STATIC);
+      step(insert_string_);
+    }
+    return it->second;
+  }
+
+  /**
+   * The id of the named symbol of library. Versioned symbols may be defined
+   * more than once under the same name; they share a row with the largest
+   * size. A binding to a symbol missing from .dynsym adds it with size 0.
+   */
+  int64_t symbol_id(int64_t library, const std::string &name, uint64_t size) {
+    uint64_t key = static_cast<uint64_t>(library) << 32 | string_id(name);
+    auto [it, inserted] = symbol_ids_.try_emplace(key, symbol_ids_.size() + 1);
+    if (inserted) {
+      sqlite3_bind_int64(insert_symbol_, 1, it->second);
+      sqlite3_bind_int64(insert_symbol_, 2, library);
+      sqlite3_bind_int64(insert_symbol_, 3, key & UINT32_MAX);
+      sqlite3_bind_int64(insert_symbol_, 4, size);
+      step(insert_symbol_);
+    } else if (size > 0) {
+      sqlite3_bind_int64(grow_symbol_, 1, size);
+      sqlite3_bind_int64(grow_symbol_, 2, it->second);
+      sqlite3_bind_int64(grow_symbol_, 3, size);
+      step(grow_symbol_);
+    }
+    return it->second;
+  }
+
+ private:
+  sqlite3_stmt *insert_string_ = nullptr;
+  sqlite3_stmt *insert_symbol_ = nullptr;
+  sqlite3_stmt *grow_symbol_ = nullptr;
+  static std::unordered_map<std::string, int64_t> string_ids_;
+  // By library id << 32 | name id.
+  static std::unordered_map<uint64_t, int64_t> symbol_ids_;
+};
+
+std::unordered_map<std::string, int64_t> SymbolWriter::string_ids_;
+std::unordered_map<uint64_t, int64_t> SymbolWriter::symbol_ids_;
+
+/**
+ * The exports of every object recorded with RECORDSYMBOLS_CATALOG, by
+ * build id, attached to db as "catalog". An object whose build is already
+ * in the catalog is not enumerated again; the recording only keeps its
+ * build id and the symbols bound to.
+ *
+ * Processes recording in parallel share the catalog. A new build's symbols
+ * are collected while the object is enumerated, then add() claims the build
+ * and inserts them in one short transaction on catalog_db, so every build
+ * is enumerated once and other recorders only wait for the inserts. Should
+ * that transaction fail, the symbols go into the recording instead.
+ */
+class CatalogWriter {
+ public:
+  CatalogWriter() {
+    prepare_catalog("SELECT 1 FROM Builds WHERE BuildId = ?;", &find_build_);
+    prepare_catalog("INSERT OR IGNORE INTO Builds(BuildId, Path) "
+                    "VALUES (?, ?);",
+                    &insert_build_);
+    prepare_catalog("INSERT INTO Symbols(Build, Name, Size) VALUES (?, ?, ?);",
+                    &insert_symbol_);
+  }
+  ~CatalogWriter() {
+    sqlite3_finalize(find_build_);
+    sqlite3_finalize(insert_build_);
+    sqlite3_finalize(insert_symbol_);
+  }
+
+  /** Whether the symbols of build_id are already in the catalog. */
+  bool known(const std::string &build_id) {
+    sqlite3_bind_text(find_build_, 1, build_id.c_str(), -1, SQLITE_STATIC);
+    bool found = sqlite3_step(find_build_) == SQLITE_ROW;
+    sqlite3_reset(find_build_);
+    return found;
+  }
+
+  /** Collect a symbol of the build for add(). */
+  void symbol(std::string name, uint64_t size) {
+    symbols_.emplace_back(std::move(name), size);
+  }
+
+  /**
+   * Claim build_id and insert the collected symbols, unless another process
+   * claimed it first. Returns false if the catalog could not be written,
+   * e.g. it stayed locked past the busy timeout; the caller then records
+   * symbols() itself.
+   */
+  bool add(const std::string &build_id, const std::string &path) {
+    // IMMEDIATE takes the write lock up front, waiting for it as long as
+    // the busy timeout allows, rather than failing on upgrading a read.
+    if (!exec_catalog("BEGIN IMMEDIATE;")) {
+      return false;
+    }
+    sqlite3_bind_text(insert_build_, 1, build_id.c_str(), -1, SQLITE_STATIC);
+    sqlite3_bind_text(insert_build_, 2, path.c_str(), -1, SQLITE_STATIC);
+    bool written = sqlite3_step(insert_build_) == SQLITE_DONE;
+    sqlite3_reset(insert_build_);
+    // Nothing changes if another process claimed it since known().
+    if (written && sqlite3_changes(catalog_db) > 0) {
+      int64_t build = sqlite3_last_insert_rowid(catalog_db);
+      for (const auto &[name, size] : symbols_) {
+        sqlite3_bind_int64(insert_symbol_, 1, build);
+        sqlite3_bind_text(insert_symbol_, 2, name.c_str(), -1, SQLITE_STATIC);
+        sqlite3_bind_int64(insert_symbol_, 3, size);
+        written = sqlite3_step(insert_symbol_) == SQLITE_DONE;
+        sqlite3_reset(insert_symbol_);
+        if (!written) {
+          break;
+        }
+      }
+    }
+    if (!written) {
+      std::cerr << options.catalog << ": " << sqlite3_errmsg(catalog_db)
+                << std::endl;
+    }
+    if (written && exec_catalog("COMMIT;")) {
+      return true;
+    }
+    exec_catalog("ROLLBACK;");
+    return false;
+  }
+
+  const std::vector<std::pair<std::string, uint64_t>> &symbols() const {
+    return symbols_;
+  }
+
+ private:
+  static void prepare_catalog(const char *sql, sqlite3_stmt **stmt) {
+    if (sqlite3_prepare_v2(catalog_db, sql, -1, stmt, nullptr) != SQLITE_OK) {
+      std::cerr << sqlite3_errmsg(catalog_db) << std::endl;
+    }
+  }
+
+  static bool exec_catalog(const char *sql) {
+    char *err_msg = nullptr;
+    if (sqlite3_exec(catalog_db, sql, 0, 0, &err_msg) != SQLITE_OK) {
+      std::cerr << options.catalog << ": " << err_msg << std::endl;
+      sqlite3_free(err_msg);
+      return false;
+    }
+    return true;
+  }
+
+  sqlite3_stmt *find_build_ = nullptr;
+  sqlite3_stmt *insert_build_ = nullptr;
+  sqlite3_stmt *insert_symbol_ = nullptr;
+  std::vector<std::pair<std::string, uint64_t>> symbols_;
+};
+
+// Every PerThread takes the next index into each thread's slots.
+static constexpr uint32_t kMaxPerThreadInstances = 8;
+static std::atomic<uint32_t> per_thread_instances{0};
+static thread_local void *per_thread_slots[kMaxPerThreadInstances];
+
+/**
+ * A value of type T owned by each thread that touches it.
+ *
+ * Lazily bound programs call la_symbind*() from whichever thread first hits
+ * an unresolved PLT slot, so recording state is kept per thread and only
+ * merged once the process exits. Each thread's value is pushed onto a
+ * lock-free list the first time it is used; the per-value mutex is only ever
+ * contended by the exit-time drain.
+ *
+ * Each instance is given its own index into a thread_local array of slots,
+ * as a thread_local in the template would be shared by every PerThread<T>
+ * with the same T, or even by every caller if keyed on the callback.
+ */
+template <typename T>
+class PerThread {
+ public:
+  PerThread() : index_(per_thread_instances.fetch_add(1)) {
+    assert(index_ < kMaxPerThreadInstances);
+  }
+
+  /** Run f with exclusive access to the calling thread's value. */
+  template <typename F>
+  void with_local(F f) {
+    Node *local = local_node();
+    std::lock_guard<std::mutex> guard(local->mutex);
+    f(local->value);
+  }
+
+  /** Run f over every thread's value, e.g. to drain them at exit. */
+  template <typename F>
+  void for_each(F f) {
+    for (Node *node = head_.load(std::memory_order_acquire); node != nullptr;
+         node = node->next) {
+      std::lock_guard<std::mutex> guard(node->mutex);
+      f(node->value);
+    }
+  }
+
+ private:
+  struct Node {
+    std::mutex mutex;
+    T value;
+    Node *next = nullptr;
+  };
+  std::atomic<Node *> head_{nullptr};
+  const uint32_t index_;
+
+  Node *local_node() {
+    void *&slot = per_thread_slots[index_];
+    if (slot == nullptr) {
+      Node *local = new Node();
+      local->next = head_.load(std::memory_order_relaxed);
+      while (!head_.compare_exchange_weak(local->next, local,
+                                          std::memory_order_release,
+                                          std::memory_order_relaxed)) {
+      }
+      slot = local;
+    }
+    return static_cast<Node *>(slot);
+  }
+};
+
+/**
+ * Bindings observed by a single thread, waiting to be written to Usages.
+ * Symbol names are copied as the defining object may be unloaded before
+ * exit and demangling is deferred until then to keep la_symbind*() cheap.
+ */
+struct UsageBuffer {
+  struct Usage {
+    const LibraryRecord *library;
+    const LibraryRecord *provider;
+    std::string symbol;
+  };
+  std::vector<Usage> usages;
+};
+
+static PerThread<UsageBuffer> usage_buffers;
+
+/**
+ * A symbol referenced by an object's non-PLT dynamic relocations.
+ *
+ * Data, TLS and GOT references are bound while the object is relocated and
+ * never reach la_symbind*(), so they are collected in la_objopen() and
+ * resolved at exit to the first object, in load order, defining the symbol.
+ * References that resolve to the referencing object itself are dropped.
+ */
+struct DataReference {
+  const LibraryRecord *library;
+  std::string symbol;
+  // A copy relocation is never satisfied by the referencing object itself.
+  bool copy;
+};
+
+// Only appended to by la_objopen(), which the load lock serializes.
+static std::vector<DataReference> data_references;
+
+/**
+ * A binding observed while recording the bind order.
+ * Without LD_BIND_NOW, bindings happen the first time a function is called,
+ * so the order of sequence numbers is the order of first use.
+ */
+struct BindEvent {
+  uint64_t sequence;
+  uint64_t nanoseconds;
+  const LibraryRecord *definer;
+  std::string symbol;
+};
+
+struct BindOrderBuffer {
+  std::vector<BindEvent> events;
+};
+
+static PerThread<BindOrderBuffer> bind_order_buffers;
+static std::atomic<uint64_t> bind_sequence{0};
+
+#ifdef RECORD_PLT_CALLS
+/**
+ * A cross-library call: the function making the call (an index into the
+ * caller's LibraryRecord::functions, or -1 when the call site is not inside
+ * an exported function) and the symbol being called, identified by its
+ * index in the defining object's symbol table.
+ */
+struct CallEdge {
+  const LibraryRecord *caller;
+  long function;
+  const LibraryRecord *callee;
+  unsigned int ndx;
+
+  bool operator==(const CallEdge &other) const {
+    return caller == other.caller && function == other.function &&
+           callee == other.callee && ndx == other.ndx;
+  }
+};
+
+struct CallEdgeHash {
+  size_t operator()(const CallEdge &edge) const {
+    size_t h = std::hash<const void *>()(edge.caller);
+    h = h * 31 + std::hash<long>()(edge.function);
+    h = h * 31 + std::hash<const void *>()(edge.callee);
+    return h * 31 + edge.ndx;
+  }
+};
+
+/**
+ * Call counts seen by a single thread. The callee's name is copied the first
+ * time an edge is seen so that it survives the callee being unloaded.
+ */
+struct CallEdgeBuffer {
+  std::unordered_map<CallEdge, std::pair<uint64_t, std::string>, CallEdgeHash>
+      edges;
+};
+
+static PerThread<CallEdgeBuffer> call_edge_buffers;
+
+/**
+ * Cross-library call paths seen by a single thread, as a trie of PLT calls.
+ *
+ * The shadow stack mirrors the calls that are currently in flight: a frame is
+ * pushed in la_pltenter and popped in la_pltexit, and the time in between is
+ * charged to the frame's trie node. Children of the root are the objects
+ * making the outermost calls.
+ */
+struct CallTrie {
+  struct Node {
+    Node(const LibraryRecord *library, std::string symbol, uint32_t parent)
+        : library(library), symbol(std::move(symbol)), parent(parent) {}
+
+    const LibraryRecord *library;
+    // The mangled name of the callee; empty for an outermost caller.
+    std::string symbol;
+    uint32_t parent;
+    uint64_t calls = 0;
+    uint64_t inclusive_cycles = 0;
+    std::map<std::pair<const LibraryRecord *, unsigned int>, uint32_t>
+        children;
+  };
+  struct Frame {
+    uint32_t node;
+    uint64_t start;
+    // The stack pointer at the PLT call; la_pltexit sees the same value.
+    ElfW(Addr) stack_pointer;
+  };
+
+  std::vector<Node> nodes{Node(nullptr, "", 0)};
+  std::vector<Frame> stack;
+
+  uint32_t child(uint32_t parent, const LibraryRecord *library,
+                 unsigned int ndx, const char *symname) {
+    auto it = nodes[parent].children.find({library, ndx});
+    if (it != nodes[parent].children.end()) {
+      return it->second;
+    }
+    uint32_t index = nodes.size();
+    nodes.emplace_back(library, symname == nullptr ? "" : symname, parent);
+    nodes[parent].children.emplace(std::make_pair(library, ndx), index);
+    return index;
+  }
+};
+
+static PerThread<CallTrie> call_tries;
+
+// How many bytes of the caller's stack the dynamic linker copies when it
+// needs to call la_pltexit. It must cover any arguments passed on the stack.
+static constexpr long kPltExitFrameSize = 1024;
+#endif
+
+/**
+ * Every entry point the dynamic linker (or process exit) calls into us
+ * through. Each one is timed so we can tell how much of a slow startup is
+ * the recorder itself; add new callbacks here and to callback_names.
+ */
+enum Callback {
+  kLaVersion,
+  kLaObjsearch,
+  kLaObjopen,
+  kLaSymbind32,
+  kLaSymbind64,
+  kLaPltenter,
+  kLaPltexit,
+  kFini,
+  kCallbackCount,
+};
+
+static const char *const callback_names[kCallbackCount] = {
+    "la_version",   "la_objsearch", "la_objopen", "la_symbind32",
+    "la_symbind64", "la_pltenter",  "la_pltexit", "fini",
+};
+
+/**
+ * Latencies of a single callback on a single thread.
+ *
+ * The histogram is log-linear: values below 4 get a bucket each, and every
+ * power of two above that is split into 4 sub-buckets, bounding the error of
+ * a reported percentile to 25%.
+ */
+struct CallbackStats {
+  static constexpr size_t kBuckets = 256;
+
+  uint64_t calls = 0;
+  uint64_t total_cycles = 0;
+  uint64_t max_cycles = 0;
+  std::array<uint64_t, kBuckets> histogram{};
+
+  static size_t bucket(uint64_t cycles) {
+    if (cycles < 4) {
+      return cycles;
+    }
+    size_t exponent = 63 - __builtin_clzll(cycles);
+    size_t sub_bucket = (cycles >> (exponent - 2)) & 3;
+    return (exponent - 1) * 4 + sub_bucket;
+  }
+
+  /** The largest value that falls into the given bucket. */
+  static uint64_t bucket_limit(size_t bucket) {
+    if (bucket < 4) {
+      return bucket;
+    }
+    size_t exponent = bucket / 4 + 1;
+    uint64_t lower = static_cast<uint64_t>(4 + bucket % 4) << (exponent - 2);
+    return lower + ((uint64_t{1} << (exponent - 2)) - 1);
+  }
+
+  void record(uint64_t cycles) {
+    ++calls;
+    total_cycles += cycles;
+    max_cycles = std::max(max_cycles, cycles);
+    ++histogram[bucket(cycles)];
+  }
+
+  void merge(const CallbackStats &other) {
+    calls += other.calls;
+    total_cycles += other.total_cycles;
+    max_cycles = std::max(max_cycles, other.max_cycles);
+    for (size_t i = 0; i < kBuckets; ++i) {
+      histogram[i] += other.histogram[i];
+    }
+  }
+
+  uint64_t percentile(double fraction) const {
+    uint64_t rank = static_cast<uint64_t>(fraction * calls);
+    uint64_t seen = 0;
+    for (size_t i = 0; i < kBuckets; ++i) {
+      seen += histogram[i];
+      if (seen > rank) {
+        return std::min(bucket_limit(i), max_cycles);
+      }
+    }
+    return max_cycles;
+  }
+};
+
+struct OverheadStats {
+  std::array<CallbackStats, kCallbackCount> callbacks;
+};
+
+static PerThread<OverheadStats> overhead_stats;
+
+// Used to convert cycles into wall clock time once the process exits.
+static uint64_t start_cycles;
+static std::chrono::steady_clock::time_point start_time;
+
+// The segment mapped for RECORDSYMBOLS_LIVE, or nullptr.
+static LiveHeader *live_counters;
+// Libraries loaded past this are only counted as dropped.
+static constexpr uint32_t kLiveCapacity = 1024;
+// kLiveOwned while live_counters are this process's own; see
+// detach_live_counters(). nullptr if the kernel cannot zero it on fork,
+// and then forked children count into their parent's segment.
+static std::atomic<uint32_t> *live_owner;
+static constexpr uint32_t kLiveDetaching = 1;
+static constexpr uint32_t kLiveOwned = 2;
+
+static void detach_live_counters();
+
+/**
+ * Times the enclosing scope and charges it to a callback.
+ * Declare one at the top of every audit callback.
+ */
+class CallbackTimer {
+ public:
+  explicit CallbackTimer(Callback callback)
+      : callback_(callback), start_(read_cycles()) {
+    if (live_counters != nullptr) {
+      detach_live_counters();
+    }
+  }
+
+  ~CallbackTimer() {
+    uint64_t elapsed = read_cycles() - start_;
+    overhead_stats.with_local([this, elapsed](OverheadStats &stats) {
+      stats.callbacks[callback_].record(elapsed);
+    });
+    if (live_counters != nullptr) {
+      live_counters->callback_cycles.fetch_add(elapsed,
+                                               std::memory_order_relaxed);
+      if (library_ != nullptr) {
+        library_->callback_cycles.fetch_add(elapsed,
+                                            std::memory_order_relaxed);
+      }
+    }
+  }
+
+  /** Also charge the time to the object identified by cookie. */
+  void charge(uintptr_t cookie) {
+    const LibraryRecord *library =
+        reinterpret_cast<const LibraryRecord *>(cookie);
+    library_ = library == nullptr ? nullptr : library->live;
+  }
+
+ private:
+  Callback callback_;
+  uint64_t start_;
+  LiveLibrary *library_ = nullptr;
+};
+
+static void flush_memory();
+static void flush_pages();
+static void flush_usages();
+static void flush_bind_order();
+#ifdef RECORD_PLT_CALLS
+static void flush_call_edges();
+static void flush_call_tries();
+#endif
+static void flush_overhead();
+static void backup_database();
+static bool send_to_collector();
+static void close_live_counters();
+static double nanoseconds_per_cycle();
 
 __attribute__((constructor)) static void init() {
   // Note: Cannot use print here.
+  start_cycles = read_cycles();
+  start_time = std::chrono::steady_clock::now();
+}
+
+/**
+ * Bindings are buffered in memory until the process exits, at which point
+ * they are written out in a single transaction.
+ */
+__attribute__((destructor)) static void fini() {
+  if (db == nullptr || getpid() != db_owner) {
+    return;
+  }
+  {
+    CallbackTimer timer(kFini);
+    if (options.smaps) {
+      flush_memory();
+    }
+    // Before the bindings are drained, as they say which symbols were used.
+    if (options.pages) {
+      flush_pages();
+    }
+    flush_usages();
+    if (options.bind_order) {
+      flush_bind_order();
+    }
+#ifdef RECORD_PLT_CALLS
+    flush_call_edges();
+    if (!options.flamegraph.empty()) {
+      flush_call_tries();
+    }
+#endif
+  }
+  flush_overhead();
+  if (options.in_memory &&
+      (options.collector.empty() || !send_to_collector())) {
+    backup_database();
+  }
+  sqlite3_close(db);
+  db = nullptr;
+  sqlite3_close(catalog_db);
+  catalog_db = nullptr;
+  close_live_counters();
 }
 
 /**
@@ -25,6 +855,316 @@ __attribute__((constructor)) static void init() {
  * It was an amazing learning resource to build an LD_AUDIT library.
  */
 
+/**
+ * Read the "name replacement" lines of a redirect file into redirects.
+ * Blank lines and lines starting with # are ignored. Exits on error, as
+ * running with half a layout would make any comparison meaningless.
+ */
+static void load_redirects(const std::string &path) {
+  std::ifstream file(path);
+  if (!file) {
+    std::cerr << "Could not read " << path << std::endl;
+    exit(1);
+  }
+  std::vector<std::pair<std::string, std::string>> entries;
+  std::string line;
+  for (size_t number = 1; std::getline(file, line); ++number) {
+    std::istringstream fields(line);
+    std::string name, replacement, extra;
+    if (!(fields >> name) || name[0] == '#') {
+      continue;
+    }
+    if (!(fields >> replacement) || (fields >> extra)) {
+      std::cerr << path << ":" << number
+                << ": expected \"name replacement\"" << std::endl;
+      exit(1);
+    }
+    entries.emplace_back(name, replacement);
+  }
+
+  std::vector<std::string_view> names;
+  for (const auto &entry : entries) {
+    names.push_back(entry.first);
+  }
+  if (!redirects.hash.build(names)) {
+    std::cerr << path << ": a name is redirected more than once" << std::endl;
+    exit(1);
+  }
+  redirects.entries.resize(entries.size());
+  for (uint32_t slot = 0; slot < entries.size(); ++slot) {
+    redirects.entries[slot] = std::move(entries[redirects.hash.slots()[slot]]);
+  }
+}
+
+/**
+ * Map the route table compiled by routetable. The mapping is never undone,
+ * as bindings keep pointing into it. Exits if the file is not a table.
+ */
+static void load_routes(const std::string &path) {
+  int fd = open(path.c_str(), O_RDONLY);
+  struct stat st;
+  if (fd < 0 || fstat(fd, &st) != 0) {
+    std::cerr << "Could not read " << path << std::endl;
+    exit(1);
+  }
+  void *data = st.st_size == 0 ? MAP_FAILED
+                               : mmap(nullptr, st.st_size, PROT_READ,
+                                      MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (data == MAP_FAILED || !routes.table.open(data, st.st_size)) {
+    std::cerr << path << " is not a route table" << std::endl;
+    exit(1);
+  }
+  routes.targets.reset(new Routes::Target[routes.table.size()]);
+  for (uint32_t i = 0; i < routes.table.size(); ++i) {
+    routes.by_target_library[routes.table.string(
+                                 routes.table.entry(i).target_library)]
+        .push_back(i);
+  }
+}
+
+/**
+ * Whether the segment name was left behind by a process that is gone, or
+ * by this one before it exec'd. Segments still being set up, or that are
+ * not live counters, are not.
+ */
+static bool stale_live_counters(const std::string &name) {
+  int fd = shm_open(name.c_str(), O_RDONLY, 0);
+  if (fd < 0) {
+    return false;
+  }
+  struct stat st;
+  LiveHeader header;
+  bool read_header = fstat(fd, &st) == 0 &&
+                     static_cast<size_t>(st.st_size) >= sizeof(header) &&
+                     pread(fd, &header, sizeof(header), 0) ==
+                         static_cast<ssize_t>(sizeof(header));
+  close(fd);
+  if (!read_header ||
+      memcmp(header.magic, kLiveMagic, sizeof(kLiveMagic)) != 0) {
+    return false;
+  }
+  return header.pid == getpid() ||
+         (kill(header.pid, 0) != 0 && errno == ESRCH);
+}
+
+/**
+ * Create the shared-memory segment named by RECORDSYMBOLS_LIVE and start
+ * publishing counters in it; see livecounters.h.
+ *
+ * A segment left behind by a process that is gone is replaced, while
+ * readers that still have it mapped keep the old one. If a running process
+ * has the name, e.g. the parent of an exec'd child that inherited a name
+ * without %p, "-pid" is appended to it instead. Failing only warns: the
+ * process runs on without live counters.
+ */
+static void open_live_counters(std::string name) {
+  size_t pid = name.find("%p");
+  if (pid != std::string::npos) {
+    name.replace(pid, 2, std::to_string(getpid()));
+  }
+  if (name.empty() || name[0] != '/') {
+    name.insert(0, "/");
+  }
+  int fd = shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0644);
+  if (fd < 0 && errno == EEXIST) {
+    if (stale_live_counters(name)) {
+      shm_unlink(name.c_str());
+    } else {
+      name += "-" + std::to_string(getpid());
+    }
+    fd = shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0644);
+  }
+  size_t size = live_counters_size(kLiveCapacity);
+  void *data = MAP_FAILED;
+  if (fd >= 0 && ftruncate(fd, size) == 0) {
+    data = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  }
+  int error = errno;
+  if (fd >= 0) {
+    close(fd);
+    if (data == MAP_FAILED) {
+      shm_unlink(name.c_str());
+    }
+  }
+  if (data == MAP_FAILED) {
+    std::cerr << "Could not create shared memory " << name << ": "
+              << strerror(error) << std::endl;
+    return;
+  }
+  options.live = name;
+  // The segment starts out zeroed.
+  LiveHeader *header = static_cast<LiveHeader *>(data);
+  header->capacity = kLiveCapacity;
+  header->pid = getpid();
+  header->start_cycles = start_cycles;
+  header->start_nanoseconds =
+      std::chrono::duration_cast<std::chrono::nanoseconds>(
+          start_time.time_since_epoch())
+          .count();
+  // Last, as readers and stale_live_counters() go by it.
+  memcpy(header->magic, kLiveMagic, sizeof(header->magic));
+  live_counters = header;
+  // A page of its own that a forked child gets zeroed, which is how
+  // detach_live_counters() tells it is in one.
+  void *owner = mmap(nullptr, sizeof(*live_owner), PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (owner != MAP_FAILED && madvise(owner, sizeof(*live_owner),
+                                     MADV_WIPEONFORK) == 0) {
+    live_owner = new (owner) std::atomic<uint32_t>(kLiveOwned);
+  }
+}
+
+/**
+ * In a child forked without exec, move a private copy of the counters over
+ * the parent's segment before the child counts anything, so it goes on
+ * counting without adding to its parent's totals. The copy takes the
+ * shared mapping's place, so the slots LibraryRecord::live points to stay
+ * where they are. The child also forgets the name, which its parent owns.
+ *
+ * Audit libraries get a libc of their own, whose pthread_atfork() handlers
+ * never run when the program forks, so this is checked on every callback
+ * instead: a load of a page the kernel zeroes in the child.
+ */
+static void detach_live_counters() {
+  if (live_owner == nullptr ||
+      live_owner->load(std::memory_order_acquire) == kLiveOwned) {
+    return;
+  }
+  uint32_t expected = 0;
+  if (!live_owner->compare_exchange_strong(expected, kLiveDetaching,
+                                           std::memory_order_acquire)) {
+    // Another thread of the child is detaching them.
+    while (live_owner->load(std::memory_order_acquire) != kLiveOwned) {
+      sched_yield();
+    }
+    return;
+  }
+  size_t size = live_counters_size(kLiveCapacity);
+  void *copy = mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (copy != MAP_FAILED) {
+    memcpy(copy, live_counters, size);
+    if (mremap(copy, size, size, MREMAP_MAYMOVE | MREMAP_FIXED,
+               live_counters) == MAP_FAILED) {
+      munmap(copy, size);
+      copy = MAP_FAILED;
+    }
+  }
+  if (copy == MAP_FAILED) {
+    // Zeroed counters then, which are still not the parent's.
+    mmap(live_counters, size, PROT_READ | PROT_WRITE,
+         MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0);
+  }
+  live_counters->pid = getpid();
+  options.live.clear();
+  live_owner->store(kLiveOwned, std::memory_order_release);
+}
+
+/**
+ * Give record a slot in the live counters, marked as being opened until
+ * live_library_opened(), if there are counters and a slot is left.
+ * la_objopen() is serialized, so it is the only writer of the slots.
+ */
+static void live_library_opening(LibraryRecord *record) {
+  if (live_counters == nullptr) {
+    return;
+  }
+  uint32_t index = live_counters->libraries.load(std::memory_order_relaxed);
+  if (index == live_counters->capacity) {
+    live_counters->dropped.fetch_add(1, std::memory_order_relaxed);
+    return;
+  }
+  LiveLibrary *library = &live_libraries(live_counters)[index];
+  library->sequence.store(1, std::memory_order_relaxed);
+  live_counters->libraries.store(index + 1, std::memory_order_release);
+  strncpy(library->name, record->name.c_str(), sizeof(library->name) - 1);
+  record->live = library;
+}
+
+/** Publish the symbol count of an opened library and complete its slot. */
+static void live_library_opened(const LibraryRecord *record) {
+  if (record->live == nullptr) {
+    return;
+  }
+  uint64_t defined = 0;
+  for (size_t i = 0; i < record->symbol_count; ++i) {
+    defined += record->symbols[i].st_shndx != SHN_UNDEF;
+  }
+  record->live->symbols = defined;
+  record->live->sequence.store(2, std::memory_order_release);
+}
+
+/** Count a binding in the live counters of both objects. */
+static void live_binding(uintptr_t refcook, uintptr_t defcook) {
+  const LibraryRecord *ref_library =
+      reinterpret_cast<const LibraryRecord *>(refcook);
+  const LibraryRecord *def_library =
+      reinterpret_cast<const LibraryRecord *>(defcook);
+  if (ref_library != nullptr && ref_library->live != nullptr) {
+    ref_library->live->imports.fetch_add(1, std::memory_order_relaxed);
+  }
+  if (def_library != nullptr && def_library->live != nullptr) {
+    def_library->live->bindings.fetch_add(1, std::memory_order_relaxed);
+  }
+}
+
+/**
+ * Attach the catalog named by RECORDSYMBOLS_CATALOG, creating it on first
+ * use, and note in the recording where it is. Exits on error, as the
+ * recording would be missing the symbols of every known build.
+ */
+static void attach_catalog() {
+  // Other processes hold the catalog for as long as inserting the symbols
+  // of one new build takes.
+  sqlite3_busy_timeout(db, 60000);
+  sqlite3_stmt *stmt = nullptr;
+  prepare("ATTACH DATABASE ? AS catalog;", &stmt);
+  sqlite3_bind_text(stmt, 1, options.catalog.c_str(), -1, SQLITE_STATIC);
+  int error = sqlite3_step(stmt) == SQLITE_DONE ? SQLITE_OK : SQLITE_ERROR;
+  sqlite3_finalize(stmt);
+
+  char *err_msg = nullptr;
+  if (error == SQLITE_OK) {
+    error = sqlite3_exec(
+        db,
+        R""""(
+        PRAGMA catalog.journal_mode = WAL;
+        CREATE TABLE IF NOT EXISTS catalog.Builds(Id INTEGER PRIMARY KEY,
+                                                  BuildId TEXT UNIQUE,
+                                                  Path TEXT);
+        CREATE TABLE IF NOT EXISTS catalog.Symbols(Build INTEGER, Name TEXT,
+                                                   Size INTEGER);
+        CREATE INDEX IF NOT EXISTS catalog.SymbolsByBuild
+          ON Symbols(Build, Name);
+        CREATE INDEX IF NOT EXISTS catalog.SymbolsByName ON Symbols(Name);
+        CREATE TABLE Catalog(Path TEXT);
+        )"""",
+        0, 0, &err_msg);
+  }
+  if (error == SQLITE_OK) {
+    prepare("INSERT INTO Catalog(Path) VALUES (?);", &stmt);
+    sqlite3_bind_text(stmt, 1, options.catalog.c_str(), -1, SQLITE_STATIC);
+    error = sqlite3_step(stmt) == SQLITE_DONE ? SQLITE_OK : SQLITE_ERROR;
+    sqlite3_finalize(stmt);
+  }
+  if (error != SQLITE_OK) {
+    std::cerr << options.catalog << ": " << sqlite3_errmsg(db) << std::endl;
+    sqlite3_free(err_msg);
+    sqlite3_close(db);
+    exit(1);
+  }
+  if (sqlite3_open_v2(options.catalog.c_str(), &catalog_db,
+                      SQLITE_OPEN_READWRITE, nullptr) != SQLITE_OK) {
+    std::cerr << options.catalog << ": " << sqlite3_errmsg(catalog_db)
+              << std::endl;
+    sqlite3_close(catalog_db);
+    sqlite3_close(db);
+    exit(1);
+  }
+  sqlite3_busy_timeout(catalog_db, 60000);
+}
+
 /*
    unsigned int la_version(unsigned int version);
    This is the only function that must be defined by an auditing
@@ -49,16 +1189,64 @@ __attribute__((constructor)) static void init() {
    the <link.h> definitions used to build the audit module.
 */
 unsigned int la_version(unsigned int version) {
+  CallbackTimer timer(kLaVersion);
   // If version == 0 the library will be ignored by the linker.
   if (version == 0) {
     return version;
   }
   std::cout << "Taking control of the linking search...." << std::endl;
 
+  options.bind_order = getenv("RECORDSYMBOLS_BIND_ORDER") != nullptr;
+  if (const char *order_dir = getenv("RECORDSYMBOLS_ORDER_DIR")) {
+    options.order_dir = order_dir;
+    options.bind_order = true;
+  }
+  if (const char *flamegraph = getenv("RECORDSYMBOLS_FLAMEGRAPH")) {
+    options.flamegraph = flamegraph;
+  }
+  if (const char *redirect = getenv("RECORDSYMBOLS_REDIRECT")) {
+    options.redirect = redirect;
+    load_redirects(options.redirect);
+  }
+  if (const char *route_table = getenv("RECORDSYMBOLS_ROUTES")) {
+    options.routes = route_table;
+    load_routes(options.routes);
+  }
+  options.pages = getenv("RECORDSYMBOLS_PAGES") != nullptr;
+  options.smaps = getenv("RECORDSYMBOLS_SMAPS") != nullptr;
+  options.in_memory = getenv("RECORDSYMBOLS_IN_MEMORY") != nullptr;
+  if (const char *collector = getenv("RECORDSYMBOLS_COLLECTOR")) {
+    options.collector = collector;
+    options.in_memory = true;
+  }
+  // The collector is sent the recording's own tables only, so it must hold
+  // every export.
+  const char *catalog = getenv("RECORDSYMBOLS_CATALOG");
+  if (catalog != nullptr && !options.collector.empty()) {
+    std::cerr << "RECORDSYMBOLS_CATALOG is ignored with "
+                 "RECORDSYMBOLS_COLLECTOR; every export is recorded"
+              << std::endl;
+  } else if (catalog != nullptr) {
+    // Recordings name the catalog, so it must be found from anywhere.
+    options.catalog = std::filesystem::absolute(catalog).string();
+  }
+  if (const char *database = getenv("RECORDSYMBOLS_DATABASE")) {
+    options.database = database;
+    size_t pid = options.database.find("%p");
+    if (pid != std::string::npos) {
+      options.database.replace(pid, 2, std::to_string(getpid()));
+    }
+  }
+  if (const char *live = getenv("RECORDSYMBOLS_LIVE")) {
+    open_live_counters(live);
+  }
+
   /**
    * Let's setup our sqlite3 database now.
    */
-  int error = sqlite3_open("database.db", &db);
+  db_owner = getpid();
+  int error = sqlite3_open(
+      options.in_memory ? ":memory:" : options.database.c_str(), &db);
   if (error != SQLITE_OK) {
     std::cerr << sqlite3_errstr(error) << std::endl;
     exit(1);
@@ -67,12 +1255,56 @@ unsigned int la_version(unsigned int version) {
   // Create our table
   std::string sql =
       R""""(
+      DROP VIEW IF EXISTS NamedSymbols;
+      DROP VIEW IF EXISTS NamedUsages;
       DROP TABLE IF EXISTS Libraries;
+      DROP TABLE IF EXISTS Catalog;
+      DROP TABLE IF EXISTS Strings;
       DROP TABLE IF EXISTS Symbols;
       DROP TABLE IF EXISTS Usages;
-      CREATE TABLE Libraries(Name TEXT PRIMARY KEY, Path TEXT);
-      CREATE TABLE Symbols(Name TEXT, Library TEXT);
-      CREATE TABLE Usages(Library TEXT, Symbol Text);
+      DROP TABLE IF EXISTS AuditOverhead;
+      DROP TABLE IF EXISTS BindOrder;
+      DROP TABLE IF EXISTS CallEdges;
+      DROP TABLE IF EXISTS CallPaths;
+      DROP TABLE IF EXISTS Pages;
+      DROP TABLE IF EXISTS Memory;
+      CREATE TABLE Libraries(Id INTEGER PRIMARY KEY, Name TEXT, Path TEXT,
+                             BuildId TEXT);
+      CREATE TABLE Strings(Id INTEGER PRIMARY KEY, Value TEXT);
+      CREATE TABLE Symbols(Id INTEGER PRIMARY KEY, Library INTEGER,
+                           Name INTEGER, Size INTEGER);
+      CREATE TABLE Usages(Library INTEGER, Symbol INTEGER);
+      CREATE VIEW NamedSymbols AS
+        SELECT Strings.Value AS Name, Libraries.Name AS Library, Size
+        FROM Symbols
+        JOIN Strings ON Strings.Id = Symbols.Name
+        JOIN Libraries ON Libraries.Id = Symbols.Library;
+      CREATE VIEW NamedUsages AS
+        SELECT Consumer.Name AS Library, Strings.Value AS Symbol,
+               Provider.Name AS Provider
+        FROM Usages
+        JOIN Libraries AS Consumer ON Consumer.Id = Usages.Library
+        JOIN Symbols ON Symbols.Id = Usages.Symbol
+        JOIN Strings ON Strings.Id = Symbols.Name
+        JOIN Libraries AS Provider ON Provider.Id = Symbols.Library;
+      CREATE TABLE AuditOverhead(Callback TEXT PRIMARY KEY, Calls INTEGER,
+                                 TotalCycles INTEGER, MaxCycles INTEGER,
+                                 P50Cycles INTEGER, P90Cycles INTEGER,
+                                 P99Cycles INTEGER, TotalNanoseconds INTEGER);
+      CREATE TABLE BindOrder(Sequence INTEGER PRIMARY KEY, Nanoseconds INTEGER,
+                             Library TEXT, Symbol TEXT, MangledSymbol TEXT);
+      CREATE TABLE CallEdges(Library TEXT, Caller TEXT, Provider TEXT,
+                             Symbol TEXT, Count INTEGER);
+      CREATE TABLE CallPaths(Path TEXT PRIMARY KEY, Calls INTEGER,
+                             InclusiveNanoseconds INTEGER,
+                             ExclusiveNanoseconds INTEGER);
+      CREATE TABLE Pages(Library TEXT PRIMARY KEY, MappedBytes INTEGER,
+                         ResidentBytes INTEGER, TextBytes INTEGER,
+                         ResidentTextBytes INTEGER, UsedSymbols INTEGER,
+                         UsedSymbolBytes INTEGER, UsedSymbolPages INTEGER);
+      CREATE TABLE Memory(Library TEXT PRIMARY KEY, Rss INTEGER, Pss INTEGER,
+                          SharedClean INTEGER, SharedDirty INTEGER,
+                          PrivateClean INTEGER, PrivateDirty INTEGER);
       )"""";
   char *err_msg = nullptr;
   error = sqlite3_exec(db, sql.c_str(), 0, 0, &err_msg);
@@ -83,6 +1315,9 @@ unsigned int la_version(unsigned int version) {
     sqlite3_close(db);
     exit(1);
   }
+  if (!options.catalog.empty()) {
+    attach_catalog();
+  }
 
   return LAV_CURRENT;
 }
@@ -109,6 +1344,45 @@ std::string demangle(std::string mangled_str) {
   return return_val;
 }
 
+/**
+ * The NT_GNU_BUILD_ID note of a mapped object as lowercase hex, or an empty
+ * string if the linker did not write one.
+ */
+static std::string read_build_id(const ElfW(Phdr) * phdr, size_t phnum,
+                                 ElfW(Addr) base) {
+  for (size_t i = 0; i < phnum; ++i) {
+    if (phdr[i].p_type != PT_NOTE) {
+      continue;
+    }
+    // Notes are padded to the segment's alignment, 4 or 8 bytes.
+    size_t align = phdr[i].p_align == 8 ? 8 : 4;
+    auto pad = [align](size_t size) {
+      return (size + align - 1) & ~(align - 1);
+    };
+    const char *note = reinterpret_cast<const char *>(base + phdr[i].p_vaddr);
+    const char *end = note + phdr[i].p_memsz;
+    while (note + sizeof(ElfW(Nhdr)) <= end) {
+      const ElfW(Nhdr) *header = reinterpret_cast<const ElfW(Nhdr) *>(note);
+      const char *name = note + sizeof(ElfW(Nhdr));
+      const unsigned char *desc = reinterpret_cast<const unsigned char *>(
+          name + pad(header->n_namesz));
+      note = reinterpret_cast<const char *>(desc) + pad(header->n_descsz);
+      if (note > end || header->n_type != NT_GNU_BUILD_ID ||
+          header->n_namesz != 4 || memcmp(name, "GNU", 4) != 0) {
+        continue;
+      }
+      static const char kHex[] = "0123456789abcdef";
+      std::string hex;
+      for (size_t j = 0; j < header->n_descsz; ++j) {
+        hex += kHex[desc[j] >> 4];
+        hex += kHex[desc[j] & 0xf];
+      }
+      return hex;
+    }
+  }
+  return std::string();
+}
+
 /**
  * This is the code from Musl's dynamic linker.
  * Originally, I could not get my interpretation of the code below to work so we
@@ -192,6 +1466,40 @@ size_t gnu_hash_symtab_len(const ElfW(Word) * base_address) {
   return last_symbol + header->symoffset;
 }
 
+/*
+   char *la_objsearch(const char *name, uintptr_t *cookie,
+                      unsigned int flag);
+   The dynamic linker invokes this function to inform the auditing
+   library that it is about to search for a shared object.  The name
+   argument is the filename or pathname that is to be searched for.
+   cookie identifies the shared object that initiated the search.
+   flag is set to one of the following values:
+   LA_SER_ORIG
+          This is the original name that is being searched for.
+          Typically, this name comes from an ELF DT_NEEDED entry, or
+          is the filename argument given to dlopen(3).
+   The return value of la_objsearch() is the pathname that the
+   dynamic linker should use for further processing.  If NULL is
+   returned, then this pathname is ignored for further processing.
+   If this audit library simply intends to monitor search paths,
+   then name should be returned.
+*/
+char *la_objsearch(const char *name, uintptr_t *cookie, unsigned int flag) {
+  CallbackTimer timer(kLaObjsearch);
+  // Only the original name is redirected; the replacement is then
+  // searched for like any other name, which a path short-circuits.
+  if (flag == LA_SER_ORIG) {
+    const char *replacement = redirects.find(name);
+    if (replacement == nullptr && strchr(name, '/') != nullptr) {
+      replacement = redirects.find(strrchr(name, '/') + 1);
+    }
+    if (replacement != nullptr) {
+      return const_cast<char *>(replacement);
+    }
+  }
+  return const_cast<char *>(name);
+}
+
 /*
     The dynamic linker calls this function when a new shared object
     is loaded.  The map argument is a pointer to a link-map structure
@@ -220,42 +1528,41 @@ size_t gnu_hash_symtab_len(const ElfW(Word) * base_address) {
     bindings should be audited for this object.
 */
 unsigned int la_objopen(struct link_map *map, Lmid_t lmid, uintptr_t *cookie) {
+  CallbackTimer timer(kLaObjopen);
   // This nis not a real shared library and is placed by the Kernel
   // The rest of the code won't work for it so just skip it for now.
   // https://man7.org/linux/man-pages/man7/vdso.7.html
   // TODO(fmzakari): Kernel docs say it's a real ELF format so it should work?
   if (std::string(map->l_name) == "linux-vdso.so.1") {
+    *cookie = reinterpret_cast<uintptr_t>(
+        new LibraryRecord(map->l_name, map->l_addr));
     return LA_FLG_BINDTO | LA_FLG_BINDFROM;
   }
 
   std::string library = std::filesystem::path(map->l_name).filename().string();
   /// TODO(fmzakari): Find a better name when it's empty which represents the
   /// process
+  std::string path = map->l_name;
   if (library.empty()) {
     library = "main";
+    // Record which program this is so recordings can be told apart.
+    path = std::filesystem::read_symlink("/proc/self/exe").string();
   }
-  std::ostringstream s;
-  s << "INSERT INTO Libraries(Name, Path) VALUES ('" << library << "','"
-    << map->l_name << "'"
-    << ");";
-  std::string sql = s.str();
-
-  char *err_msg = nullptr;
-  int error = sqlite3_exec(db, sql.c_str(), 0, 0, &err_msg);
-
-  if (error != SQLITE_OK) {
-    std::cerr << err_msg << std::endl;
-    sqlite3_free(err_msg);
-    sqlite3_close(db);
-    exit(1);
-  }
-
-  // store reference of the cookie as we will need it later
-  cookie_map.insert({*cookie, library});
+  // la_objopen() is serialized by the dynamic linker's load lock, so the
+  // inserts below may use the database directly. Bindings may race on many
+  // threads and instead find the library through the cookie.
+  LibraryRecord *record = new LibraryRecord(library, map->l_addr);
+  record->id = library_records.size() + 1;
+  *cookie = reinterpret_cast<uintptr_t>(record);
+  library_records.push_back(record);
+  live_library_opening(record);
+  timer.charge(*cookie);
 
   // Keep reference to sections we care about
   const char *strtab = nullptr;
   const ElfW(Sym) *elf_sym = nullptr;
+  const ElfW(Rela) *rela = nullptr;
+  size_t rela_size = 0;
   size_t sym_cnt_hash = 0;
   size_t sym_cnt_dt_hash = 0;
   const ElfW(Dyn) *const dyn_start = map->l_ld;
@@ -283,6 +1590,14 @@ unsigned int la_objopen(struct link_map *map, Lmid_t lmid, uintptr_t *cookie) {
         }
         break;
       }
+      case (DT_RELA): {
+        rela = reinterpret_cast<const ElfW(Rela) *>(base_address);
+        break;
+      }
+      case (DT_RELASZ): {
+        rela_size = dyn->d_un.d_val;
+        break;
+      }
       case (DT_HASH): {
         // https://flapenguin.me/elf-dt-hash
         struct hash_header {
@@ -304,13 +1619,90 @@ unsigned int la_objopen(struct link_map *map, Lmid_t lmid, uintptr_t *cookie) {
     exit(1);
   }
   size_t sym_cnt = sym_cnt_dt_hash;
+  record->symbols = elf_sym;
+  record->symbol_count = sym_cnt;
+  record->strings = strtab;
+
+  // Objects are mapped from their start, so the ELF header is at the load
+  // bias; the program's headers may not be mapped, but the kernel says
+  // where they are.
+  const ElfW(Phdr) *phdr = nullptr;
+  size_t phnum = 0;
+  const ElfW(Ehdr) *ehdr = reinterpret_cast<const ElfW(Ehdr) *>(map->l_addr);
+  if (library == "main") {
+    phdr = reinterpret_cast<const ElfW(Phdr) *>(getauxval(AT_PHDR));
+    phnum = getauxval(AT_PHNUM);
+  } else if (ehdr != nullptr && memcmp(ehdr->e_ident, ELFMAG, SELFMAG) == 0) {
+    phdr = reinterpret_cast<const ElfW(Phdr) *>(map->l_addr + ehdr->e_phoff);
+    phnum = ehdr->e_phnum;
+  }
+  if (options.pages || options.smaps) {
+    for (size_t i = 0; i < phnum; ++i) {
+      if (phdr[i].p_type == PT_LOAD) {
+        record->segments.push_back(phdr[i]);
+      }
+    }
+  }
+  std::string build_id = read_build_id(phdr, phnum, map->l_addr);
+
+  // One transaction per object rather than one per row.
+  char *err_msg = nullptr;
+  int error = sqlite3_exec(db, "BEGIN TRANSACTION;", 0, 0, &err_msg);
+  sqlite3_stmt *stmt = nullptr;
+  if (error == SQLITE_OK) {
+    error = sqlite3_prepare_v2(db,
+                               "INSERT INTO Libraries(Id, Name, Path, BuildId) "
+                               "VALUES (?, ?, ?, ?);",
+                               -1, &stmt, nullptr);
+  }
+  if (error == SQLITE_OK) {
+    sqlite3_bind_int64(stmt, 1, record->id);
+    sqlite3_bind_text(stmt, 2, library.c_str(), -1, SQLITE_STATIC);
+    sqlite3_bind_text(stmt, 3, path.c_str(), -1, SQLITE_STATIC);
+    if (!build_id.empty()) {
+      sqlite3_bind_text(stmt, 4, build_id.c_str(), -1, SQLITE_STATIC);
+    }
+    error = sqlite3_step(stmt) == SQLITE_DONE ? SQLITE_OK : SQLITE_ERROR;
+    sqlite3_finalize(stmt);
+  }
+  if (error != SQLITE_OK) {
+    std::cerr << sqlite3_errmsg(db) << std::endl;
+    sqlite3_free(err_msg);
+    sqlite3_close(db);
+    exit(1);
+  }
+
+  // Objects without a build id cannot be told apart from a rebuild and are
+  // always enumerated into the recording itself.
+  std::unique_ptr<CatalogWriter> catalog;
+  bool cataloged = !options.catalog.empty() && !build_id.empty();
+  if (cataloged) {
+    catalog = std::make_unique<CatalogWriter>();
+    if (catalog->known(build_id)) {
+      catalog.reset();
+    }
+  }
 
-  s.str(std::string());  // clear the string stream
-  s << "INSERT INTO Symbols(Name, Library) VALUES ";
+  // The routes leading here, by the name of the symbol they go to.
+  std::unordered_map<std::string_view, std::vector<uint32_t>> routed_here;
+  auto routed = routes.by_target_library.find(library);
+  if (routed != routes.by_target_library.end()) {
+    for (uint32_t route : routed->second) {
+      routed_here[routes.table.string(
+                      routes.table.entry(route).target_symbol)]
+          .push_back(route);
+    }
+  }
 
-  for (size_t sym_index = 0; sym_index < sym_cnt; ++sym_index) {
+  // A known build only needs enumerating for the routes and PLT calls.
+  bool enumerate = !cataloged || catalog != nullptr || !routed_here.empty();
+#ifdef RECORD_PLT_CALLS
+  enumerate = true;
+#endif
+  bool write_symbols = !cataloged || catalog != nullptr;
+  SymbolWriter writer;
+  for (size_t sym_index = 0; enumerate && sym_index < sym_cnt; ++sym_index) {
     const char *sym_name = &strtab[elf_sym[sym_index].st_name];
-    std::string demangled_sym_name = demangle(sym_name);
 
     // Symbols whose section index is undefined means they are imported.
     // We don't record these as we only care about defined ones.
@@ -318,28 +1710,169 @@ unsigned int la_objopen(struct link_map *map, Lmid_t lmid, uintptr_t *cookie) {
       continue;
     }
 
+    if (!routed_here.empty()) {
+      auto it = routed_here.find(sym_name);
+      if (it != routed_here.end()) {
+        // An IFUNC's value is its resolver, which must not run from here.
+        bool ifunc =
+            ELF64_ST_TYPE(elf_sym[sym_index].st_info) == STT_GNU_IFUNC;
+        for (uint32_t route : it->second) {
+          if (ifunc) {
+            std::cerr << "Cannot route to " << sym_name << " in " << library
+                      << ": it is an IFUNC" << std::endl;
+            continue;
+          }
+          Routes::Target &target = routes.targets[route];
+          target.library = record;
+          target.address.store(map->l_addr + elf_sym[sym_index].st_value,
+                               std::memory_order_release);
+        }
+        // Later definitions are other versions of the same symbol.
+        routed_here.erase(it);
+      }
+    }
+
+#ifdef RECORD_PLT_CALLS
+    unsigned char type = ELF64_ST_TYPE(elf_sym[sym_index].st_info);
+    if (type == STT_FUNC || type == STT_GNU_IFUNC) {
+      record->functions.push_back({map->l_addr + elf_sym[sym_index].st_value,
+                                   elf_sym[sym_index].st_size, sym_name});
+    }
+#endif
+
+    if (!write_symbols) {
+      continue;
+    }
+    std::string demangled_sym_name = demangle(sym_name);
     // TODO(fmzakar): This is helpful for debugging. Use GLOG?
     // std::cout << library << " " << demangled_sym_name << std::endl;
-    s << "('" << demangled_sym_name << "','" << library << "'"
-      << ")";
-    if (sym_index < sym_cnt - 1) {
-      s << ",";
+    if (catalog != nullptr) {
+      catalog->symbol(std::move(demangled_sym_name),
+                      elf_sym[sym_index].st_size);
+    } else {
+      writer.symbol_id(record->id, demangled_sym_name,
+                       elf_sym[sym_index].st_size);
     }
   }
+  if (catalog != nullptr && !catalog->add(build_id, path)) {
+    for (const auto &[name, size] : catalog->symbols()) {
+      writer.symbol_id(record->id, name, size);
+    }
+  }
+  catalog.reset();
 
-  s << ";";
-  sql = s.str();
-  error = sqlite3_exec(db, sql.c_str(), 0, 0, &err_msg);
-  if (error != SQLITE_OK) {
+  std::set<std::string> referenced;
+  for (size_t i = 0; i < rela_size / sizeof(ElfW(Rela)); ++i) {
+    size_t sym_index = ELF64_R_SYM(rela[i].r_info);
+    if (sym_index == 0) {
+      continue;
+    }
+#if defined(__aarch64__)
+    bool copy = ELF64_R_TYPE(rela[i].r_info) == R_AARCH64_COPY;
+#else
+    bool copy = ELF64_R_TYPE(rela[i].r_info) == R_X86_64_COPY;
+#endif
+    const char *sym_name = &strtab[elf_sym[sym_index].st_name];
+    if (referenced.insert(sym_name).second) {
+      data_references.push_back({record, sym_name, copy});
+    }
+  }
+
+#ifdef RECORD_PLT_CALLS
+  std::sort(record->functions.begin(), record->functions.end(),
+            [](const LibraryRecord::Function &a,
+               const LibraryRecord::Function &b) { return a.start < b.start; });
+#endif
+
+  if (sqlite3_exec(db, "COMMIT;", 0, 0, &err_msg) != SQLITE_OK) {
     std::cerr << err_msg << std::endl;
     sqlite3_free(err_msg);
     sqlite3_close(db);
     exit(1);
   }
 
+  live_library_opened(record);
   return LA_FLG_BINDTO | LA_FLG_BINDFROM;
 }
 
+/**
+ * Remember that the object identified by refcook bound to symname, which
+ * the object identified by defcook provides.
+ *
+ * Without LD_BIND_NOW this runs concurrently on every thread that resolves a
+ * PLT slot, so it only touches the calling thread's buffer.
+ */
+static void record_usage(uintptr_t refcook, uintptr_t defcook,
+                         const char *symname) {
+  const LibraryRecord *ref_library =
+      reinterpret_cast<const LibraryRecord *>(refcook);
+  const LibraryRecord *def_library =
+      reinterpret_cast<const LibraryRecord *>(defcook);
+  if (ref_library == nullptr || def_library == nullptr) {
+    std::cerr << "Could not find a cookie. Assertion failed." << std::endl;
+    exit(1);
+  }
+  usage_buffers.with_local([&](UsageBuffer &buffer) {
+    buffer.usages.push_back({ref_library, def_library, symname});
+  });
+}
+
+/**
+ * Remember when symname was bound to the object identified by defcook.
+ *
+ * The sequence counter is the only state shared between threads; it is
+ * also why this is a separate mode rather than always on.
+ */
+static void record_bind_order(uintptr_t defcook, const char *symname) {
+  uint64_t sequence = bind_sequence.fetch_add(1, std::memory_order_relaxed);
+  uint64_t nanoseconds =
+      std::chrono::duration_cast<std::chrono::nanoseconds>(
+          std::chrono::steady_clock::now() - start_time)
+          .count();
+  const LibraryRecord *definer =
+      reinterpret_cast<const LibraryRecord *>(defcook);
+  bind_order_buffers.with_local([&](BindOrderBuffer &buffer) {
+    buffer.events.push_back({sequence, nanoseconds, definer, symname});
+  });
+}
+
+/**
+ * Where a binding of *symname to value, in the object identified by
+ * *definer, should go instead.
+ *
+ * If RECORDSYMBOLS_ROUTES sends it elsewhere and the target library has
+ * been loaded, the target's address is returned and *definer and *symname
+ * are updated, so the binding is recorded as the one actually made.
+ * Otherwise value is returned unchanged.
+ */
+static uintptr_t route_binding(uintptr_t value, uintptr_t *definer,
+                               const char **symname) {
+  const LibraryRecord *library =
+      reinterpret_cast<const LibraryRecord *>(*definer);
+  if (routes.table.size() == 0 || library == nullptr) {
+    return value;
+  }
+  int64_t route = routes.table.find(library->name, *symname);
+  if (route < 0) {
+    return value;
+  }
+  Routes::Target &target = routes.targets[route];
+  uintptr_t address = target.address.load(std::memory_order_acquire);
+  if (address == 0) {
+    if (!target.warned.exchange(true)) {
+      const RouteEntry &entry = routes.table.entry(route);
+      std::cerr << "Not routing " << *symname << ": "
+                << routes.table.string(entry.target_symbol) << " in "
+                << routes.table.string(entry.target_library)
+                << " is not loaded" << std::endl;
+    }
+    return value;
+  }
+  *definer = reinterpret_cast<uintptr_t>(target.library);
+  *symname = routes.table.string(routes.table.entry(route).target_symbol);
+  return address;
+}
+
 /*
    The dynamic linker invokes one of these functions when a symbol
    binding occurs between two shared objects that have been marked
@@ -390,55 +1923,978 @@ unsigned int la_objopen(struct link_map *map, Lmid_t lmid, uintptr_t *cookie) {
 uintptr_t la_symbind32(Elf32_Sym *sym, unsigned int ndx, uintptr_t *refcook,
                        uintptr_t *defcook, unsigned int *flags,
                        const char *symname) {
-  auto ref_library_it = cookie_map.find(*refcook);
-  if (ref_library_it == cookie_map.end()) {
-    std::cerr << "Could not find a cookie. Assertion failed." << std::endl;
-    exit(1);
+  CallbackTimer timer(kLaSymbind32);
+  uintptr_t definer = *defcook;
+  uintptr_t value = route_binding(sym->st_value, &definer, &symname);
+  record_usage(*refcook, definer, symname);
+  if (live_counters != nullptr) {
+    live_binding(*refcook, definer);
+    timer.charge(definer);
+  }
+  if (options.bind_order) {
+    record_bind_order(definer, symname);
+  }
+  return value;
+}
+
+uintptr_t la_symbind64(Elf64_Sym *sym, unsigned int ndx, uintptr_t *refcook,
+                       uintptr_t *defcook, unsigned int *flags,
+                       const char *symname) {
+  CallbackTimer timer(kLaSymbind64);
+  uintptr_t definer = *defcook;
+  uintptr_t value = route_binding(sym->st_value, &definer, &symname);
+  record_usage(*refcook, definer, symname);
+  if (live_counters != nullptr) {
+    live_binding(*refcook, definer);
+    timer.charge(definer);
+  }
+  if (options.bind_order) {
+    record_bind_order(definer, symname);
+  }
+  return value;
+}
+
+#ifdef RECORD_PLT_CALLS
+/**
+ * Attribute a call through a PLT slot to the function that made it.
+ *
+ * return_address is inside the caller, which is looked up among the
+ * exported functions recorded for the referencing object in la_objopen().
+ */
+static void record_call(uintptr_t refcook, uintptr_t defcook, unsigned int ndx,
+                        ElfW(Addr) return_address, const char *symname) {
+  const LibraryRecord *caller =
+      reinterpret_cast<const LibraryRecord *>(refcook);
+  const LibraryRecord *callee =
+      reinterpret_cast<const LibraryRecord *>(defcook);
+  const LibraryRecord::Function *function =
+      caller->find_function(return_address);
+  if (callee->live != nullptr) {
+    callee->live->plt_calls.fetch_add(1, std::memory_order_relaxed);
+  }
+  CallEdge edge{caller,
+                function == nullptr ? -1 : function - caller->functions.data(),
+                callee, ndx};
+  call_edge_buffers.with_local([&](CallEdgeBuffer &buffer) {
+    auto [it, inserted] = buffer.edges.try_emplace(edge, 0, std::string());
+    if (inserted) {
+      it->second.second = symname;
+    }
+    ++it->second.first;
+  });
+}
+
+/** Push a frame for a PLT call onto the calling thread's shadow stack. */
+static void shadow_push(uintptr_t refcook, uintptr_t defcook, unsigned int ndx,
+                        ElfW(Addr) stack_pointer, const char *symname) {
+  const LibraryRecord *caller =
+      reinterpret_cast<const LibraryRecord *>(refcook);
+  const LibraryRecord *callee =
+      reinterpret_cast<const LibraryRecord *>(defcook);
+  call_tries.with_local([&](CallTrie &trie) {
+    uint32_t parent = trie.stack.empty()
+                          ? trie.child(0, caller, ~0u, nullptr)
+                          : trie.stack.back().node;
+    uint32_t node = trie.child(parent, callee, ndx, symname);
+    trie.stack.push_back({node, read_cycles(), stack_pointer});
+  });
+}
+
+/**
+ * Pop the frame pushed for the PLT call made at stack_pointer.
+ *
+ * Calls that were left through longjmp or an exception never reach
+ * la_pltexit, so any frames above the matching one are closed as well.
+ */
+static void shadow_pop(ElfW(Addr) stack_pointer) {
+  uint64_t now = read_cycles();
+  call_tries.with_local([&](CallTrie &trie) {
+    while (!trie.stack.empty()) {
+      CallTrie::Frame frame = trie.stack.back();
+      trie.stack.pop_back();
+      CallTrie::Node &node = trie.nodes[frame.node];
+      ++node.calls;
+      node.inclusive_cycles += now - frame.start;
+      if (frame.stack_pointer >= stack_pointer) {
+        break;
+      }
+    }
+  });
+}
+
+/*
+   ElfW(Addr) la_pltenter(ElfW(Sym) *sym, unsigned int ndx,
+                          uintptr_t *refcook, uintptr_t *defcook,
+                          La_regs *regs, unsigned int *flags,
+                          const char *symname, long *framesizep);
+   When a PLT entry is called between two shared objects that have
+   been marked for binding notification, the dynamic linker calls
+   the la_pltenter() function appropriate for the hardware
+   architecture before transferring control to the target of the
+   PLT entry. The regs argument points to a structure (defined in
+   <link.h>) containing the values of registers to be used for the
+   call to this PLT entry.
+   This is only called for PLT slots that are resolved lazily, so
+   run the program without LD_BIND_NOW.
+   la_pltexit() is only called once the PLT entry returns if
+   *framesizep is set to the number of bytes of stack the dynamic
+   linker should copy for the call.
+*/
+#if defined(__x86_64__)
+ElfW(Addr) la_x86_64_gnu_pltenter(ElfW(Sym) *sym, unsigned int ndx,
+                                  uintptr_t *refcook, uintptr_t *defcook,
+                                  La_x86_64_regs *regs, unsigned int *flags,
+                                  const char *symname, long int *framesizep) {
+  CallbackTimer timer(kLaPltenter);
+  timer.charge(*defcook);
+  // The call instruction has just pushed the return address.
+  ElfW(Addr) return_address = *reinterpret_cast<ElfW(Addr) *>(regs->lr_rsp);
+  record_call(*refcook, *defcook, ndx, return_address, symname);
+  if (!options.flamegraph.empty()) {
+    shadow_push(*refcook, *defcook, ndx, regs->lr_rsp, symname);
+    *framesizep = kPltExitFrameSize;
+  }
+  return sym->st_value;
+}
+
+unsigned int la_x86_64_gnu_pltexit(ElfW(Sym) *sym, unsigned int ndx,
+                                   uintptr_t *refcook, uintptr_t *defcook,
+                                   const La_x86_64_regs *inregs,
+                                   La_x86_64_retval *outregs,
+                                   const char *symname) {
+  CallbackTimer timer(kLaPltexit);
+  timer.charge(*defcook);
+  shadow_pop(inregs->lr_rsp);
+  return 0;
+}
+#elif defined(__aarch64__)
+ElfW(Addr) la_aarch64_gnu_pltenter(ElfW(Sym) *sym, unsigned int ndx,
+                                   uintptr_t *refcook, uintptr_t *defcook,
+                                   La_aarch64_regs *regs, unsigned int *flags,
+                                   const char *symname, long int *framesizep) {
+  CallbackTimer timer(kLaPltenter);
+  timer.charge(*defcook);
+  record_call(*refcook, *defcook, ndx, regs->lr_lr, symname);
+  if (!options.flamegraph.empty()) {
+    shadow_push(*refcook, *defcook, ndx, regs->lr_sp, symname);
+    *framesizep = kPltExitFrameSize;
+  }
+  return sym->st_value;
+}
+
+unsigned int la_aarch64_gnu_pltexit(ElfW(Sym) *sym, unsigned int ndx,
+                                    uintptr_t *refcook, uintptr_t *defcook,
+                                    const La_aarch64_regs *inregs,
+                                    La_aarch64_retval *outregs,
+                                    const char *symname) {
+  CallbackTimer timer(kLaPltexit);
+  timer.charge(*defcook);
+  shadow_pop(inregs->lr_sp);
+  return 0;
+}
+#else
+#error "RECORD_PLT_CALLS is only supported on x86_64 and aarch64"
+#endif
+
+/**
+ * Merge every thread's call counts into the CallEdges table.
+ * Calls made from outside any exported function are attributed to <local>.
+ */
+static void flush_call_edges() {
+  std::unordered_map<CallEdge, std::pair<uint64_t, std::string>, CallEdgeHash>
+      edges;
+  call_edge_buffers.for_each([&edges](CallEdgeBuffer &buffer) {
+    for (auto &[edge, count_and_name] : buffer.edges) {
+      auto [it, inserted] = edges.try_emplace(edge, 0, count_and_name.second);
+      it->second.first += count_and_name.first;
+    }
+    buffer.edges.clear();
+  });
+
+  Transaction transaction;
+  if (!transaction.open()) {
+    return;
+  }
+  sqlite3_stmt *stmt = nullptr;
+  int error = sqlite3_prepare_v2(
+      db,
+      "INSERT INTO CallEdges(Library, Caller, Provider, Symbol, Count) "
+      "VALUES (?, ?, ?, ?, ?);",
+      -1, &stmt, nullptr);
+  if (error != SQLITE_OK) {
+    std::cerr << sqlite3_errmsg(db) << std::endl;
+    return;
+  }
+  for (const auto &[edge, count_and_name] : edges) {
+    std::string caller =
+        edge.function < 0
+            ? std::string("<local>")
+            : demangle(edge.caller->functions[edge.function].name);
+    std::string callee = demangle(count_and_name.second);
+    sqlite3_bind_text(stmt, 1, edge.caller->name.c_str(), -1, SQLITE_STATIC);
+    sqlite3_bind_text(stmt, 2, caller.c_str(), -1, SQLITE_TRANSIENT);
+    sqlite3_bind_text(stmt, 3, edge.callee->name.c_str(), -1, SQLITE_STATIC);
+    sqlite3_bind_text(stmt, 4, callee.c_str(), -1, SQLITE_TRANSIENT);
+    sqlite3_bind_int64(stmt, 5, count_and_name.first);
+    if (sqlite3_step(stmt) != SQLITE_DONE) {
+      std::cerr << sqlite3_errmsg(db) << std::endl;
+    }
+    sqlite3_reset(stmt);
+  }
+  sqlite3_finalize(stmt);
+  transaction.commit();
+}
+
+/**
+ * Merge every thread's call trie by path and write the result to CallPaths
+ * and, in the folded format read by flamegraph.pl and friends, to the file
+ * named by RECORDSYMBOLS_FLAMEGRAPH. The folded stacks carry exclusive time
+ * in nanoseconds, i.e. time not spent in a nested cross-library call.
+ */
+static void flush_call_tries() {
+  struct PathTotals {
+    uint64_t calls = 0;
+    uint64_t inclusive_cycles = 0;
+    uint64_t exclusive_cycles = 0;
+  };
+  std::map<std::string, PathTotals> paths;
+  call_tries.for_each([&paths](CallTrie &trie) {
+    // Parents are always created before their children.
+    std::vector<std::string> node_paths(trie.nodes.size());
+    for (uint32_t i = 1; i < trie.nodes.size(); ++i) {
+      const CallTrie::Node &node = trie.nodes[i];
+      std::string label = node.library->name;
+      if (!node.symbol.empty()) {
+        label += "`" + demangle(node.symbol);
+      }
+      node_paths[i] = node.parent == 0
+                          ? label
+                          : node_paths[node.parent] + ";" + label;
+      if (node.parent == 0) {
+        // The calling object itself; not a call.
+        continue;
+      }
+      uint64_t children_cycles = 0;
+      for (const auto &[key, child] : node.children) {
+        children_cycles += trie.nodes[child].inclusive_cycles;
+      }
+      PathTotals &totals = paths[node_paths[i]];
+      totals.calls += node.calls;
+      totals.inclusive_cycles += node.inclusive_cycles;
+      totals.exclusive_cycles +=
+          node.inclusive_cycles - std::min(children_cycles,
+                                           node.inclusive_cycles);
+    }
+  });
+  double ns_per_cycle = nanoseconds_per_cycle();
+
+  std::ofstream out(options.flamegraph);
+  if (!out) {
+    std::cerr << "Could not write " << options.flamegraph << std::endl;
+  }
+  for (const auto &[path, totals] : paths) {
+    uint64_t exclusive_ns = totals.exclusive_cycles * ns_per_cycle;
+    if (out && exclusive_ns > 0) {
+      out << path << " " << exclusive_ns << "\n";
+    }
+  }
+
+  Transaction transaction;
+  if (!transaction.open()) {
+    return;
+  }
+  sqlite3_stmt *stmt = nullptr;
+  int error = sqlite3_prepare_v2(
+      db,
+      "INSERT INTO CallPaths(Path, Calls, InclusiveNanoseconds, "
+      "ExclusiveNanoseconds) VALUES (?, ?, ?, ?);",
+      -1, &stmt, nullptr);
+  if (error != SQLITE_OK) {
+    std::cerr << sqlite3_errmsg(db) << std::endl;
+    return;
+  }
+  for (const auto &[path, totals] : paths) {
+    sqlite3_bind_text(stmt, 1, path.c_str(), -1, SQLITE_STATIC);
+    sqlite3_bind_int64(stmt, 2, totals.calls);
+    sqlite3_bind_int64(stmt, 3, totals.inclusive_cycles * ns_per_cycle);
+    sqlite3_bind_int64(stmt, 4, totals.exclusive_cycles * ns_per_cycle);
+    if (sqlite3_step(stmt) != SQLITE_DONE) {
+      std::cerr << sqlite3_errmsg(db) << std::endl;
+    }
+    sqlite3_reset(stmt);
+  }
+  sqlite3_finalize(stmt);
+  transaction.commit();
+}
+#endif
+
+/**
+ * Write the Rss, Pss and clean and dirty shared and private memory of every
+ * object's mappings to Memory, in bytes.
+ *
+ * /proc/self/smaps is read once, line by line, and each mapping is
+ * attributed to the object whose segments contain it. Going by address
+ * rather than path also catches anonymous mappings such as .bss, and skips
+ * the copies of libraries in this library's own link map namespace.
+ */
+static void flush_memory() {
+  struct Usage {
+    uint64_t values[6] = {};
+  };
+  static const char *const kFields[6] = {"Rss:",          "Pss:",
+                                         "Shared_Clean:", "Shared_Dirty:",
+                                         "Private_Clean:", "Private_Dirty:"};
+  // The pages of each segment and the object owning them, by end address.
+  uintptr_t page_mask = ~(static_cast<uintptr_t>(sysconf(_SC_PAGESIZE)) - 1);
+  std::map<uintptr_t, std::pair<uintptr_t, const LibraryRecord *>> segments;
+  for (const LibraryRecord *record : library_records) {
+    for (const ElfW(Phdr) &phdr : record->segments) {
+      uintptr_t start = record->base + phdr.p_vaddr;
+      uintptr_t end = (start + phdr.p_memsz + ~page_mask) & page_mask;
+      segments[end] = {start & page_mask, record};
+    }
+  }
+  std::map<const LibraryRecord *, Usage> usage;
+
+  FILE *smaps = fopen("/proc/self/smaps", "r");
+  if (smaps == nullptr) {
+    std::cerr << "Could not read /proc/self/smaps" << std::endl;
+    return;
+  }
+  char line[4096];
+  Usage *current = nullptr;
+  // How much of the current mapping lies in the object.
+  double fraction = 0;
+  while (fgets(line, sizeof(line), smaps) != nullptr) {
+    unsigned long start, end;
+    char permissions[8];
+    if (sscanf(line, "%lx-%lx %7s", &start, &end, permissions) == 3) {
+      // The kernel merges .bss with adjacent anonymous mappings, so only
+      // the part of a mapping within the segment is counted.
+      auto segment = segments.upper_bound(start);
+      current = nullptr;
+      if (segment != segments.end() && segment->second.first < end) {
+        current = &usage[segment->second.second];
+        uintptr_t overlap = std::min<uintptr_t>(end, segment->first) -
+                            std::max<uintptr_t>(start, segment->second.first);
+        fraction = static_cast<double>(overlap) / (end - start);
+      }
+      continue;
+    }
+    if (current == nullptr) {
+      continue;
+    }
+    for (size_t i = 0; i < 6; ++i) {
+      size_t length = strlen(kFields[i]);
+      if (strncmp(line, kFields[i], length) == 0) {
+        current->values[i] +=
+            strtoull(line + length, nullptr, 10) * 1024 * fraction;
+        break;
+      }
+    }
+  }
+  fclose(smaps);
+
+  sqlite3_stmt *stmt = nullptr;
+  int error = sqlite3_prepare_v2(
+      db,
+      "INSERT INTO Memory(Library, Rss, Pss, SharedClean, SharedDirty, "
+      "PrivateClean, PrivateDirty) VALUES (?, ?, ?, ?, ?, ?, ?);",
+      -1, &stmt, nullptr);
+  if (error != SQLITE_OK) {
+    std::cerr << sqlite3_errmsg(db) << std::endl;
+    return;
+  }
+  for (const auto &[record, values] : usage) {
+    sqlite3_bind_text(stmt, 1, record->name.c_str(), -1, SQLITE_STATIC);
+    for (size_t i = 0; i < 6; ++i) {
+      sqlite3_bind_int64(stmt, i + 2, values.values[i]);
+    }
+    if (sqlite3_step(stmt) != SQLITE_DONE) {
+      std::cerr << sqlite3_errmsg(db) << std::endl;
+    }
+    sqlite3_reset(stmt);
+  }
+  sqlite3_finalize(stmt);
+}
+
+/**
+ * Write how much of every object is resident at exit to Pages, and how many
+ * of its resident text pages hold a function some object bound to.
+ *
+ * The segments are those la_objopen() found and residency comes from
+ * mincore(), which for file mappings reports the page cache: pages read
+ * ahead, or touched by another process, count as resident too. Only
+ * bindings made through la_symbind*() are known here, so these are the used
+ * functions.
+ */
+static void flush_pages() {
+  std::map<const LibraryRecord *, std::set<std::string>> used;
+  usage_buffers.for_each([&used](UsageBuffer &buffer) {
+    for (const UsageBuffer::Usage &usage : buffer.usages) {
+      used[usage.provider].insert(usage.symbol);
+    }
+  });
+
+  // Every mapped page of each object, whether it is resident and whether
+  // it is executable. Segments may share a page, so pages are merged.
+  std::map<const LibraryRecord *, std::map<uintptr_t, std::pair<bool, bool>>>
+      residency;
+  uintptr_t page_size = sysconf(_SC_PAGESIZE);
+  for (const LibraryRecord *record : library_records) {
+    for (const ElfW(Phdr) &phdr : record->segments) {
+      if (phdr.p_memsz == 0) {
+        continue;
+      }
+      uintptr_t start = (record->base + phdr.p_vaddr) & ~(page_size - 1);
+      uintptr_t end =
+          (record->base + phdr.p_vaddr + phdr.p_memsz + page_size - 1) &
+          ~(page_size - 1);
+      std::vector<unsigned char> resident((end - start) / page_size);
+      // Fails for objects that were unloaded.
+      if (mincore(reinterpret_cast<void *>(start), end - start,
+                  resident.data()) != 0) {
+        continue;
+      }
+      auto &pages = residency[record];
+      for (size_t page = 0; page < resident.size(); ++page) {
+        auto &state = pages[start + page * page_size];
+        state.first |= resident[page] & 1;
+        state.second |= (phdr.p_flags & PF_X) != 0;
+      }
+    }
+  }
+
+  Transaction transaction;
+  if (!transaction.open()) {
+    return;
+  }
+  sqlite3_stmt *stmt = nullptr;
+  int error = sqlite3_prepare_v2(
+      db,
+      "INSERT INTO Pages(Library, MappedBytes, ResidentBytes, TextBytes, "
+      "ResidentTextBytes, UsedSymbols, UsedSymbolBytes, UsedSymbolPages) "
+      "VALUES (?, ?, ?, ?, ?, ?, ?, ?);",
+      -1, &stmt, nullptr);
+  if (error != SQLITE_OK) {
+    std::cerr << sqlite3_errmsg(db) << std::endl;
+    return;
+  }
+  for (const auto &[record, pages] : residency) {
+    uint64_t resident = 0, text = 0, resident_text = 0;
+    for (const auto &[address, state] : pages) {
+      resident += state.first;
+      text += state.second;
+      resident_text += state.first && state.second;
+    }
+
+    // Versions of a symbol share its address, so functions are counted by
+    // address.
+    std::set<ElfW(Addr)> functions;
+    std::set<uintptr_t> function_pages;
+    uint64_t function_bytes = 0;
+    auto names = used.find(record);
+    for (size_t i = 0; names != used.end() && i < record->symbol_count; ++i) {
+      const ElfW(Sym) &sym = record->symbols[i];
+      unsigned char type = ELF64_ST_TYPE(sym.st_info);
+      if (sym.st_shndx == SHN_UNDEF ||
+          (type != STT_FUNC && type != STT_GNU_IFUNC) ||
+          !names->second.count(record->strings + sym.st_name)) {
+        continue;
+      }
+      ElfW(Addr) start = record->base + sym.st_value;
+      if (!functions.insert(start).second) {
+        continue;
+      }
+      function_bytes += sym.st_size;
+      ElfW(Addr) last = start + std::max<ElfW(Xword)>(sym.st_size, 1) - 1;
+      for (uintptr_t page = start & ~(page_size - 1); page <= last;
+           page += page_size) {
+        function_pages.insert(page);
+      }
+    }
+
+    sqlite3_bind_text(stmt, 1, record->name.c_str(), -1, SQLITE_STATIC);
+    sqlite3_bind_int64(stmt, 2, pages.size() * page_size);
+    sqlite3_bind_int64(stmt, 3, resident * page_size);
+    sqlite3_bind_int64(stmt, 4, text * page_size);
+    sqlite3_bind_int64(stmt, 5, resident_text * page_size);
+    sqlite3_bind_int64(stmt, 6, functions.size());
+    sqlite3_bind_int64(stmt, 7, function_bytes);
+    sqlite3_bind_int64(stmt, 8, function_pages.size());
+    if (sqlite3_step(stmt) != SQLITE_DONE) {
+      std::cerr << sqlite3_errmsg(db) << std::endl;
+    }
+    sqlite3_reset(stmt);
+  }
+  sqlite3_finalize(stmt);
+  transaction.commit();
+}
+
+/**
+ * Drain every thread's buffered bindings, and the references made by
+ * relocations, into the Usages table, then index the symbol tables.
+ *
+ * Runs once at exit, so a prepared statement inside a single transaction is
+ * used rather than a statement per binding. The indexes are only created
+ * once every row is in, which is cheaper than keeping them up to date.
+ */
+static void flush_usages() {
+  Transaction transaction;
+  if (!transaction.open()) {
+    return;
   }
-  auto ref_library = ref_library_it->second;
-  std::string demangled_sym_name = demangle(symname);
 
-  std::ostringstream s;
-  s << "INSERT INTO Usages(Library, Symbol) VALUES ('" << ref_library << "','"
-    << demangled_sym_name << "'"
-    << ");";
-  std::string sql = s.str();
+  sqlite3_stmt *stmt = nullptr;
+  int error = sqlite3_prepare_v2(
+      db, "INSERT INTO Usages(Library, Symbol) VALUES (?, ?);", -1, &stmt,
+      nullptr);
+  if (error != SQLITE_OK) {
+    std::cerr << sqlite3_errmsg(db) << std::endl;
+    return;
+  }
+
+  // Threads racing through the same PLT slot bind the same symbol; it is
+  // written once. By library id << 32 | symbol id.
+  std::unordered_set<uint64_t> written;
+  auto add_usage = [stmt, &written](int64_t library, int64_t symbol) {
+    if (!written.insert(static_cast<uint64_t>(library) << 32 | symbol)
+             .second) {
+      return;
+    }
+    sqlite3_bind_int64(stmt, 1, library);
+    sqlite3_bind_int64(stmt, 2, symbol);
+    step(stmt);
+  };
+  SymbolWriter writer;
+  usage_buffers.for_each([&add_usage, &writer](UsageBuffer &buffer) {
+    for (const UsageBuffer::Usage &usage : buffer.usages) {
+      // The vdso is not recorded, and only libc binds to it anyway.
+      if (usage.library->id == 0 || usage.provider->id == 0) {
+        continue;
+      }
+      add_usage(usage.library->id, writer.symbol_id(usage.provider->id,
+                                                    demangle(usage.symbol), 0));
+    }
+    buffer.usages.clear();
+  });
+
+  // Symbols were numbered in load order, which for the initial objects is
+  // also the order the dynamic linker searches them in. Cataloged objects
+  // only have the symbols bound to here; the rest are in the catalog.
   char *err_msg = nullptr;
-  int error = sqlite3_exec(db, sql.c_str(), 0, 0, &err_msg);
+  error = sqlite3_exec(db,
+                       "CREATE INDEX IF NOT EXISTS SymbolsByName ON "
+                       "Symbols(Name);"
+                       "CREATE TEMP TABLE DataReferences(Library INTEGER, "
+                       "Name TEXT, NameId INTEGER, Copy INTEGER);",
+                       0, 0, &err_msg);
   if (error != SQLITE_OK) {
     std::cerr << err_msg << std::endl;
     sqlite3_free(err_msg);
-    sqlite3_close(db);
-    exit(1);
+    sqlite3_finalize(stmt);
+    return;
+  }
+  sqlite3_stmt *reference_stmt = nullptr;
+  prepare(
+      "INSERT INTO temp.DataReferences(Library, Name, NameId, Copy) "
+      "VALUES (?, ?, ?, ?);",
+      &reference_stmt);
+  for (const DataReference &reference : data_references) {
+    std::string name = demangle(reference.symbol);
+    // Unless cataloged, a name no object defines has no provider.
+    int64_t name_id = SymbolWriter::find_string(name);
+    if (name_id == 0 && options.catalog.empty()) {
+      continue;
+    }
+    sqlite3_bind_int64(reference_stmt, 1, reference.library->id);
+    sqlite3_bind_text(reference_stmt, 2, name.c_str(), -1, SQLITE_STATIC);
+    sqlite3_bind_int64(reference_stmt, 3, name_id);
+    sqlite3_bind_int(reference_stmt, 4, reference.copy);
+    step(reference_stmt);
   }
+  sqlite3_finalize(reference_stmt);
 
-  return sym->st_value;
-}
+  // The first object in load order defining each name, among the recorded
+  // symbols and, if cataloged, among the catalog's.
+  std::string query =
+      "SELECT r.Library, r.Name, "
+      "(SELECT s.Library FROM Symbols s WHERE s.Name = r.NameId "
+      "AND (r.Copy = 0 OR s.Library != r.Library) ORDER BY s.Id LIMIT 1), ";
+  query += options.catalog.empty()
+               ? "NULL "
+               : "(SELECT l.Id FROM catalog.Symbols c "
+                 "JOIN catalog.Builds b ON b.Id = c.Build "
+                 "JOIN Libraries l ON l.BuildId = b.BuildId "
+                 "WHERE c.Name = r.Name "
+                 "AND (r.Copy = 0 OR l.Id != r.Library) "
+                 "ORDER BY l.Id LIMIT 1) ";
+  query += "FROM temp.DataReferences r;";
+  prepare(query.c_str(), &reference_stmt);
+  while (sqlite3_step(reference_stmt) == SQLITE_ROW) {
+    int64_t recorded = sqlite3_column_int64(reference_stmt, 2);
+    int64_t cataloged = sqlite3_column_int64(reference_stmt, 3);
+    bool use_catalog =
+        recorded == 0 || (cataloged != 0 && cataloged < recorded);
+    int64_t provider = use_catalog ? cataloged : recorded;
+    // An object that only refers to its own export through its GOT or data
+    // does not need it exported: once hidden, the relocation is relative.
+    int64_t library = sqlite3_column_int64(reference_stmt, 0);
+    if (provider != 0 && provider != library) {
+      add_usage(library,
+                writer.symbol_id(provider,
+                                 reinterpret_cast<const char *>(
+                                     sqlite3_column_text(reference_stmt, 1)),
+                                 0));
+    }
+  }
+  sqlite3_finalize(reference_stmt);
+  sqlite3_finalize(stmt);
 
-uintptr_t la_symbind64(Elf64_Sym *sym, unsigned int ndx, uintptr_t *refcook,
-                       uintptr_t *defcook, unsigned int *flags,
-                       const char *symname) {
-  auto ref_library_it = cookie_map.find(*refcook);
-  if (ref_library_it == cookie_map.end()) {
-    std::cerr << "Could not find a cookie. Assertion failed." << std::endl;
-    exit(1);
+  // Symbols of cataloged objects were added as they were bound to, without
+  // their size.
+  if (!options.catalog.empty()) {
+    error = sqlite3_exec(
+        db,
+        R""""(
+        UPDATE Symbols SET Size = COALESCE(
+          (SELECT MAX(c.Size) FROM Libraries l
+           JOIN catalog.Builds b ON b.BuildId = l.BuildId
+           JOIN catalog.Symbols c ON c.Build = b.Id
+           WHERE l.Id = Symbols.Library
+             AND c.Name = (SELECT Value FROM Strings
+                           WHERE Strings.Id = Symbols.Name)),
+          Size)
+        WHERE Library IN (SELECT Id FROM Libraries WHERE BuildId IS NOT NULL);
+        )"""",
+        0, 0, &err_msg);
+    if (error != SQLITE_OK) {
+      std::cerr << err_msg << std::endl;
+      sqlite3_free(err_msg);
+    }
   }
-  auto ref_library = ref_library_it->second;
-  std::string demangled_sym_name = demangle(symname);
 
-  std::ostringstream s;
-  s << "INSERT INTO Usages(Library, Symbol) VALUES ('" << ref_library << "','"
-    << demangled_sym_name << "'"
-    << ");";
-  std::string sql = s.str();
-  char *err_msg = nullptr;
-  int error = sqlite3_exec(db, sql.c_str(), 0, 0, &err_msg);
+  error = sqlite3_exec(
+      db,
+      R""""(
+      DROP TABLE temp.DataReferences;
+      CREATE INDEX IF NOT EXISTS LibrariesByName ON Libraries(Name);
+      CREATE INDEX IF NOT EXISTS SymbolsByLibrary ON Symbols(Library);
+      CREATE INDEX IF NOT EXISTS UsagesByLibrary ON Usages(Library);
+      CREATE INDEX IF NOT EXISTS UsagesBySymbol ON Usages(Symbol);
+      )"""",
+      0, 0, &err_msg);
   if (error != SQLITE_OK) {
     std::cerr << err_msg << std::endl;
     sqlite3_free(err_msg);
-    sqlite3_close(db);
-    exit(1);
   }
 
-  return sym->st_value;
-}
\ No newline at end of file
+  transaction.commit();
+}
+
+/**
+ * Write the first binding of every (library, symbol) to BindOrder and, if
+ * requested, a symbol ordering file per library.
+ *
+ * Bindings from every thread are merged by sequence number. Later bindings
+ * of the same symbol (from other referencing objects, or threads racing
+ * through the same PLT slot) are dropped.
+ */
+static void flush_bind_order() {
+  std::vector<BindEvent> events;
+  bind_order_buffers.for_each([&events](BindOrderBuffer &buffer) {
+    std::move(buffer.events.begin(), buffer.events.end(),
+              std::back_inserter(events));
+    buffer.events.clear();
+  });
+  std::sort(events.begin(), events.end(),
+            [](const BindEvent &a, const BindEvent &b) {
+              return a.sequence < b.sequence;
+            });
+
+  std::set<std::pair<const LibraryRecord *, std::string>> seen;
+  std::map<const LibraryRecord *, std::vector<const BindEvent *>> by_library;
+  for (const BindEvent &event : events) {
+    if (seen.insert({event.definer, event.symbol}).second) {
+      by_library[event.definer].push_back(&event);
+    }
+  }
+
+  Transaction transaction;
+  if (!transaction.open()) {
+    return;
+  }
+  sqlite3_stmt *stmt = nullptr;
+  int error = sqlite3_prepare_v2(
+      db,
+      "INSERT INTO BindOrder(Sequence, Nanoseconds, Library, Symbol, "
+      "MangledSymbol) VALUES (?, ?, ?, ?, ?);",
+      -1, &stmt, nullptr);
+  if (error != SQLITE_OK) {
+    std::cerr << sqlite3_errmsg(db) << std::endl;
+    return;
+  }
+  for (const auto &[library, library_events] : by_library) {
+    for (const BindEvent *event : library_events) {
+      std::string demangled_sym_name = demangle(event->symbol);
+      sqlite3_bind_int64(stmt, 1, event->sequence);
+      sqlite3_bind_int64(stmt, 2, event->nanoseconds);
+      sqlite3_bind_text(stmt, 3, library->name.c_str(), -1, SQLITE_STATIC);
+      sqlite3_bind_text(stmt, 4, demangled_sym_name.c_str(), -1,
+                        SQLITE_TRANSIENT);
+      sqlite3_bind_text(stmt, 5, event->symbol.c_str(), -1, SQLITE_STATIC);
+      if (sqlite3_step(stmt) != SQLITE_DONE) {
+        std::cerr << sqlite3_errmsg(db) << std::endl;
+      }
+      sqlite3_reset(stmt);
+    }
+  }
+  sqlite3_finalize(stmt);
+  transaction.commit();
+
+  if (options.order_dir.empty()) {
+    return;
+  }
+  // One mangled name per line, hottest first, as expected by lld's
+  // --symbol-ordering-file.
+  for (const auto &[library, library_events] : by_library) {
+    std::filesystem::path path =
+        std::filesystem::path(options.order_dir) / (library->name + ".order");
+    std::ofstream out(path);
+    if (!out) {
+      std::cerr << "Could not write " << path << std::endl;
+      continue;
+    }
+    for (const BindEvent *event : library_events) {
+      out << event->symbol << "\n";
+    }
+  }
+}
+
+/**
+ * The ratio observed between the steady clock and the cycle counter over the
+ * lifetime of the process.
+ */
+static double nanoseconds_per_cycle() {
+  double elapsed_ns = std::chrono::duration<double, std::nano>(
+                          std::chrono::steady_clock::now() - start_time)
+                          .count();
+  uint64_t elapsed_cycles = read_cycles() - start_cycles;
+  return elapsed_cycles == 0 ? 0 : elapsed_ns / elapsed_cycles;
+}
+
+/**
+ * Merge every thread's callback latencies and write them to AuditOverhead.
+ */
+static void flush_overhead() {
+  OverheadStats totals;
+  overhead_stats.for_each([&totals](OverheadStats &stats) {
+    for (size_t i = 0; i < kCallbackCount; ++i) {
+      totals.callbacks[i].merge(stats.callbacks[i]);
+    }
+  });
+  double ns_per_cycle = nanoseconds_per_cycle();
+
+  sqlite3_stmt *stmt = nullptr;
+  int error = sqlite3_prepare_v2(
+      db,
+      "INSERT INTO AuditOverhead(Callback, Calls, TotalCycles, MaxCycles, "
+      "P50Cycles, P90Cycles, P99Cycles, TotalNanoseconds) "
+      "VALUES (?, ?, ?, ?, ?, ?, ?, ?);",
+      -1, &stmt, nullptr);
+  if (error != SQLITE_OK) {
+    std::cerr << sqlite3_errmsg(db) << std::endl;
+    return;
+  }
+  for (size_t i = 0; i < kCallbackCount; ++i) {
+    const CallbackStats &stats = totals.callbacks[i];
+    if (stats.calls == 0) {
+      continue;
+    }
+    sqlite3_bind_text(stmt, 1, callback_names[i], -1, SQLITE_STATIC);
+    sqlite3_bind_int64(stmt, 2, stats.calls);
+    sqlite3_bind_int64(stmt, 3, stats.total_cycles);
+    sqlite3_bind_int64(stmt, 4, stats.max_cycles);
+    sqlite3_bind_int64(stmt, 5, stats.percentile(0.50));
+    sqlite3_bind_int64(stmt, 6, stats.percentile(0.90));
+    sqlite3_bind_int64(stmt, 7, stats.percentile(0.99));
+    sqlite3_bind_int64(stmt, 8, stats.total_cycles * ns_per_cycle);
+    if (sqlite3_step(stmt) != SQLITE_DONE) {
+      std::cerr << sqlite3_errmsg(db) << std::endl;
+    }
+    sqlite3_reset(stmt);
+  }
+  sqlite3_finalize(stmt);
+}
+
+/**
+ * Copy the in-memory recording to options.database in one pass. The file is
+ * replaced as a whole, so tables of earlier recordings into it are gone.
+ * Nothing is written if the process never reaches its destructors.
+ */
+static void backup_database() {
+  sqlite3 *file;
+  int error = sqlite3_open(options.database.c_str(), &file);
+  sqlite3_backup *backup =
+      error == SQLITE_OK ? sqlite3_backup_init(file, "main", db, "main")
+                         : nullptr;
+  if (backup != nullptr) {
+    sqlite3_backup_step(backup, -1);
+    error = sqlite3_backup_finish(backup);
+  } else if (error == SQLITE_OK) {
+    error = sqlite3_errcode(file);
+  }
+  if (error != SQLITE_OK) {
+    std::cerr << options.database << ": " << sqlite3_errstr(error)
+              << std::endl;
+  }
+  sqlite3_close(file);
+}
+
+/**
+ * Send size bytes to the collector's socket, waiting no later than deadline
+ * for it to make room.
+ */
+static bool send_all(int fd, const char *data, size_t size,
+                     std::chrono::steady_clock::time_point deadline) {
+  while (size > 0) {
+    ssize_t sent = send(fd, data, size, MSG_DONTWAIT | MSG_NOSIGNAL);
+    if (sent > 0) {
+      data += sent;
+      size -= sent;
+      continue;
+    }
+    if (sent < 0 && errno != EAGAIN && errno != EWOULDBLOCK &&
+        errno != EINTR) {
+      return false;
+    }
+    auto left = std::chrono::duration_cast<std::chrono::milliseconds>(
+        deadline - std::chrono::steady_clock::now());
+    pollfd writable = {fd, POLLOUT, 0};
+    if (left.count() <= 0 || poll(&writable, 1, left.count()) <= 0) {
+      return false;
+    }
+  }
+  return true;
+}
+
+/**
+ * Stream the recording's libraries, symbols and usages to the collector at
+ * options.collector, in frames of kCollectorFrameSize (see collector.h).
+ * Returns false if there is no collector, it did not take the whole
+ * recording within kCollectorTimeout, or the recording is longer than
+ * kCollectorMaxStream, in which case the collector drops what it got and
+ * the recording should be written to a file.
+ *
+ * Once the empty frame is in the socket the stream is delivered: the
+ * collector reads it even after this process has exited, so nothing is
+ * waited for after that and the recording is never both sent and written.
+ */
+static bool send_to_collector() {
+  sockaddr_un address = {};
+  address.sun_family = AF_UNIX;
+  if (options.collector.size() >= sizeof(address.sun_path)) {
+    std::cerr << options.collector << ": socket path too long" << std::endl;
+    return false;
+  }
+  memcpy(address.sun_path, options.collector.c_str(),
+         options.collector.size());
+  // Connecting to a Unix socket never waits, even if the backlog is full.
+  int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (fd < 0 || connect(fd, reinterpret_cast<const sockaddr *>(&address),
+                        sizeof(address)) != 0) {
+    if (fd >= 0) {
+      close(fd);
+    }
+    return false;
+  }
+
+  auto deadline = std::chrono::steady_clock::now() + kCollectorTimeout;
+  std::string frame(kCollectorMagic, sizeof(kCollectorMagic));
+  size_t frame_start = frame.size();
+  collector_put(&frame, uint32_t{0});
+  bool sent = true;
+  size_t streamed = 0;
+  // Send the frame once it is full, or at the end, and start the next.
+  auto flush = [&](bool end) {
+    size_t size = frame.size() - frame_start - sizeof(uint32_t);
+    if (!sent || (!end && size < kCollectorFrameSize)) {
+      return;
+    }
+    uint32_t frame_size = size;
+    memcpy(&frame[frame_start], &frame_size, sizeof(frame_size));
+    if (end && size > 0) {
+      collector_put(&frame, uint32_t{0});
+    }
+    streamed += frame.size();
+    sent = streamed <= kCollectorMaxStream &&
+           send_all(fd, frame.data(), frame.size(), deadline);
+    frame.clear();
+    frame_start = 0;
+    collector_put(&frame, uint32_t{0});
+  };
+  auto id = [](sqlite3_stmt *stmt, int column) {
+    return static_cast<uint32_t>(sqlite3_column_int64(stmt, column));
+  };
+  auto text = [](sqlite3_stmt *stmt, int column) {
+    const unsigned char *value = sqlite3_column_text(stmt, column);
+    return value == nullptr ? std::string_view()
+                            : reinterpret_cast<const char *>(value);
+  };
+
+  sqlite3_stmt *stmt = nullptr;
+  prepare("SELECT Id, Name, Path FROM Libraries;", &stmt);
+  while (sent && sqlite3_step(stmt) == SQLITE_ROW) {
+    frame.push_back(kCollectorLibrary);
+    collector_put(&frame, id(stmt, 0));
+    collector_put(&frame, text(stmt, 1));
+    collector_put(&frame, text(stmt, 2));
+    flush(false);
+  }
+  sqlite3_finalize(stmt);
+  prepare("SELECT Id, Value FROM Strings;", &stmt);
+  while (sent && sqlite3_step(stmt) == SQLITE_ROW) {
+    frame.push_back(kCollectorString);
+    collector_put(&frame, id(stmt, 0));
+    collector_put(&frame, text(stmt, 1));
+    flush(false);
+  }
+  sqlite3_finalize(stmt);
+  prepare("SELECT Id, Library, Name, Size FROM Symbols;", &stmt);
+  while (sent && sqlite3_step(stmt) == SQLITE_ROW) {
+    frame.push_back(kCollectorSymbol);
+    collector_put(&frame, id(stmt, 0));
+    collector_put(&frame, id(stmt, 1));
+    collector_put(&frame, id(stmt, 2));
+    collector_put(&frame,
+                  static_cast<uint64_t>(sqlite3_column_int64(stmt, 3)));
+    flush(false);
+  }
+  sqlite3_finalize(stmt);
+  prepare("SELECT Library, Symbol FROM Usages;", &stmt);
+  while (sent && sqlite3_step(stmt) == SQLITE_ROW) {
+    frame.push_back(kCollectorUsage);
+    collector_put(&frame, id(stmt, 0));
+    collector_put(&frame, id(stmt, 1));
+    flush(false);
+  }
+  sqlite3_finalize(stmt);
+  flush(true);
+  close(fd);
+  return sent;
+}
+
+/**
+ * Mark the live counters as final and remove their name. Readers that have
+ * the segment mapped can still show the totals.
+ */
+static void close_live_counters() {
+  if (live_counters == nullptr) {
+    return;
+  }
+  detach_live_counters();
+  live_counters->exited.store(1, std::memory_order_release);
+  if (!options.live.empty()) {
+    shm_unlink(options.live.c_str());
+  }
+}
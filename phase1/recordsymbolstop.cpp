@@ -0,0 +1,202 @@
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "livecounters.h"
+
+/**
+ * Show the counters a running recorder publishes with RECORDSYMBOLS_LIVE.
+ *
+ *   recordsymbols-top name [-i milliseconds] [-n count] [-l lines]
+ *
+ * Every interval (1000ms by default) prints the process's totals and its
+ * busiest libraries: the symbols each defines, the bindings it provided and
+ * made, the calls made into it through a PLT slot, and the time the
+ * recorder spent on its behalf, with the rates since the last refresh.
+ * Stops after count refreshes, or once the process has exited.
+ *
+ * The segment is only ever read, so refreshing as often as every
+ * millisecond costs the audited process nothing beyond the cache lines the
+ * reads share with it.
+ */
+
+static void usage() {
+  std::cerr << "Usage: recordsymbols-top name [-i milliseconds] [-n count] "
+               "[-l lines]"
+            << std::endl;
+  exit(1);
+}
+
+/** Map the segment read-only, or exit. The mapping is never undone. */
+static const LiveHeader *map_counters(std::string name) {
+  if (name[0] != '/') {
+    name.insert(0, "/");
+  }
+  int fd = shm_open(name.c_str(), O_RDONLY, 0);
+  struct stat st;
+  if (fd < 0 || fstat(fd, &st) != 0) {
+    std::cerr << "Could not open shared memory " << name << std::endl;
+    exit(1);
+  }
+  void *data = static_cast<size_t>(st.st_size) < sizeof(LiveHeader)
+                   ? MAP_FAILED
+                   : mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  const LiveHeader *header = static_cast<const LiveHeader *>(data);
+  if (data == MAP_FAILED ||
+      memcmp(header->magic, kLiveMagic, sizeof(kLiveMagic)) != 0 ||
+      live_counters_size(header->capacity) !=
+          static_cast<size_t>(st.st_size)) {
+    std::cerr << name << " is not a recorder's live counters" << std::endl;
+    exit(1);
+  }
+  return header;
+}
+
+/** The steady clock in nanoseconds, as published by the recorder. */
+static uint64_t now_nanoseconds() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+int main(int argc, char **argv) {
+  std::string name;
+  int64_t interval = 1000;
+  int64_t count = -1;
+  size_t lines = 20;
+  for (int i = 1; i < argc; ++i) {
+    if (strcmp(argv[i], "-i") == 0 && i + 1 < argc) {
+      interval = strtoll(argv[++i], nullptr, 10);
+    } else if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+      count = strtoll(argv[++i], nullptr, 10);
+    } else if (strcmp(argv[i], "-l") == 0 && i + 1 < argc) {
+      lines = strtoull(argv[++i], nullptr, 10);
+    } else if (argv[i][0] == '-' || !name.empty()) {
+      usage();
+    } else {
+      name = argv[i];
+    }
+  }
+  if (name.empty() || interval <= 0) {
+    usage();
+  }
+
+  const LiveHeader *header = map_counters(name);
+  const LiveLibrary *slots = live_libraries(header);
+  bool terminal = isatty(STDOUT_FILENO);
+  // The previous refresh's counters by slot, for rates.
+  std::unordered_map<uint32_t, LiveLibrarySnapshot> previous;
+  uint64_t previous_nanoseconds = now_nanoseconds();
+  for (int64_t refresh = 0; count < 0 || refresh < count; ++refresh) {
+    if (refresh > 0) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(interval));
+    }
+    bool exited = header->exited.load(std::memory_order_acquire) != 0;
+    uint32_t libraries =
+        std::min(header->libraries.load(std::memory_order_acquire),
+                 header->capacity);
+    std::vector<std::pair<uint32_t, LiveLibrarySnapshot>> snapshots;
+    uint32_t opening = 0;
+    for (uint32_t i = 0; i < libraries; ++i) {
+      LiveLibrarySnapshot snapshot;
+      if (read_live_library(slots[i], &snapshot)) {
+        snapshots.emplace_back(i, std::move(snapshot));
+      } else {
+        ++opening;
+      }
+    }
+    uint64_t callback_cycles =
+        header->callback_cycles.load(std::memory_order_relaxed);
+
+    // Both clocks have run since the recorder started, which calibrates
+    // one against the other more closely the longer it runs.
+    uint64_t nanoseconds = now_nanoseconds();
+    uint64_t elapsed_cycles = read_cycles() - header->start_cycles;
+    double uptime = (nanoseconds - header->start_nanoseconds) / 1e9;
+    double ns_per_cycle =
+        elapsed_cycles == 0 ? 0 : uptime * 1e9 / elapsed_cycles;
+    double seconds = (nanoseconds - previous_nanoseconds) / 1e9;
+    previous_nanoseconds = nanoseconds;
+
+    struct Row {
+      const LiveLibrarySnapshot *snapshot;
+      uint64_t new_bindings;
+      uint64_t new_plt_calls;
+    };
+    std::vector<Row> rows;
+    uint64_t bindings = 0;
+    uint64_t plt_calls = 0;
+    for (const auto &[slot, snapshot] : snapshots) {
+      const LiveLibrarySnapshot &last = previous[slot];
+      rows.push_back({&snapshot, snapshot.bindings - last.bindings,
+                      snapshot.plt_calls - last.plt_calls});
+      bindings += snapshot.bindings;
+      plt_calls += snapshot.plt_calls;
+    }
+    // The busiest right now first, then the busiest overall.
+    std::sort(rows.begin(), rows.end(), [](const Row &a, const Row &b) {
+      uint64_t a_recent = a.new_bindings + a.new_plt_calls;
+      uint64_t b_recent = b.new_bindings + b.new_plt_calls;
+      if (a_recent != b_recent) {
+        return a_recent > b_recent;
+      }
+      return a.snapshot->bindings + a.snapshot->plt_calls >
+             b.snapshot->bindings + b.snapshot->plt_calls;
+    });
+
+    if (terminal) {
+      printf("\033[H\033[2J");
+    } else if (refresh > 0) {
+      printf("\n");
+    }
+    printf("pid %d%s  up %.1fs  %zu libraries", header->pid,
+           exited ? " (exited)" : "", uptime, snapshots.size());
+    if (opening > 0) {
+      printf(" (%u opening)", opening);
+    }
+    if (header->dropped.load(std::memory_order_relaxed) > 0) {
+      printf(" (%u not counted)",
+             header->dropped.load(std::memory_order_relaxed));
+    }
+    printf("\n%llu bindings  %llu PLT calls  %.3fms in callbacks\n\n",
+           static_cast<unsigned long long>(bindings),
+           static_cast<unsigned long long>(plt_calls),
+           callback_cycles * ns_per_cycle / 1e6);
+    printf("%-32s %9s %10s %9s %10s %12s %10s %12s\n", "library", "symbols",
+           "bindings", "/s", "imports", "plt calls", "/s", "callback ms");
+    for (size_t i = 0; i < rows.size() && i < lines; ++i) {
+      const LiveLibrarySnapshot &snapshot = *rows[i].snapshot;
+      printf("%-32.32s %9llu %10llu %9.0f %10llu %12llu %10.0f %12.3f\n",
+             snapshot.name.c_str(),
+             static_cast<unsigned long long>(snapshot.symbols),
+             static_cast<unsigned long long>(snapshot.bindings),
+             refresh == 0 ? 0 : rows[i].new_bindings / seconds,
+             static_cast<unsigned long long>(snapshot.imports),
+             static_cast<unsigned long long>(snapshot.plt_calls),
+             refresh == 0 ? 0 : rows[i].new_plt_calls / seconds,
+             snapshot.callback_cycles * ns_per_cycle / 1e6);
+    }
+    fflush(stdout);
+
+    previous.clear();
+    for (auto &[slot, snapshot] : snapshots) {
+      previous[slot] = std::move(snapshot);
+    }
+    if (exited) {
+      break;
+    }
+  }
+  return 0;
+}
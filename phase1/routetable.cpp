@@ -0,0 +1,129 @@
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "routetable.h"
+
+/**
+ * Compile a list of symbol routes into the table recordsymbolslib.so maps
+ * with RECORDSYMBOLS_ROUTES.
+ *
+ * Each line of the input is
+ *
+ *   from-library symbol target-library [target-symbol]
+ *
+ * with mangled symbol names, and routes bindings of symbol that from-library
+ * would provide to target-symbol (by default the same name) in
+ * target-library. Blank lines and lines starting with # are ignored.
+ */
+
+static void usage() {
+  std::cerr << "Usage: routetable [-o routes.bin] routes.txt" << std::endl;
+  exit(1);
+}
+
+struct Route {
+  std::string from_library;
+  std::string symbol;
+  std::string target_library;
+  std::string target_symbol;
+};
+
+int main(int argc, char **argv) {
+  std::string output = "routes.bin";
+  std::string input;
+  for (int i = 1; i < argc; ++i) {
+    if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+      output = argv[++i];
+    } else if (argv[i][0] == '-' || !input.empty()) {
+      usage();
+    } else {
+      input = argv[i];
+    }
+  }
+  if (input.empty()) {
+    usage();
+  }
+
+  std::ifstream file(input);
+  if (!file) {
+    std::cerr << "Could not read " << input << std::endl;
+    return 1;
+  }
+  std::vector<Route> routes;
+  std::string line;
+  for (size_t number = 1; std::getline(file, line); ++number) {
+    std::istringstream fields(line);
+    Route route;
+    std::string extra;
+    if (!(fields >> route.from_library) || route.from_library[0] == '#') {
+      continue;
+    }
+    if (!(fields >> route.symbol >> route.target_library)) {
+      std::cerr << input << ":" << number
+                << ": expected \"from-library symbol target-library "
+                   "[target-symbol]\""
+                << std::endl;
+      return 1;
+    }
+    if (!(fields >> route.target_symbol)) {
+      route.target_symbol = route.symbol;
+    } else if (fields >> extra) {
+      std::cerr << input << ":" << number << ": unexpected " << extra
+                << std::endl;
+      return 1;
+    }
+    routes.push_back(std::move(route));
+  }
+
+  std::vector<std::string> keys;
+  for (const Route &route : routes) {
+    keys.push_back(route_key(route.from_library, route.symbol));
+  }
+  PerfectHash hash;
+  if (!hash.build(std::vector<std::string_view>(keys.begin(), keys.end()))) {
+    std::cerr << input << ": a symbol is routed more than once" << std::endl;
+    return 1;
+  }
+
+  // Library names repeat a lot, so every string is stored once.
+  std::string strings;
+  std::unordered_map<std::string, uint32_t> offsets;
+  auto intern = [&](const std::string &value) {
+    auto [it, inserted] = offsets.try_emplace(value, strings.size());
+    if (inserted) {
+      strings.append(value);
+      strings.push_back('\0');
+    }
+    return it->second;
+  };
+  std::vector<RouteEntry> entries;
+  for (uint32_t slot = 0; slot < hash.size(); ++slot) {
+    const Route &route = routes[hash.slots()[slot]];
+    entries.push_back({intern(route.from_library), intern(route.symbol),
+                       intern(route.target_library),
+                       intern(route.target_symbol)});
+  }
+
+  RouteTableHeader header;
+  memcpy(header.magic, kRouteTableMagic, sizeof(header.magic));
+  header.buckets = routes.empty() ? 0 : hash.seeds().size();
+  header.size = routes.size();
+  std::ofstream out(output, std::ios::binary);
+  out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+  out.write(reinterpret_cast<const char *>(hash.seeds().data()),
+            header.buckets * sizeof(uint32_t));
+  out.write(reinterpret_cast<const char *>(entries.data()),
+            entries.size() * sizeof(RouteEntry));
+  out.write(strings.data(), strings.size());
+  if (!out.flush()) {
+    std::cerr << "Could not write " << output << std::endl;
+    return 1;
+  }
+  std::cout << output << ": " << routes.size() << " routes" << std::endl;
+  return 0;
+}
@@ -0,0 +1,126 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+
+#include "perfecthash.h"
+
+/**
+ * The file format of a compiled symbol routing table.
+ *
+ * A route sends bindings of symbol, as provided by from_library, to
+ * target_symbol in target_library instead. routetable compiles a text list
+ * of routes into this format and the audit library maps it as is, so a
+ * lookup is a perfect hash (see PerfectHash) straight over the mapping:
+ *
+ *   RouteTableHeader
+ *   uint32_t seeds[buckets]
+ *   RouteEntry entries[size], in slot order
+ *   NUL-terminated strings, referred to by offset from their start
+ *
+ * Entries are keyed by route_key(from_library, symbol).
+ */
+struct RouteTableHeader {
+  char magic[8];
+  uint32_t buckets;
+  uint32_t size;
+};
+
+struct RouteEntry {
+  uint32_t from_library;
+  uint32_t symbol;
+  uint32_t target_library;
+  uint32_t target_symbol;
+};
+
+static constexpr char kRouteTableMagic[8] = {'R', 'S', 'R', 'O',
+                                             'U', 'T', 'E', '1'};
+
+/** The perfect hash key of a route; library names cannot contain a NUL. */
+inline std::string route_key(std::string_view library,
+                             std::string_view symbol) {
+  std::string key;
+  key.reserve(library.size() + symbol.size() + 1);
+  key.append(library);
+  key.push_back('\0');
+  key.append(symbol);
+  return key;
+}
+
+/**
+ * A read-only view of a compiled table, e.g. one that was mmap'd.
+ */
+class RouteTable {
+ public:
+  RouteTable() = default;
+
+  /**
+   * View the table in data. Returns false if it is not a complete route
+   * table, so a truncated or stale file is never half used.
+   */
+  bool open(const void *data, size_t size) {
+    if (size < sizeof(RouteTableHeader)) {
+      return false;
+    }
+    header_ = static_cast<const RouteTableHeader *>(data);
+    if (memcmp(header_->magic, kRouteTableMagic, sizeof(kRouteTableMagic)) !=
+            0 ||
+        (header_->size != 0 && header_->buckets == 0)) {
+      return false;
+    }
+    size_t strings = sizeof(RouteTableHeader) +
+                     header_->buckets * sizeof(uint32_t) +
+                     header_->size * sizeof(RouteEntry);
+    // Every string must end before the mapping does.
+    const char *end = static_cast<const char *>(data) + size;
+    if (strings > size || (size > strings && end[-1] != '\0')) {
+      return false;
+    }
+    seeds_ = reinterpret_cast<const uint32_t *>(header_ + 1);
+    entries_ = reinterpret_cast<const RouteEntry *>(seeds_ + header_->buckets);
+    strings_ = reinterpret_cast<const char *>(entries_ + header_->size);
+    strings_size_ = size - strings;
+    for (uint32_t i = 0; i < header_->size; ++i) {
+      const RouteEntry &entry = entries_[i];
+      if (entry.from_library >= strings_size_ ||
+          entry.symbol >= strings_size_ ||
+          entry.target_library >= strings_size_ ||
+          entry.target_symbol >= strings_size_) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  uint32_t size() const { return header_ == nullptr ? 0 : header_->size; }
+
+  const RouteEntry &entry(uint32_t index) const { return entries_[index]; }
+
+  const char *string(uint32_t offset) const { return strings_ + offset; }
+
+  /** The index of the route for symbol from library, or -1. */
+  int64_t find(std::string_view library, std::string_view symbol) const {
+    if (size() == 0) {
+      return -1;
+    }
+    // The pieces of route_key(library, symbol), which would allocate.
+    uint32_t slot =
+        PerfectHash::slot({library, std::string_view("\0", 1), symbol},
+                          seeds_, header_->buckets, header_->size);
+    const RouteEntry &entry = entries_[slot];
+    if (library != string(entry.from_library) ||
+        symbol != string(entry.symbol)) {
+      return -1;
+    }
+    return slot;
+  }
+
+ private:
+  const RouteTableHeader *header_ = nullptr;
+  const uint32_t *seeds_ = nullptr;
+  const RouteEntry *entries_ = nullptr;
+  const char *strings_ = nullptr;
+  size_t strings_size_ = 0;
+};
@@ -0,0 +1,263 @@
+#include <spawn.h>
+#include <sys/wait.h>
+
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <set>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+#include "corpus.h"
+#include "elffile.h"
+
+/**
+ * Build a forwarding shim for every library split by a plan, so binaries
+ * linked against the original keep working once its exports live in parts.
+ *
+ * The shim takes over the original file name and SONAME and lists the parts
+ * of the plan as auxiliary filters (DT_AUXILIARY). The dynamic linker loads
+ * the filtees with the shim and resolves every symbol found in the shim in
+ * them instead, in plan order, so each export is forwarded to whichever
+ * part now defines it; dlsym() on the shim behaves the same way.
+ *
+ * The shim still defines every export of the original, with the same type,
+ * size and version, so that the version requirements of old binaries are
+ * met and new ones can link against it. The definitions are traps and are
+ * only reached if no part defines the symbol.
+ *
+ * The original library is read at its recorded Path from the corpus. For
+ * each library an assembly file and a version script are written to the
+ * output directory and linked with the C compiler (cc, or -c compiler).
+ * A shim whose version definitions differ from the original's is reported
+ * as a failure.
+ */
+
+static void usage() {
+  std::cerr << "Usage: shimlibrary -p plan.db [-o dir] [-c compiler] "
+               "database.db..."
+            << std::endl;
+  exit(1);
+}
+
+#if defined(__x86_64__)
+static const char *const kTrap = "ud2";
+#elif defined(__aarch64__)
+static const char *const kTrap = "brk #0";
+#else
+#error "Unsupported architecture"
+#endif
+
+/** Run argv and wait for it. Returns false if it could not run or failed. */
+static bool run(const std::vector<std::string> &args) {
+  std::vector<char *> argv;
+  for (const std::string &arg : args) {
+    argv.push_back(const_cast<char *>(arg.c_str()));
+  }
+  argv.push_back(nullptr);
+  pid_t pid;
+  int status;
+  if (posix_spawnp(&pid, argv[0], nullptr, nullptr, argv.data(), environ) !=
+          0 ||
+      waitpid(pid, &status, 0) != pid) {
+    std::cerr << "Could not run " << args[0] << std::endl;
+    return false;
+  }
+  return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+/**
+ * Check that the shim at path defines the versions of the original, and no
+ * others, as readelf -V would list them. A binary linked against either
+ * then finds every version it requires in the other.
+ */
+static bool same_versions(
+    const std::vector<ElfFile::VersionDefinition> &original,
+    const std::string &path) {
+  ElfFile shim;
+  if (!shim.open(path)) {
+    return false;
+  }
+  auto key = [](const std::vector<ElfFile::VersionDefinition> &versions) {
+    std::set<std::pair<std::string, std::vector<std::string>>> names;
+    for (const auto &version : versions) {
+      names.emplace((version.base ? "BASE " : "") + version.name,
+                    version.parents);
+    }
+    return names;
+  };
+  auto expected = key(original);
+  auto defined = key(shim.version_definitions());
+  for (const auto &[name, parents] : defined) {
+    if (!expected.count({name, parents})) {
+      std::cerr << path << " defines version " << name
+                << " that the original does not" << std::endl;
+    }
+  }
+  for (const auto &[name, parents] : expected) {
+    if (!defined.count({name, parents})) {
+      std::cerr << path << " is missing version " << name << std::endl;
+    }
+  }
+  return expected == defined;
+}
+
+int main(int argc, char **argv) {
+  std::string plan_database;
+  std::string output = ".";
+  std::string compiler = "cc";
+  std::vector<std::string> databases;
+  for (int i = 1; i < argc; ++i) {
+    if (strcmp(argv[i], "-p") == 0 && i + 1 < argc) {
+      plan_database = argv[++i];
+    } else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+      output = argv[++i];
+    } else if (strcmp(argv[i], "-c") == 0 && i + 1 < argc) {
+      compiler = argv[++i];
+    } else if (argv[i][0] == '-') {
+      usage();
+    } else {
+      databases.push_back(argv[i]);
+    }
+  }
+  if (plan_database.empty() || databases.empty()) {
+    usage();
+  }
+
+  Corpus corpus;
+  for (const std::string &database : databases) {
+    corpus.load(database);
+  }
+  corpus.finish();
+  SplitPlan plan = SplitPlan::read(plan_database);
+  std::map<std::string, std::vector<const SplitPlan::Part *>> parts;
+  for (const SplitPlan::Part &part : plan.parts) {
+    parts[part.library].push_back(&part);
+  }
+
+  int failures = 0;
+  for (const auto &[library, library_parts] : parts) {
+    int64_t id = corpus.find_library(library);
+    if (id < 0 || corpus.libraries[id].path.empty()) {
+      std::cerr << library << " is not in the corpus" << std::endl;
+      ++failures;
+      continue;
+    }
+    ElfFile elf;
+    if (!elf.open(corpus.libraries[id].path)) {
+      ++failures;
+      continue;
+    }
+    std::unordered_set<std::string> planned;
+    for (const SplitPlan::Part *part : library_parts) {
+      planned.insert(part->symbols.begin(), part->symbols.end());
+    }
+
+    std::vector<ElfFile::VersionDefinition> versions =
+        elf.version_definitions();
+    std::set<std::string> version_names;
+    for (const auto &version : versions) {
+      version_names.insert(version.name);
+    }
+    bool versioned = elf.section(SHT_GNU_versym) != nullptr;
+
+    std::filesystem::path base = std::filesystem::path(output) / library;
+    std::ofstream assembly(base.string() + ".shim.s");
+    if (!assembly) {
+      std::cerr << "Could not write " << base << ".shim.s" << std::endl;
+      return 1;
+    }
+    // Exported names by version node; "" for unversioned exports.
+    std::map<std::string, std::set<std::string>> exports;
+    size_t forwarded = 0;
+    size_t missing = 0;
+    for (size_t i = 1; i < elf.dynamic_symbol_count(); ++i) {
+      const ElfW(Sym) &sym = elf.dynamic_symbols()[i];
+      std::string name = elf.symbol_name(sym);
+      if (sym.st_shndx == SHN_UNDEF ||
+          (sym.st_shndx == SHN_ABS && version_names.count(name))) {
+        continue;
+      }
+      if (!planned.count(demangle(name))) {
+        ++missing;
+      }
+      bool hidden;
+      std::string version = elf.symbol_version(i, &hidden);
+      exports[version].insert(name);
+      ++forwarded;
+
+      // Versioned definitions get a local label and a .symver alias, as the
+      // same name may be defined in more than one node.
+      std::string label = versioned && !version.empty()
+                              ? "__shim_" + std::to_string(i)
+                              : name;
+      unsigned char type = ELF64_ST_TYPE(sym.st_info);
+      if (type == STT_FUNC || type == STT_GNU_IFUNC) {
+        assembly << "\t.text\n";
+      } else if (type == STT_TLS) {
+        assembly << "\t.section .tbss,\"awT\",@nobits\n";
+      } else {
+        assembly << "\t.bss\n";
+      }
+      assembly << (ELF64_ST_BIND(sym.st_info) == STB_WEAK ? "\t.weak "
+                                                          : "\t.globl ")
+               << label << "\n";
+      if (type == STT_FUNC || type == STT_GNU_IFUNC) {
+        assembly << "\t.type " << label << ", @function\n"
+                 << label << ":\n\t" << kTrap << "\n";
+      } else {
+        assembly << "\t.type " << label << ", "
+                 << (type == STT_TLS ? "@tls_object" : "@object") << "\n"
+                 << label << ":\n\t.zero "
+                 << std::max<uint64_t>(sym.st_size, 1) << "\n\t.size "
+                 << label << ", " << sym.st_size << "\n";
+      }
+      if (label != name) {
+        assembly << "\t.symver " << label << ", " << name
+                 << (hidden ? "@" : "@@") << version << "\n";
+      }
+    }
+    assembly << "\t.section .note.GNU-stack,\"\",@progbits\n";
+    assembly.close();
+    if (missing > 0) {
+      std::cerr << library << ": " << missing
+                << " exports are in no part; their stubs will trap"
+                << std::endl;
+    }
+
+    // Every version node of the original, so old binaries find them all.
+    std::ofstream script(base.string() + ".shim.map");
+    write_version_script(script, versions, exports, {});
+    script.close();
+
+    std::vector<std::string> args = {compiler,
+                                     "-shared",
+                                     "-nostdlib",
+                                     "-o",
+                                     base.string(),
+                                     base.string() + ".shim.s",
+                                     "-Wl,-soname," + elf.soname(),
+                                     "-Wl,--version-script=" + base.string() +
+                                         ".shim.map",
+                                     "-Wl,-rpath,$ORIGIN"};
+    for (const SplitPlan::Part *part : library_parts) {
+      args.push_back("-Wl,--auxiliary," + part->name);
+    }
+    if (!run(args)) {
+      std::cerr << "Linking " << base << " failed" << std::endl;
+      ++failures;
+      continue;
+    }
+    if (!same_versions(versions, base.string())) {
+      ++failures;
+      continue;
+    }
+    std::cout << base.string() << ": " << library_parts.size()
+              << " parts, " << forwarded << " exports forwarded"
+              << std::endl;
+  }
+  return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,450 @@
+#include <algorithm>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <queue>
+#include <set>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "corpus.h"
+
+/**
+ * Partition every library's exports by the exact set of programs using them.
+ *
+ * Exports bound to by exactly the same programs always load together, so
+ * each distinct consumer set becomes one part of the split. Consumer sets
+ * are compared through a 128-bit signature (the sum of a per-program hash,
+ * so it is independent of order), which keeps grouping a single hash table
+ * pass even with millions of symbols. Signatures are verified against the
+ * actual sets, so a collision can never merge two different groups.
+ *
+ * Exact grouping tends to produce many tiny parts, so with -k (a target
+ * number of parts) or -m (a minimum part size in bytes) the groups are then
+ * clustered: see cluster().
+ *
+ * The resulting plan is printed and, with -o, written to a database for
+ * the other tools.
+ */
+
+struct Signature {
+  uint64_t low = 0;
+  uint64_t high = 0;
+
+  bool operator==(const Signature &other) const {
+    return low == other.low && high == other.high;
+  }
+};
+
+struct SignatureHash {
+  size_t operator()(const Signature &signature) const {
+    return signature.low ^ (signature.high * 0x9e3779b97f4a7c15ULL);
+  }
+};
+
+// https://prng.di.unimi.it/splitmix64.c
+static uint64_t splitmix64(uint64_t x) {
+  x += 0x9e3779b97f4a7c15ULL;
+  x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+  return x ^ (x >> 31);
+}
+
+static Signature signature(const std::vector<uint32_t> &consumers) {
+  Signature result;
+  for (uint32_t consumer : consumers) {
+    result.low += splitmix64(consumer);
+    result.high += splitmix64(consumer ^ 0x5555555555555555ULL);
+  }
+  return result;
+}
+
+/** Exports that would be loaded together, and who loads them. */
+struct Group {
+  std::vector<uint32_t> consumers;
+  std::vector<uint32_t> symbols;
+  uint64_t bytes = 0;
+};
+
+/**
+ * The bytes merging a and b adds to what their consumers load: every
+ * consumer of only one of them now also loads the other.
+ */
+static uint64_t merge_cost(const Group &a, const Group &b) {
+  size_t only_a = 0, only_b = 0;
+  auto i = a.consumers.begin(), j = b.consumers.begin();
+  while (i != a.consumers.end() && j != b.consumers.end()) {
+    if (*i < *j) {
+      ++only_a, ++i;
+    } else if (*j < *i) {
+      ++only_b, ++j;
+    } else {
+      ++i, ++j;
+    }
+  }
+  only_a += a.consumers.end() - i;
+  only_b += b.consumers.end() - j;
+  return a.bytes * only_b + b.bytes * only_a;
+}
+
+/**
+ * Agglomerative clustering of the used groups of one library until at most
+ * target parts remain (0 for no limit) and none is smaller than min_bytes.
+ *
+ * Groups are the nodes of a co-usage graph with an edge between any two that
+ * share a consumer. The pair whose merge adds the fewest bytes loaded across
+ * all consumers is merged first, which greedily minimizes the bytes loaded
+ * per consumer. Only edges are considered at first, as merging groups with
+ * no common consumer is always more expensive; once none are left the
+ * cheapest partner is searched among all parts. The initial edge costs,
+ * which dominate the run time, are computed on every core.
+ *
+ * The unused group is never merged, since nobody loads it.
+ */
+static std::vector<Group> cluster(std::vector<Group> input, size_t target,
+                                  uint64_t min_bytes) {
+  std::vector<Group> groups;
+  std::vector<Group> unused;
+  uint32_t program_count = 0;
+  for (Group &group : input) {
+    if (group.consumers.empty()) {
+      unused.push_back(std::move(group));
+      continue;
+    }
+    program_count = std::max(program_count, group.consumers.back() + 1);
+    groups.push_back(std::move(group));
+  }
+
+  // The groups each program loads. Entries go stale as groups are merged
+  // and are resolved through merged_into, then compacted.
+  std::vector<std::vector<uint32_t>> users(program_count);
+  for (uint32_t i = 0; i < groups.size(); ++i) {
+    for (uint32_t program : groups[i].consumers) {
+      users[program].push_back(i);
+    }
+  }
+  std::vector<uint32_t> merged_into(groups.size());
+  for (uint32_t i = 0; i < groups.size(); ++i) {
+    merged_into[i] = i;
+  }
+  auto find = [&](uint32_t i) {
+    while (merged_into[i] != i) {
+      merged_into[i] = merged_into[merged_into[i]];
+      i = merged_into[i];
+    }
+    return i;
+  };
+  std::vector<bool> alive(groups.size(), true);
+  size_t alive_count = groups.size();
+  size_t small_count = 0;
+  for (const Group &group : groups) {
+    small_count += group.bytes < min_bytes;
+  }
+
+  struct Candidate {
+    uint64_t cost;
+    uint32_t a;
+    uint32_t b;
+
+    bool operator>(const Candidate &other) const {
+      return cost > other.cost;
+    }
+  };
+  std::vector<Candidate> initial;
+  {
+    unsigned thread_count = std::max(1u, std::thread::hardware_concurrency());
+    std::vector<std::vector<Candidate>> found(thread_count);
+    std::vector<std::thread> threads;
+    for (unsigned t = 0; t < thread_count; ++t) {
+      threads.emplace_back([&, t] {
+        std::vector<uint32_t> seen(groups.size(), UINT32_MAX);
+        for (uint32_t a = t; a < groups.size(); a += thread_count) {
+          for (uint32_t program : groups[a].consumers) {
+            for (uint32_t b : users[program]) {
+              if (b > a && seen[b] != a) {
+                seen[b] = a;
+                found[t].push_back({merge_cost(groups[a], groups[b]), a, b});
+              }
+            }
+          }
+        }
+      });
+    }
+    for (std::thread &thread : threads) {
+      thread.join();
+    }
+    for (auto &candidates : found) {
+      initial.insert(initial.end(), candidates.begin(), candidates.end());
+    }
+  }
+  std::priority_queue<Candidate, std::vector<Candidate>,
+                      std::greater<Candidate>>
+      heap(std::greater<Candidate>(), std::move(initial));
+
+  // Stamps rather than flags, so nothing is cleared between merges: a group
+  // has an edge from the current merge once pushed[g] == merge_stamp, and
+  // is in the consumer list being compacted once listed[g] == list_stamp.
+  std::vector<uint64_t> pushed;
+  std::vector<uint64_t> listed;
+  uint64_t merge_stamp = 0;
+  uint64_t list_stamp = 0;
+  auto merge = [&](uint32_t a, uint32_t b) {
+    Group group;
+    std::set_union(groups[a].consumers.begin(), groups[a].consumers.end(),
+                   groups[b].consumers.begin(), groups[b].consumers.end(),
+                   std::back_inserter(group.consumers));
+    group.symbols = std::move(groups[a].symbols);
+    group.symbols.insert(group.symbols.end(), groups[b].symbols.begin(),
+                         groups[b].symbols.end());
+    group.bytes = groups[a].bytes + groups[b].bytes;
+    small_count -= groups[a].bytes < min_bytes;
+    small_count -= groups[b].bytes < min_bytes;
+    small_count += group.bytes < min_bytes;
+    groups[a] = Group();
+    groups[b] = Group();
+
+    uint32_t c = groups.size();
+    groups.push_back(std::move(group));
+    alive[a] = alive[b] = false;
+    alive.push_back(true);
+    merged_into[a] = merged_into[b] = c;
+    merged_into.push_back(c);
+    --alive_count;
+
+    // Edges from the new group to every group sharing a consumer.
+    pushed.resize(groups.size(), 0);
+    listed.resize(groups.size(), 0);
+    ++merge_stamp;
+    pushed[c] = merge_stamp;
+    for (uint32_t program : groups[c].consumers) {
+      std::vector<uint32_t> &loaded = users[program];
+      ++list_stamp;
+      listed[c] = list_stamp;
+      size_t kept = 0;
+      for (uint32_t other : loaded) {
+        other = find(other);
+        if (listed[other] == list_stamp) {
+          continue;
+        }
+        listed[other] = list_stamp;
+        loaded[kept++] = other;
+        if (pushed[other] != merge_stamp) {
+          pushed[other] = merge_stamp;
+          heap.push({merge_cost(groups[c], groups[other]), c, other});
+        }
+      }
+      loaded.resize(kept);
+      loaded.push_back(c);
+    }
+  };
+
+  while (alive_count > 1 &&
+         ((target != 0 && alive_count > target) || small_count > 0)) {
+    bool over = target != 0 && alive_count > target;
+    uint32_t a = UINT32_MAX, b = UINT32_MAX;
+    while (!heap.empty()) {
+      Candidate candidate = heap.top();
+      heap.pop();
+      if (alive[candidate.a] && alive[candidate.b] &&
+          (over || groups[candidate.a].bytes < min_bytes ||
+           groups[candidate.b].bytes < min_bytes)) {
+        a = candidate.a;
+        b = candidate.b;
+        break;
+      }
+    }
+    if (a == UINT32_MAX) {
+      // No edges left: pick the smallest part (or the one loading the
+      // fewest bytes overall) and its cheapest partner.
+      for (uint32_t i = 0; i < groups.size(); ++i) {
+        if (!alive[i]) {
+          continue;
+        }
+        auto weight = [&](uint32_t g) {
+          return small_count > 0 ? groups[g].bytes
+                                 : groups[g].bytes * groups[g].consumers.size();
+        };
+        if (a == UINT32_MAX || weight(i) < weight(a)) {
+          a = i;
+        }
+      }
+      uint64_t best = UINT64_MAX;
+      for (uint32_t i = 0; i < groups.size(); ++i) {
+        if (alive[i] && i != a) {
+          uint64_t cost = merge_cost(groups[a], groups[i]);
+          if (cost < best) {
+            best = cost;
+            b = i;
+          }
+        }
+      }
+    }
+    merge(a, b);
+  }
+
+  std::vector<Group> result;
+  for (uint32_t i = 0; i < groups.size(); ++i) {
+    if (alive[i]) {
+      result.push_back(std::move(groups[i]));
+    }
+  }
+  for (Group &group : unused) {
+    result.push_back(std::move(group));
+  }
+  return result;
+}
+
+static void usage() {
+  std::cerr << "Usage: splitlibrary [-o plan.db] [-k parts] [-m bytes] "
+               "[-l library]... database.db..."
+            << std::endl;
+  exit(1);
+}
+
+int main(int argc, char **argv) {
+  std::string output;
+  size_t target = 0;
+  uint64_t min_bytes = 0;
+  std::set<std::string> only;
+  std::vector<std::string> databases;
+  for (int i = 1; i < argc; ++i) {
+    if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+      output = argv[++i];
+    } else if (strcmp(argv[i], "-k") == 0 && i + 1 < argc) {
+      target = strtoul(argv[++i], nullptr, 10);
+    } else if (strcmp(argv[i], "-m") == 0 && i + 1 < argc) {
+      min_bytes = strtoull(argv[++i], nullptr, 10);
+    } else if (strcmp(argv[i], "-l") == 0 && i + 1 < argc) {
+      only.insert(argv[++i]);
+    } else if (argv[i][0] == '-') {
+      usage();
+    } else {
+      databases.push_back(argv[i]);
+    }
+  }
+  if (databases.empty()) {
+    usage();
+  }
+
+  Corpus corpus;
+  for (const std::string &database : databases) {
+    corpus.load(database);
+  }
+  corpus.finish();
+
+  std::set<std::string> programs(corpus.programs.begin(),
+                                 corpus.programs.end());
+  std::vector<std::vector<uint32_t>> by_library = corpus.symbols_by_library();
+  // Which programs loaded each library, whether or not they bound to it.
+  std::vector<std::vector<uint32_t>> loaded_by(corpus.libraries.size());
+  for (uint32_t program = 0; program < corpus.programs.size(); ++program) {
+    for (uint32_t library : corpus.program_libraries[program]) {
+      loaded_by[library].push_back(program);
+    }
+  }
+
+  SplitPlan plan;
+  for (uint32_t library = 0; library < corpus.libraries.size(); ++library) {
+    const std::string &name = corpus.libraries[library].name;
+    if (programs.count(name) || by_library[library].empty() ||
+        (!only.empty() && !only.count(name))) {
+      continue;
+    }
+
+    // Group the exports by consumer set.
+    std::vector<Group> groups;
+    std::unordered_map<Signature, size_t, SignatureHash> group_index;
+    for (uint32_t symbol : by_library[library]) {
+      const std::vector<uint32_t> &consumers = corpus.consumers[symbol];
+      Signature key = signature(consumers);
+      while (true) {
+        auto [it, inserted] = group_index.try_emplace(key, groups.size());
+        if (inserted) {
+          groups.push_back({consumers, {}, 0});
+        } else if (groups[it->second].consumers != consumers) {
+          // A genuine collision; probe for the next free signature.
+          ++key.low;
+          continue;
+        }
+        groups[it->second].symbols.push_back(symbol);
+        groups[it->second].bytes += corpus.symbols[symbol].size;
+        break;
+      }
+    }
+    if (target != 0 || min_bytes != 0) {
+      groups = cluster(std::move(groups), target, min_bytes);
+    }
+
+    // Most widely used parts first; nobody's exports last.
+    std::sort(groups.begin(), groups.end(),
+              [](const Group &a, const Group &b) {
+                if (a.consumers.size() != b.consumers.size()) {
+                  return a.consumers.size() > b.consumers.size();
+                }
+                return a.bytes > b.bytes;
+              });
+
+    std::map<uint32_t, uint64_t> split_bytes;
+    uint64_t library_bytes = 0;
+    for (size_t i = 0; i < groups.size(); ++i) {
+      const Group &group = groups[i];
+      SplitPlan::Part part;
+      part.library = name;
+      part.name = SplitPlan::part_name(
+          name, group.consumers.empty() ? "unused" : std::to_string(i + 1));
+      part.bytes = group.bytes;
+      part.consumers = group.consumers.size();
+      for (uint32_t symbol : group.symbols) {
+        part.symbols.push_back(corpus.symbols[symbol].name);
+      }
+      plan.parts.push_back(std::move(part));
+
+      library_bytes += group.bytes;
+      for (uint32_t consumer : group.consumers) {
+        split_bytes[consumer] += group.bytes;
+      }
+    }
+    for (uint32_t program : loaded_by[library]) {
+      plan.loads.push_back({corpus.programs[program], name, library_bytes,
+                            split_bytes[program]});
+    }
+  }
+
+  // Summarize the plan per library.
+  std::map<std::string, std::vector<const SplitPlan::Part *>> parts;
+  for (const SplitPlan::Part &part : plan.parts) {
+    parts[part.library].push_back(&part);
+  }
+  std::map<std::string, std::pair<uint64_t, uint64_t>> loads;
+  std::map<std::string, uint64_t> load_count;
+  for (const SplitPlan::Load &load : plan.loads) {
+    loads[load.library].first += load.original_bytes;
+    loads[load.library].second += load.split_bytes;
+    ++load_count[load.library];
+  }
+  for (const auto &[library, library_parts] : parts) {
+    std::cout << library << ": " << library_parts.size() << " parts"
+              << std::endl;
+    for (const SplitPlan::Part *part : library_parts) {
+      std::cout << "  " << std::left << std::setw(32) << part->name
+                << std::right << std::setw(8) << part->symbols.size()
+                << " symbols " << std::setw(10) << part->bytes << " bytes "
+                << std::setw(6) << part->consumers << " consumers"
+                << std::endl;
+    }
+    if (load_count[library] > 0) {
+      std::cout << "  average load per consumer: "
+                << loads[library].first / load_count[library] << " -> "
+                << loads[library].second / load_count[library] << " bytes"
+                << std::endl;
+    }
+  }
+
+  if (!output.empty()) {
+    plan.save(output);
+  }
+  return 0;
+}
@@ -0,0 +1,690 @@
+#include <signal.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "collector.h"
+#include "corpus.h"
+
+/**
+ * Collect the recordings of many short-lived processes into one corpus.
+ *
+ *   symbolcollector -s socket -o corpus.db [-j threads] [-i seconds]
+ *
+ * Processes run with RECORDSYMBOLS_COLLECTOR=socket send their recording
+ * here at exit (see collector.h) instead of each writing a database. One
+ * thread accepts and reads every connection with epoll; a complete stream
+ * is handed to a pool of workers, which decode it and merge it into the
+ * aggregate. Names are interned globally, and the recordings of all
+ * processes of one program are merged into one, so the aggregate grows
+ * with the programs and libraries seen rather than with the processes.
+ *
+ * Every few seconds what was added since the last checkpoint is copied
+ * out of the aggregate and appended to corpus.db by a thread of its own.
+ * On SIGINT or SIGTERM the socket is removed, the streams already sent or
+ * still being sent are all read, and a last checkpoint is written.
+ * corpus.db has the schema of a corpus merged by mergecorpus and can be
+ * read by every tool meanwhile. The corpus is started afresh with every
+ * run.
+ */
+
+static void usage() {
+  std::cerr << "Usage: symbolcollector -s socket -o corpus.db [-j threads] "
+               "[-i seconds]"
+            << std::endl;
+  exit(1);
+}
+
+static void exec(sqlite3 *db, const char *sql) {
+  if (sqlite3_exec(db, sql, nullptr, nullptr, nullptr) != SQLITE_OK) {
+    sqlite_fail(db);
+  }
+}
+
+/** Libraries and symbols are keyed by the ids of their names. */
+static uint64_t symbol_key(uint32_t library, uint32_t name) {
+  return static_cast<uint64_t>(library) << 32 | name;
+}
+
+/**
+ * Every recording received, with global ids as in a merged corpus, and
+ * what the corpus database does not have yet.
+ */
+class Aggregate {
+ public:
+  /** One process's recording, decoded by a worker. Views into its stream. */
+  struct Process {
+    struct Library {
+      std::string_view name;
+      std::string_view path;
+    };
+    struct Symbol {
+      uint32_t library;
+      uint32_t name;
+      uint64_t size;
+    };
+    // By the process's own ids; the gaps are never referred to.
+    std::vector<Library> libraries;
+    std::vector<std::string_view> strings;
+    std::vector<Symbol> symbols;
+    // (consumer library, symbol).
+    std::vector<std::pair<uint32_t, uint32_t>> usages;
+  };
+
+  /** Add a process's recording to that of its program. */
+  void add(const Process &process) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::string_view program = "unknown";
+    for (const Process::Library &library : process.libraries) {
+      if (library.name == "main") {
+        program = library.path;
+      }
+    }
+    uint32_t program_id = string_id(program);
+    auto [recording_it, new_recording] =
+        recording_ids_.try_emplace(program_id, recordings_.size());
+    if (new_recording) {
+      recordings_.push_back({program_id, {}, {}});
+    }
+    uint32_t recording_id = recording_it->second;
+    Recording &recording = recordings_[recording_id];
+
+    // The program itself is not shared, so it is named after its path.
+    uint32_t no_path = string_id("");
+    std::vector<uint32_t> libraries(process.libraries.size());
+    for (size_t i = 0; i < process.libraries.size(); ++i) {
+      const Process::Library &library = process.libraries[i];
+      if (library.name.data() == nullptr) {
+        continue;
+      }
+      uint32_t name =
+          string_id(library.name == "main" ? program : library.name);
+      auto [it, inserted] =
+          library_ids_.try_emplace(name, library_names_.size());
+      if (inserted) {
+        library_names_.push_back(name);
+        library_paths_.push_back(no_path);
+      }
+      libraries[i] = it->second;
+      // Keep the first path a library was loaded from.
+      if (!library.path.empty() && library_paths_[it->second] == no_path) {
+        library_paths_[it->second] = string_id(library.path);
+        if (it->second < written_libraries_) {
+          changed_paths_.insert(it->second);
+        }
+      }
+      if (recording.loads.insert(it->second).second) {
+        new_loads_.emplace_back(recording_id, it->second);
+      }
+    }
+
+    std::vector<uint32_t> symbols(process.symbols.size());
+    for (size_t i = 0; i < process.symbols.size(); ++i) {
+      const Process::Symbol &symbol = process.symbols[i];
+      if (symbol.name == 0) {
+        continue;
+      }
+      uint64_t key = symbol_key(libraries[symbol.library],
+                                string_id(process.strings[symbol.name]));
+      auto [it, inserted] = symbol_ids_.try_emplace(key, symbol_keys_.size());
+      if (inserted) {
+        symbol_keys_.push_back(key);
+        symbol_sizes_.push_back(symbol.size);
+      } else if (symbol.size > symbol_sizes_[it->second]) {
+        // Versioned symbols may appear more than once under the same name.
+        symbol_sizes_[it->second] = symbol.size;
+        if (it->second < written_symbols_) {
+          changed_sizes_.insert(it->second);
+        }
+      }
+      symbols[i] = it->second;
+    }
+
+    for (const auto &[library, symbol] : process.usages) {
+      uint64_t usage = symbol_key(libraries[library], symbols[symbol]);
+      if (recording.usages.insert(usage).second) {
+        new_usages_.push_back({recording_id, usage});
+      }
+    }
+    ++processes_;
+  }
+
+  /** The rows a checkpoint appends, copied out of the aggregate. */
+  struct Snapshot {
+    // Strings never change once added, so they are not copied.
+    size_t first_string = 0;
+    std::vector<const std::string *> strings;
+    // (name, path) of the libraries from first_library on, then (id, path)
+    // of those whose path was found since.
+    size_t first_library = 0;
+    std::vector<std::pair<uint32_t, uint32_t>> libraries;
+    std::vector<std::pair<uint32_t, uint32_t>> paths;
+    // (key, size) of the symbols from first_symbol on, then (id, size) of
+    // those that grew since.
+    size_t first_symbol = 0;
+    std::vector<std::pair<uint64_t, uint64_t>> symbols;
+    std::vector<std::pair<uint32_t, uint64_t>> sizes;
+    // The program string id and name of the recordings from
+    // first_recording on.
+    size_t first_recording = 0;
+    std::vector<std::pair<uint32_t, const std::string *>> recordings;
+    std::vector<std::pair<uint32_t, uint32_t>> loads;
+    std::vector<std::pair<uint32_t, uint64_t>> usages;
+    // Totals, to print once written.
+    uint64_t processes = 0;
+    size_t programs = 0;
+  };
+
+  /**
+   * Take everything added since the last snapshot. Only copies, so adding
+   * is held up for as little as possible; the snapshot is written later
+   * by write() without the lock.
+   */
+  Snapshot snapshot() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    Snapshot snapshot;
+    snapshot.first_string = written_strings_;
+    snapshot.strings.assign(strings_.begin() + written_strings_,
+                            strings_.end());
+    snapshot.first_library = written_libraries_;
+    for (size_t id = written_libraries_; id < library_names_.size(); ++id) {
+      snapshot.libraries.emplace_back(library_names_[id], library_paths_[id]);
+    }
+    for (uint32_t id : changed_paths_) {
+      snapshot.paths.emplace_back(id, library_paths_[id]);
+    }
+    snapshot.first_symbol = written_symbols_;
+    for (size_t id = written_symbols_; id < symbol_keys_.size(); ++id) {
+      snapshot.symbols.emplace_back(symbol_keys_[id], symbol_sizes_[id]);
+    }
+    for (uint32_t id : changed_sizes_) {
+      snapshot.sizes.emplace_back(id, symbol_sizes_[id]);
+    }
+    snapshot.first_recording = written_recordings_;
+    for (size_t id = written_recordings_; id < recordings_.size(); ++id) {
+      uint32_t program = recordings_[id].program;
+      snapshot.recordings.emplace_back(program, strings_[program]);
+    }
+    snapshot.loads.swap(new_loads_);
+    snapshot.usages.swap(new_usages_);
+    snapshot.processes = processes_;
+    snapshot.programs = recordings_.size();
+
+    written_strings_ = strings_.size();
+    written_libraries_ = library_names_.size();
+    written_symbols_ = symbol_keys_.size();
+    written_recordings_ = recordings_.size();
+    changed_paths_.clear();
+    changed_sizes_.clear();
+    return snapshot;
+  }
+
+  /**
+   * Append a snapshot to db, in one transaction, and print totals. Exits
+   * on error.
+   */
+  static void write(sqlite3 *db, const Snapshot &snapshot, uint64_t dropped) {
+    exec(db, "BEGIN;");
+    std::vector<sqlite3_stmt *> statements;
+    auto prepare = [db, &statements](const char *sql) {
+      sqlite3_stmt *stmt;
+      if (sqlite3_prepare_v2(db, sql, -1, &stmt, nullptr) != SQLITE_OK) {
+        sqlite_fail(db);
+      }
+      statements.push_back(stmt);
+      return stmt;
+    };
+    auto run = [db](sqlite3_stmt *stmt, std::initializer_list<int64_t> values) {
+      int column = 0;
+      for (int64_t value : values) {
+        sqlite3_bind_int64(stmt, ++column, value);
+      }
+      if (sqlite3_step(stmt) != SQLITE_DONE) {
+        sqlite_fail(db);
+      }
+      sqlite3_reset(stmt);
+    };
+
+    sqlite3_stmt *stmt =
+        prepare("INSERT INTO Strings(Id, Value) VALUES (?, ?);");
+    int64_t id = snapshot.first_string;
+    for (const std::string *value : snapshot.strings) {
+      sqlite3_bind_text(stmt, 2, value->data(), value->size(), SQLITE_STATIC);
+      run(stmt, {id++});
+    }
+    stmt = prepare("INSERT INTO Libraries(Id, Name, Path) VALUES (?, ?, ?);");
+    id = snapshot.first_library;
+    for (const auto &[name, path] : snapshot.libraries) {
+      run(stmt, {id++, name, path});
+    }
+    stmt = prepare("UPDATE Libraries SET Path = ? WHERE Id = ?;");
+    for (const auto &[library, path] : snapshot.paths) {
+      run(stmt, {path, library});
+    }
+    stmt = prepare(
+        "INSERT INTO Symbols(Id, Library, Name, Size) VALUES (?, ?, ?, ?);");
+    id = snapshot.first_symbol;
+    for (const auto &[key, size] : snapshot.symbols) {
+      run(stmt, {id++, static_cast<int64_t>(key >> 32),
+                 static_cast<int64_t>(key & UINT32_MAX),
+                 static_cast<int64_t>(size)});
+    }
+    stmt = prepare("UPDATE Symbols SET Size = ? WHERE Id = ?;");
+    for (const auto &[symbol, size] : snapshot.sizes) {
+      run(stmt, {static_cast<int64_t>(size), symbol});
+    }
+    // Recordings are named after their program.
+    stmt = prepare(
+        "INSERT INTO Recordings(Id, Source, Program) VALUES (?, ?, ?);");
+    id = snapshot.first_recording;
+    for (const auto &[program, name] : snapshot.recordings) {
+      sqlite3_bind_text(stmt, 2, name->data(), name->size(), SQLITE_STATIC);
+      sqlite3_bind_int64(stmt, 3, program);
+      run(stmt, {id++});
+    }
+    stmt = prepare("INSERT INTO Loads(Recording, Library) VALUES (?, ?);");
+    for (const auto &[recording, library] : snapshot.loads) {
+      run(stmt, {recording, library});
+    }
+    stmt = prepare(
+        "INSERT INTO Usages(Recording, Library, Symbol) VALUES (?, ?, ?);");
+    for (const auto &[recording, usage] : snapshot.usages) {
+      run(stmt, {recording, static_cast<int64_t>(usage >> 32),
+                 static_cast<int64_t>(usage & UINT32_MAX)});
+    }
+    for (sqlite3_stmt *statement : statements) {
+      sqlite3_finalize(statement);
+    }
+    exec(db, "COMMIT;");
+
+    std::cout << snapshot.processes << " processes of " << snapshot.programs
+              << " programs; " << snapshot.first_library +
+                                      snapshot.libraries.size()
+              << " libraries, "
+              << snapshot.first_symbol + snapshot.symbols.size()
+              << " symbols";
+    if (dropped > 0) {
+      std::cout << "; " << dropped << " incomplete streams dropped";
+    }
+    std::cout << std::endl;
+  }
+
+ private:
+  struct Recording {
+    uint32_t program;
+    std::unordered_set<uint32_t> loads;
+    // symbol_key(consumer library, symbol).
+    std::unordered_set<uint64_t> usages;
+  };
+
+  uint32_t string_id(std::string_view value) {
+    auto [it, inserted] =
+        string_ids_.try_emplace(std::string(value), strings_.size());
+    if (inserted) {
+      // Keys of an unordered_map never move.
+      strings_.push_back(&it->first);
+    }
+    return it->second;
+  }
+
+  std::mutex mutex_;
+  std::unordered_map<std::string, uint32_t> string_ids_;
+  std::vector<const std::string *> strings_;
+  // By the string id of the name.
+  std::unordered_map<uint32_t, uint32_t> library_ids_;
+  std::vector<uint32_t> library_names_;
+  std::vector<uint32_t> library_paths_;
+  std::unordered_map<uint64_t, uint32_t> symbol_ids_;
+  std::vector<uint64_t> symbol_keys_;
+  std::vector<uint64_t> symbol_sizes_;
+  // By the string id of the program.
+  std::unordered_map<uint32_t, uint32_t> recording_ids_;
+  std::vector<Recording> recordings_;
+  uint64_t processes_ = 0;
+
+  // Rows from these ids on are not in the database yet, nor are the
+  // changes and rows below.
+  size_t written_strings_ = 0;
+  size_t written_libraries_ = 0;
+  size_t written_symbols_ = 0;
+  size_t written_recordings_ = 0;
+  std::unordered_set<uint32_t> changed_paths_;
+  std::unordered_set<uint32_t> changed_sizes_;
+  std::vector<std::pair<uint32_t, uint32_t>> new_loads_;
+  // (recording, symbol_key(consumer library, symbol)).
+  std::vector<std::pair<uint32_t, uint64_t>> new_usages_;
+};
+
+/**
+ * Decode a complete stream: the magic, then frames up to the empty one.
+ * Returns false if it is malformed or refers to records it does not have.
+ */
+static bool decode(const std::string &stream, Aggregate::Process *process) {
+  if (stream.compare(0, sizeof(kCollectorMagic), kCollectorMagic,
+                     sizeof(kCollectorMagic)) != 0) {
+    return false;
+  }
+  CollectorReader frames(stream.data() + sizeof(kCollectorMagic),
+                         stream.size() - sizeof(kCollectorMagic));
+  // Ids are row ids, so no id is beyond the number of records of its kind
+  // the stream has room for. Larger ones are rejected before slot() sizes
+  // anything by them.
+  auto fits = [&stream](uint32_t id, size_t record_size) {
+    return id <= stream.size() / record_size;
+  };
+  // The smallest record of each kind: the type, the fixed fields and the
+  // lengths of empty strings.
+  constexpr size_t kLibraryRecord = 1 + 3 * sizeof(uint32_t);
+  constexpr size_t kStringRecord = 1 + 2 * sizeof(uint32_t);
+  constexpr size_t kSymbolRecord = 1 + 3 * sizeof(uint32_t) + sizeof(uint64_t);
+  auto slot = [](auto &items, uint32_t id) -> auto & {
+    if (id >= items.size()) {
+      items.resize(id + 1);
+    }
+    return items[id];
+  };
+  auto known = [](const auto &items, uint32_t id) {
+    return id < items.size() && items[id].data() != nullptr;
+  };
+  auto known_library = [process](uint32_t id) {
+    return id < process->libraries.size() &&
+           process->libraries[id].name.data() != nullptr;
+  };
+  std::string_view frame;
+  while (frames.read(&frame) && !frame.empty()) {
+    CollectorReader records(frame.data(), frame.size());
+    while (!records.done()) {
+      uint8_t type;
+      uint32_t id, library, name;
+      uint64_t size;
+      std::string_view text, path;
+      if (!records.read(&type)) {
+        return false;
+      }
+      switch (type) {
+        case kCollectorLibrary:
+          if (!records.read(&id) || !records.read(&text) ||
+              !records.read(&path) || !fits(id, kLibraryRecord)) {
+            return false;
+          }
+          slot(process->libraries, id) = {text, path};
+          break;
+        case kCollectorString:
+          if (!records.read(&id) || !records.read(&text) ||
+              !fits(id, kStringRecord)) {
+            return false;
+          }
+          slot(process->strings, id) = text;
+          break;
+        case kCollectorSymbol:
+          if (!records.read(&id) || !records.read(&library) ||
+              !records.read(&name) || !records.read(&size) ||
+              !known_library(library) || !known(process->strings, name) ||
+              name == 0 || !fits(id, kSymbolRecord)) {
+            return false;
+          }
+          slot(process->symbols, id) = {library, name, size};
+          break;
+        case kCollectorUsage:
+          if (!records.read(&library) || !records.read(&id) ||
+              !known_library(library) || id >= process->symbols.size() ||
+              process->symbols[id].name == 0) {
+            return false;
+          }
+          process->usages.emplace_back(library, id);
+          break;
+        default:
+          return false;
+      }
+    }
+  }
+  // Only the empty frame may follow.
+  return frame.empty() && frames.done();
+}
+
+/** A connection being read, up to the end of its stream. */
+struct Connection {
+  std::string stream;
+  // Where the next frame starts.
+  size_t next_frame = sizeof(kCollectorMagic);
+};
+
+/** Whether the stream received so far is complete, i.e. ends empty. */
+static bool complete(Connection *connection) {
+  const std::string &stream = connection->stream;
+  while (connection->next_frame + sizeof(uint32_t) <= stream.size()) {
+    uint32_t size;
+    memcpy(&size, &stream[connection->next_frame], sizeof(size));
+    if (size == 0) {
+      return connection->next_frame + sizeof(uint32_t) == stream.size();
+    }
+    connection->next_frame += sizeof(uint32_t) + size;
+  }
+  return false;
+}
+
+int main(int argc, char **argv) {
+  std::string socket_path;
+  std::string output;
+  unsigned threads = std::max(1u, std::thread::hardware_concurrency());
+  long interval = 10;
+  for (int i = 1; i < argc; ++i) {
+    if (strcmp(argv[i], "-s") == 0 && i + 1 < argc) {
+      socket_path = argv[++i];
+    } else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+      output = argv[++i];
+    } else if (strcmp(argv[i], "-j") == 0 && i + 1 < argc) {
+      threads = std::max(1ul, strtoul(argv[++i], nullptr, 10));
+    } else if (strcmp(argv[i], "-i") == 0 && i + 1 < argc) {
+      interval = std::max(1l, strtol(argv[++i], nullptr, 10));
+    } else {
+      usage();
+    }
+  }
+  sockaddr_un address = {};
+  address.sun_family = AF_UNIX;
+  if (socket_path.empty() || output.empty() ||
+      socket_path.size() >= sizeof(address.sun_path)) {
+    usage();
+  }
+  memcpy(address.sun_path, socket_path.c_str(), socket_path.size());
+
+  sqlite3 *db;
+  if (sqlite3_open(output.c_str(), &db) != SQLITE_OK) {
+    sqlite_fail(db);
+  }
+  // Readers see the last checkpoint while the next one is written.
+  exec(db, "PRAGMA journal_mode = WAL;");
+  exec(db, R"(
+    DROP VIEW IF EXISTS NamedUsages;
+    DROP TABLE IF EXISTS Strings;
+    DROP TABLE IF EXISTS Recordings;
+    DROP TABLE IF EXISTS Libraries;
+    DROP TABLE IF EXISTS Symbols;
+    DROP TABLE IF EXISTS Loads;
+    DROP TABLE IF EXISTS Usages;
+  )");
+  exec(db, kMergedCorpusSchema);
+  exec(db, kMergedCorpusIndexes);
+
+  // Signals are read from the epoll loop so the last checkpoint is taken.
+  sigset_t signals;
+  sigemptyset(&signals);
+  sigaddset(&signals, SIGINT);
+  sigaddset(&signals, SIGTERM);
+  sigprocmask(SIG_BLOCK, &signals, nullptr);
+  int signal_fd = signalfd(-1, &signals, SFD_NONBLOCK | SFD_CLOEXEC);
+  int listen_fd =
+      socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  unlink(socket_path.c_str());
+  if (signal_fd < 0 || listen_fd < 0 ||
+      bind(listen_fd, reinterpret_cast<const sockaddr *>(&address),
+           sizeof(address)) != 0 ||
+      listen(listen_fd, SOMAXCONN) != 0) {
+    std::cerr << socket_path << ": " << strerror(errno) << std::endl;
+    return 1;
+  }
+  int epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+  epoll_event event = {};
+  event.events = EPOLLIN;
+  event.data.fd = listen_fd;
+  epoll_ctl(epoll_fd, EPOLL_CTL_ADD, listen_fd, &event);
+  event.data.fd = signal_fd;
+  epoll_ctl(epoll_fd, EPOLL_CTL_ADD, signal_fd, &event);
+
+  // Complete streams, waiting for a worker.
+  Aggregate aggregate;
+  std::mutex mutex;
+  std::condition_variable ready;
+  std::deque<std::string> queue;
+  bool stopping = false;
+  std::atomic<uint64_t> dropped{0};
+  std::vector<std::thread> workers;
+  for (unsigned i = 0; i < threads; ++i) {
+    workers.emplace_back([&] {
+      for (;;) {
+        std::unique_lock<std::mutex> lock(mutex);
+        ready.wait(lock, [&] { return !queue.empty() || stopping; });
+        if (queue.empty()) {
+          return;
+        }
+        std::string stream = std::move(queue.front());
+        queue.pop_front();
+        lock.unlock();
+        Aggregate::Process process;
+        if (decode(stream, &process)) {
+          aggregate.add(process);
+        } else {
+          ++dropped;
+        }
+      }
+    });
+  }
+
+  // Checkpoints are written by a thread of their own, so that neither
+  // the workers nor the connections wait for the database.
+  std::mutex checkpoint_mutex;
+  std::condition_variable checkpoint_stop;
+  bool checkpoint_stopping = false;
+  std::thread checkpointer([&] {
+    std::unique_lock<std::mutex> lock(checkpoint_mutex);
+    while (!checkpoint_stop.wait_for(lock, std::chrono::seconds(interval),
+                                     [&] { return checkpoint_stopping; })) {
+      Aggregate::write(db, aggregate.snapshot(), dropped);
+    }
+  });
+
+  std::unordered_map<int, Connection> connections;
+  auto disconnect = [&](int fd) {
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, nullptr);
+    close(fd);
+    connections.erase(fd);
+  };
+  auto accept_all = [&] {
+    int client;
+    while ((client = accept4(listen_fd, nullptr, nullptr,
+                             SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0) {
+      event.data.fd = client;
+      epoll_ctl(epoll_fd, EPOLL_CTL_ADD, client, &event);
+      connections[client];
+    }
+  };
+  // Read what is queued on a connection and queue its stream once complete.
+  auto read_connection = [&](int fd) {
+    Connection &connection = connections[fd];
+    char buffer[kCollectorFrameSize];
+    ssize_t received;
+    while ((received = recv(fd, buffer, sizeof(buffer), 0)) > 0 &&
+           connection.stream.size() <= kCollectorMaxStream) {
+      connection.stream.append(buffer, received);
+    }
+    if (connection.stream.size() > kCollectorMaxStream) {
+      // The sender gives up on a stream this long, or lies about it.
+      ++dropped;
+      disconnect(fd);
+    } else if (complete(&connection)) {
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        queue.push_back(std::move(connection.stream));
+      }
+      ready.notify_one();
+      disconnect(fd);
+    } else if (received == 0 || (errno != EAGAIN && errno != EWOULDBLOCK)) {
+      // The process went away, or gave up, before the end.
+      ++dropped;
+      disconnect(fd);
+    }
+  };
+  epoll_event events[64];
+  bool running = true;
+  while (running) {
+    int count = epoll_wait(epoll_fd, events, 64, -1);
+    for (int i = 0; i < count; ++i) {
+      int fd = events[i].data.fd;
+      if (fd == signal_fd) {
+        running = false;
+      } else if (fd == listen_fd) {
+        accept_all();
+      } else {
+        read_connection(fd);
+      }
+    }
+  }
+
+  // Senders count a stream as delivered once it is in the socket, so take
+  // every one already on its way: no new process can connect once the
+  // name is gone, the backlog is accepted, and every connection is read
+  // until its stream is complete or its sender gives up, which it does
+  // within kCollectorTimeout.
+  unlink(socket_path.c_str());
+  accept_all();
+  close(listen_fd);
+  epoll_ctl(epoll_fd, EPOLL_CTL_DEL, signal_fd, nullptr);
+  auto deadline = std::chrono::steady_clock::now() + 2 * kCollectorTimeout;
+  while (!connections.empty()) {
+    auto left = std::chrono::duration_cast<std::chrono::milliseconds>(
+        deadline - std::chrono::steady_clock::now());
+    if (left.count() <= 0) {
+      break;
+    }
+    int count = epoll_wait(epoll_fd, events, 64, left.count());
+    for (int i = 0; i < count; ++i) {
+      read_connection(events[i].data.fd);
+    }
+  }
+  dropped += connections.size();
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    stopping = true;
+  }
+  ready.notify_all();
+  for (std::thread &worker : workers) {
+    worker.join();
+  }
+  {
+    std::lock_guard<std::mutex> lock(checkpoint_mutex);
+    checkpoint_stopping = true;
+  }
+  checkpoint_stop.notify_one();
+  checkpointer.join();
+  Aggregate::write(db, aggregate.snapshot(), dropped);
+  sqlite3_close(db);
+  return 0;
+}
@@ -0,0 +1,187 @@
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "corpus.h"
+#include "dictionary.h"
+
+/**
+ * Build a front-coded dictionary (see dictionary.h) of every symbol name in
+ * the given recordings or merged corpora, or query one.
+ *
+ *   symboldict -o names.dict [-b names-per-block] database.db...
+ *   symboldict -d names.dict [-f name] [-i id] [-p prefix]...
+ *
+ * Queries map the dictionary and print "id name" lines: -f looks a name up,
+ * -i prints the name with that id and -p every name starting with prefix.
+ */
+
+static void usage() {
+  std::cerr << "Usage: symboldict -o names.dict [-b names-per-block] "
+               "database.db..."
+            << std::endl
+            << "       symboldict -d names.dict [-f name] [-i id] "
+               "[-p prefix]..."
+            << std::endl;
+  exit(1);
+}
+
+static void put_varint(std::string *out, uint64_t value) {
+  while (value >= 0x80) {
+    out->push_back(static_cast<char>(value | 0x80));
+    value >>= 7;
+  }
+  out->push_back(static_cast<char>(value));
+}
+
+/** Write the sorted, distinct names as a dictionary. Exits on error. */
+static void write_dictionary(const std::string &output,
+                             const std::vector<std::string> &names,
+                             uint32_t block_size) {
+  std::vector<uint64_t> offsets;
+  std::string data;
+  for (size_t i = 0; i < names.size(); ++i) {
+    const std::string &name = names[i];
+    if (i % block_size == 0) {
+      offsets.push_back(data.size());
+      put_varint(&data, name.size());
+      data += name;
+      continue;
+    }
+    const std::string &last = names[i - 1];
+    size_t shared = std::mismatch(name.begin(),
+                                  name.begin() + std::min(name.size(),
+                                                          last.size()),
+                                  last.begin())
+                        .first -
+                    name.begin();
+    put_varint(&data, shared);
+    put_varint(&data, name.size() - shared);
+    data.append(name, shared, std::string::npos);
+  }
+
+  DictionaryHeader header = {};
+  memcpy(header.magic, kDictionaryMagic, sizeof(header.magic));
+  header.size = names.size();
+  header.block_size = block_size;
+  header.data_size = data.size();
+  std::ofstream file(output, std::ios::binary | std::ios::trunc);
+  file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+  file.write(reinterpret_cast<const char *>(offsets.data()),
+             offsets.size() * sizeof(uint64_t));
+  file.write(data.data(), data.size());
+  if (!file) {
+    std::cerr << "Could not write " << output << std::endl;
+    exit(1);
+  }
+}
+
+int main(int argc, char **argv) {
+  std::string output;
+  std::string dictionary_path;
+  uint32_t block_size = 16;
+  // Queries in the order given, as (flag, argument).
+  std::vector<std::pair<char, std::string>> queries;
+  std::vector<std::string> databases;
+  for (int i = 1; i < argc; ++i) {
+    if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+      output = argv[++i];
+    } else if (strcmp(argv[i], "-b") == 0 && i + 1 < argc) {
+      block_size = strtoul(argv[++i], nullptr, 10);
+    } else if (strcmp(argv[i], "-d") == 0 && i + 1 < argc) {
+      dictionary_path = argv[++i];
+    } else if ((strcmp(argv[i], "-f") == 0 || strcmp(argv[i], "-i") == 0 ||
+                strcmp(argv[i], "-p") == 0) &&
+               i + 1 < argc) {
+      queries.emplace_back(argv[i][1], argv[i + 1]);
+      ++i;
+    } else if (argv[i][0] == '-') {
+      usage();
+    } else {
+      databases.push_back(argv[i]);
+    }
+  }
+  if (output.empty() == dictionary_path.empty() || block_size == 0 ||
+      (!output.empty() && (databases.empty() || !queries.empty())) ||
+      (!dictionary_path.empty() && !databases.empty())) {
+    usage();
+  }
+
+  if (!output.empty()) {
+    Corpus corpus;
+    for (const std::string &database : databases) {
+      corpus.load(database);
+    }
+    std::vector<std::string> names;
+    names.reserve(corpus.symbols.size());
+    uint64_t raw_bytes = 0;
+    for (const Corpus::Symbol &symbol : corpus.symbols) {
+      names.push_back(symbol.name);
+    }
+    std::sort(names.begin(), names.end());
+    names.erase(std::unique(names.begin(), names.end()), names.end());
+    for (const std::string &name : names) {
+      raw_bytes += name.size() + 1;
+    }
+    write_dictionary(output, names, block_size);
+    struct stat st;
+    stat(output.c_str(), &st);
+    std::cout << output << ": " << names.size() << " names, " << raw_bytes
+              << " bytes as strings, " << st.st_size << " bytes front-coded"
+              << std::endl;
+    return 0;
+  }
+
+  int fd = open(dictionary_path.c_str(), O_RDONLY);
+  struct stat st;
+  if (fd < 0 || fstat(fd, &st) != 0) {
+    std::cerr << "Could not read " << dictionary_path << std::endl;
+    return 1;
+  }
+  void *data = st.st_size == 0 ? MAP_FAILED
+                               : mmap(nullptr, st.st_size, PROT_READ,
+                                      MAP_PRIVATE, fd, 0);
+  close(fd);
+  SymbolDictionary dictionary;
+  if (data == MAP_FAILED || !dictionary.open(data, st.st_size)) {
+    std::cerr << dictionary_path << " is not a symbol dictionary"
+              << std::endl;
+    return 1;
+  }
+  for (const auto &[flag, argument] : queries) {
+    if (flag == 'f') {
+      int64_t id = dictionary.find(argument);
+      if (id < 0) {
+        std::cerr << argument << " is not in " << dictionary_path
+                  << std::endl;
+      } else {
+        std::cout << id << " " << argument << std::endl;
+      }
+    } else if (flag == 'i') {
+      uint32_t id = strtoul(argument.c_str(), nullptr, 10);
+      if (id >= dictionary.size()) {
+        std::cerr << dictionary_path << " has " << dictionary.size()
+                  << " names" << std::endl;
+      } else {
+        std::cout << id << " " << dictionary.name(id) << std::endl;
+      }
+    } else {
+      dictionary.scan(argument, [](uint32_t id, std::string_view name) {
+        std::cout << id << " " << name << "\n";
+        return true;
+      });
+    }
+  }
+  if (queries.empty()) {
+    std::cout << dictionary.size() << " names" << std::endl;
+  }
+  return 0;
+}
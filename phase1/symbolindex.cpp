@@ -0,0 +1,321 @@
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <regex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "dictionary.h"
+#include "nameindex.h"
+
+/**
+ * Build a scope index (see nameindex.h) over a symbol dictionary written by
+ * symboldict, or query the dictionary with one.
+ *
+ *   symbolindex -d names.dict -o names.idx
+ *   symbolindex -d names.dict -x names.idx [-l limit]
+ *       [-n scope] [-c component] [-p prefix] [-r regex]...
+ *
+ * Queries print "id name" lines: -n the names declared in a scope such as
+ * mycorp::storage, -c those in any scope whose last component starts with
+ * the given text (e.g. F14 for every F14Table<...> and F14Map<...>), -p
+ * those starting with prefix, and -r those matching an ECMAScript regex. A
+ * regex anchored with ^ and a literal prefix only visits the names with
+ * that prefix; any other regex visits every name.
+ */
+
+static void usage() {
+  std::cerr << "Usage: symbolindex -d names.dict -o names.idx" << std::endl
+            << "       symbolindex -d names.dict -x names.idx [-l limit] "
+               "[-n scope] [-c component] [-p prefix] [-r regex]..."
+            << std::endl;
+  exit(1);
+}
+
+/** Map a whole file read-only, or exit. The mapping is never undone. */
+static std::pair<const void *, size_t> map_file(const std::string &path) {
+  int fd = open(path.c_str(), O_RDONLY);
+  struct stat st;
+  if (fd < 0 || fstat(fd, &st) != 0) {
+    std::cerr << "Could not read " << path << std::endl;
+    exit(1);
+  }
+  void *data = st.st_size == 0 ? MAP_FAILED
+                               : mmap(nullptr, st.st_size, PROT_READ,
+                                      MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (data == MAP_FAILED) {
+    std::cerr << "Could not map " << path << std::endl;
+    exit(1);
+  }
+  return {data, static_cast<size_t>(st.st_size)};
+}
+
+/** The scope trie while it is built, before it is laid out for writing. */
+struct ScopeTrie {
+  struct Node {
+    std::string component;
+    uint32_t parent;
+    std::vector<NameRun> runs;
+  };
+  std::vector<Node> nodes = {{"", 0, {}}};
+  // By parent index, NUL, component.
+  std::unordered_map<std::string, uint32_t> children;
+
+  uint32_t child(uint32_t parent, std::string_view component) {
+    std::string key = std::to_string(parent);
+    key.push_back('\0');
+    key.append(component);
+    auto [it, inserted] = children.try_emplace(key, nodes.size());
+    if (inserted) {
+      nodes.push_back({std::string(component), parent, {}});
+    }
+    return it->second;
+  }
+
+  /** Add the name with the given id to a node; ids come in order. */
+  void add(uint32_t node, uint32_t id) {
+    std::vector<NameRun> &runs = nodes[node].runs;
+    if (!runs.empty() && runs.back().end == id) {
+      ++runs.back().end;
+    } else {
+      runs.push_back({id, id + 1});
+    }
+  }
+};
+
+/** Write the index of every name in the dictionary. Exits on error. */
+static void write_index(const std::string &output,
+                        const SymbolDictionary &dictionary) {
+  ScopeTrie trie;
+  dictionary.scan("", [&trie](uint32_t id, std::string_view name) {
+    uint32_t node = 0;
+    for (std::string_view component : name_scopes(name)) {
+      node = trie.child(node, component);
+      trie.add(node, id);
+    }
+    return true;
+  });
+  if (dictionary.size() > 0) {
+    trie.nodes[0].runs.push_back({0, dictionary.size()});
+  }
+
+  std::string strings(1, '\0');
+  std::unordered_map<std::string_view, uint32_t> string_offsets;
+  // The scopes of each component text, in index order.
+  std::map<std::string_view, std::vector<uint32_t>> components;
+  std::vector<std::vector<uint32_t>> children(trie.nodes.size());
+  std::vector<NameScope> scopes(trie.nodes.size());
+  std::vector<NameRun> runs;
+  for (uint32_t i = 0; i < trie.nodes.size(); ++i) {
+    const ScopeTrie::Node &node = trie.nodes[i];
+    NameScope &scope = scopes[i];
+    if (i > 0) {
+      auto [it, inserted] =
+          string_offsets.try_emplace(node.component, strings.size());
+      if (inserted) {
+        strings += node.component;
+        strings.push_back('\0');
+      }
+      scope.component = it->second;
+      children[node.parent].push_back(i);
+      components[node.component].push_back(i);
+    }
+    scope.parent = node.parent;
+    scope.first_run = runs.size();
+    scope.run_count = node.runs.size();
+    runs.insert(runs.end(), node.runs.begin(), node.runs.end());
+  }
+  std::vector<uint32_t> child_list;
+  for (uint32_t i = 0; i < children.size(); ++i) {
+    std::sort(children[i].begin(), children[i].end(),
+              [&trie](uint32_t a, uint32_t b) {
+                return trie.nodes[a].component < trie.nodes[b].component;
+              });
+    scopes[i].first_child = child_list.size();
+    scopes[i].child_count = children[i].size();
+    child_list.insert(child_list.end(), children[i].begin(),
+                      children[i].end());
+  }
+  std::vector<NameComponent> component_list;
+  std::vector<uint32_t> postings;
+  for (const auto &[text, indexes] : components) {
+    component_list.push_back({string_offsets.at(text),
+                              static_cast<uint32_t>(postings.size()),
+                              static_cast<uint32_t>(indexes.size())});
+    postings.insert(postings.end(), indexes.begin(), indexes.end());
+  }
+
+  NameIndexHeader header = {};
+  memcpy(header.magic, kNameIndexMagic, sizeof(header.magic));
+  header.names = dictionary.size();
+  header.scopes = scopes.size();
+  header.components = component_list.size();
+  header.postings = postings.size();
+  header.runs = runs.size();
+  header.strings_size = strings.size();
+  std::ofstream file(output, std::ios::binary | std::ios::trunc);
+  auto write = [&file](const auto &items) {
+    file.write(reinterpret_cast<const char *>(items.data()),
+               items.size() * sizeof(items[0]));
+  };
+  file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+  write(scopes);
+  write(child_list);
+  write(component_list);
+  write(postings);
+  write(runs);
+  write(strings);
+  if (!file) {
+    std::cerr << "Could not write " << output << std::endl;
+    exit(1);
+  }
+  std::cout << output << ": " << scopes.size() << " scopes, "
+            << component_list.size() << " distinct components, "
+            << runs.size() << " runs" << std::endl;
+}
+
+/**
+ * The text every match of an ECMAScript regex starts with: what follows a
+ * leading ^ up to the first special character. Empty if there is none or
+ * the regex has an alternative.
+ */
+static std::string literal_prefix(const std::string &pattern) {
+  if (pattern.empty() || pattern[0] != '^' ||
+      pattern.find('|') != std::string::npos) {
+    return std::string();
+  }
+  size_t end = pattern.find_first_of(".[]()*+?{}^$\\", 1);
+  if (end == std::string::npos) {
+    end = pattern.size();
+  } else if (strchr("*?{", pattern[end]) != nullptr) {
+    // The last literal character is optional.
+    --end;
+  }
+  return pattern.substr(1, end - 1);
+}
+
+int main(int argc, char **argv) {
+  std::string dictionary_path;
+  std::string output;
+  std::string index_path;
+  uint64_t limit = UINT64_MAX;
+  // Queries in the order given, as (flag, argument).
+  std::vector<std::pair<char, std::string>> queries;
+  for (int i = 1; i < argc; ++i) {
+    if (strcmp(argv[i], "-d") == 0 && i + 1 < argc) {
+      dictionary_path = argv[++i];
+    } else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+      output = argv[++i];
+    } else if (strcmp(argv[i], "-x") == 0 && i + 1 < argc) {
+      index_path = argv[++i];
+    } else if (strcmp(argv[i], "-l") == 0 && i + 1 < argc) {
+      limit = strtoull(argv[++i], nullptr, 10);
+    } else if (argv[i][0] == '-' && argv[i][1] != '\0' &&
+               strchr("ncpr", argv[i][1]) != nullptr && argv[i][2] == '\0' &&
+               i + 1 < argc) {
+      queries.emplace_back(argv[i][1], argv[i + 1]);
+      ++i;
+    } else {
+      usage();
+    }
+  }
+  if (dictionary_path.empty() || output.empty() == index_path.empty() ||
+      (!output.empty() && !queries.empty())) {
+    usage();
+  }
+
+  auto [dictionary_data, dictionary_size] = map_file(dictionary_path);
+  SymbolDictionary dictionary;
+  if (!dictionary.open(dictionary_data, dictionary_size)) {
+    std::cerr << dictionary_path << " is not a symbol dictionary"
+              << std::endl;
+    return 1;
+  }
+  if (!output.empty()) {
+    write_index(output, dictionary);
+    return 0;
+  }
+
+  auto [index_data, index_size] = map_file(index_path);
+  NameIndex index;
+  if (!index.open(index_data, index_size) ||
+      index.names() != dictionary.size()) {
+    std::cerr << index_path << " is not an index of " << dictionary_path
+              << std::endl;
+    return 1;
+  }
+
+  for (const auto &[flag, argument] : queries) {
+    uint64_t printed = 0;
+    auto print = [&printed, limit](uint32_t id, std::string_view name) {
+      if (printed++ >= limit) {
+        return false;
+      }
+      std::cout << id << " " << name << "\n";
+      return true;
+    };
+    // The runs of ids to print, for scope queries.
+    std::vector<NameRun> runs;
+    auto add_scope = [&index, &runs](uint32_t scope_index) {
+      const NameScope &scope = index.scope(scope_index);
+      runs.insert(runs.end(), index.runs(scope),
+                  index.runs(scope) + scope.run_count);
+    };
+    if (flag == 'n') {
+      int64_t scope = index.find_scope(argument);
+      if (scope < 0) {
+        std::cerr << "No scope " << argument << std::endl;
+        continue;
+      }
+      add_scope(scope);
+    } else if (flag == 'c') {
+      index.scopes_named(argument, add_scope);
+    } else if (flag == 'p') {
+      dictionary.scan(argument, print);
+    } else {
+      std::regex regex;
+      try {
+        regex = std::regex(argument, std::regex::ECMAScript |
+                                         std::regex::optimize);
+      } catch (const std::regex_error &error) {
+        std::cerr << argument << ": " << error.what() << std::endl;
+        continue;
+      }
+      dictionary.scan(literal_prefix(argument),
+                      [&regex, &print](uint32_t id, std::string_view name) {
+                        if (!std::regex_search(name.begin(), name.end(),
+                                               regex)) {
+                          return true;
+                        }
+                        return print(id, name);
+                      });
+    }
+
+    // Nested scopes with the same component overlap.
+    std::sort(runs.begin(), runs.end(),
+              [](const NameRun &a, const NameRun &b) {
+                return a.first < b.first;
+              });
+    uint32_t next = 0;
+    for (const NameRun &run : runs) {
+      for (next = std::max(run.first, next); next < run.end; ++next) {
+        if (!print(next, dictionary.name(next))) {
+          break;
+        }
+      }
+      if (printed > limit) {
+        break;
+      }
+    }
+  }
+  return 0;
+}
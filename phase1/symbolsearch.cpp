@@ -0,0 +1,260 @@
+#include <cctype>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "corpus.h"
+
+/**
+ * Build a full-text index of every symbol in the given recordings or merged
+ * corpora, or search one.
+ *
+ *   symbolsearch -o search.db database.db...
+ *   symbolsearch -d search.db [-n count] [-m expression] [text]...
+ *
+ * The index is an FTS5 table over the demangled names, tokenized by
+ * splitting on "::", "<", ">", "," and the other punctuation of C++ names,
+ * so std::vector<mycorp::Widget>::reserve(unsigned long) has the tokens
+ * std, vector, mycorp, widget, reserve, unsigned and long. Searching takes
+ * milliseconds on millions of names where LIKE '%text%' reads every one.
+ *
+ * A text argument is searched for as a phrase: its tokens must appear in a
+ * name one after the other, so 'mycorp::Widget' finds every member of
+ * mycorp::Widget and every template instantiated with it. A trailing * also
+ * matches longer last tokens. -m takes an FTS5 query expression instead,
+ * e.g. 'vector NOT std'. Matches are printed best first, as "library
+ * name size consumers" lines.
+ *
+ * The tokenizer is registered by this program, so the index can only be
+ * searched through it. It needs SQLite built with FTS5 (sqlite3fts.o).
+ */
+
+static void usage() {
+  std::cerr << "Usage: symbolsearch -o search.db database.db..." << std::endl
+            << "       symbolsearch -d search.db [-n count] "
+               "[-m expression] [text]..."
+            << std::endl;
+  exit(1);
+}
+
+static const char *const kSchema = R"(
+DROP TABLE IF EXISTS SymbolSearch;
+DROP TABLE IF EXISTS Symbols;
+CREATE TABLE Symbols(Id INTEGER PRIMARY KEY, Library TEXT, Name TEXT,
+                     Size INTEGER, Consumers INTEGER);
+CREATE VIRTUAL TABLE SymbolSearch USING fts5(
+    Name, content = 'Symbols', content_rowid = 'Id', tokenize = 'symbol',
+    prefix = '2 4');
+)";
+
+/**
+ * The "symbol" FTS5 tokenizer: calls token(text, start, end) for every run
+ * of letters, digits, underscores and non-ASCII bytes in a demangled name,
+ * with ASCII letters folded to lower case. Everything else separates
+ * tokens. Names are indexed without their leading underscores too, so
+ * Alloc_hider finds _Alloc_hider. It keeps no state, so every instance is
+ * the same placeholder.
+ */
+static char tokenizer_instance;
+
+static int create_tokenizer(void *, const char **, int,
+                            Fts5Tokenizer **tokenizer) {
+  *tokenizer = reinterpret_cast<Fts5Tokenizer *>(&tokenizer_instance);
+  return SQLITE_OK;
+}
+
+static void delete_tokenizer(Fts5Tokenizer *) {}
+
+static int tokenize(Fts5Tokenizer *, void *context, int flags,
+                    const char *text, int size,
+                    int (*token)(void *context, int flags, const char *text,
+                                 int size, int start, int end)) {
+  auto in_token = [text](int i) {
+    unsigned char c = text[i];
+    return isalnum(c) || c == '_' || c >= 0x80;
+  };
+  std::string folded;
+  int i = 0;
+  while (i < size) {
+    if (!in_token(i)) {
+      ++i;
+      continue;
+    }
+    int start = i;
+    folded.clear();
+    for (; i < size && in_token(i); ++i) {
+      folded.push_back(tolower(static_cast<unsigned char>(text[i])));
+    }
+    int rc = token(context, 0, folded.data(), folded.size(), start, i);
+    size_t stripped = folded.find_first_not_of('_');
+    if (rc == SQLITE_OK && (flags & FTS5_TOKENIZE_DOCUMENT) != 0 &&
+        stripped != 0 && stripped != std::string::npos) {
+      rc = token(context, FTS5_TOKEN_COLOCATED, folded.data() + stripped,
+                 folded.size() - stripped, start, i);
+    }
+    if (rc != SQLITE_OK) {
+      return rc;
+    }
+  }
+  return SQLITE_OK;
+}
+
+/** Register the "symbol" tokenizer with db. Exits if FTS5 is missing. */
+static void register_tokenizer(sqlite3 *db) {
+  static fts5_tokenizer tokenizer = {create_tokenizer, delete_tokenizer,
+                                     tokenize};
+  fts5_api *api = nullptr;
+  sqlite3_stmt *stmt;
+  if (sqlite3_prepare_v2(db, "SELECT fts5(?1)", -1, &stmt, nullptr) !=
+      SQLITE_OK) {
+    std::cerr << "SQLite was built without FTS5" << std::endl;
+    exit(1);
+  }
+  sqlite3_bind_pointer(stmt, 1, &api, "fts5_api_ptr", nullptr);
+  sqlite3_step(stmt);
+  sqlite3_finalize(stmt);
+  if (api == nullptr ||
+      api->xCreateTokenizer(api, "symbol", nullptr, &tokenizer, nullptr) !=
+          SQLITE_OK) {
+    sqlite_fail(db);
+  }
+}
+
+static void exec(sqlite3 *db, const char *sql) {
+  if (sqlite3_exec(db, sql, nullptr, nullptr, nullptr) != SQLITE_OK) {
+    sqlite_fail(db);
+  }
+}
+
+/** Write the index of every symbol in the corpus. Exits on error. */
+static void write_index(sqlite3 *db, const Corpus &corpus) {
+  exec(db, "PRAGMA synchronous = OFF;");
+  exec(db, "BEGIN;");
+  exec(db, kSchema);
+  sqlite3_stmt *stmt;
+  if (sqlite3_prepare_v2(db,
+                         "INSERT INTO Symbols(Library, Name, Size, Consumers) "
+                         "VALUES (?, ?, ?, ?)",
+                         -1, &stmt, nullptr) != SQLITE_OK) {
+    sqlite_fail(db);
+  }
+  for (size_t i = 0; i < corpus.symbols.size(); ++i) {
+    const Corpus::Symbol &symbol = corpus.symbols[i];
+    const std::string &library = corpus.libraries[symbol.library].name;
+    sqlite3_bind_text(stmt, 1, library.c_str(), library.size(),
+                      SQLITE_STATIC);
+    sqlite3_bind_text(stmt, 2, symbol.name.c_str(), symbol.name.size(),
+                      SQLITE_STATIC);
+    sqlite3_bind_int64(stmt, 3, symbol.size);
+    sqlite3_bind_int64(stmt, 4, corpus.consumers[i].size());
+    if (sqlite3_step(stmt) != SQLITE_DONE) {
+      sqlite_fail(db);
+    }
+    sqlite3_reset(stmt);
+  }
+  sqlite3_finalize(stmt);
+  // Indexing every row at once is faster than a trigger per insert.
+  exec(db, "INSERT INTO SymbolSearch(SymbolSearch) VALUES ('rebuild');");
+  exec(db, "INSERT INTO SymbolSearch(SymbolSearch) VALUES ('optimize');");
+  exec(db, "COMMIT;");
+}
+
+/** An FTS5 phrase matching text, with its trailing * kept as a prefix. */
+static std::string phrase(std::string text) {
+  bool prefix = !text.empty() && text.back() == '*';
+  if (prefix) {
+    text.pop_back();
+  }
+  std::string quoted = "\"";
+  for (char c : text) {
+    quoted.push_back(c);
+    if (c == '"') {
+      quoted.push_back('"');
+    }
+  }
+  quoted.push_back('"');
+  return prefix ? quoted + "*" : quoted;
+}
+
+int main(int argc, char **argv) {
+  std::string output;
+  std::string index_path;
+  int64_t count = 50;
+  // The databases to index, or the text to search for.
+  std::vector<std::string> arguments;
+  std::vector<std::string> queries;
+  for (int i = 1; i < argc; ++i) {
+    if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+      output = argv[++i];
+    } else if (strcmp(argv[i], "-d") == 0 && i + 1 < argc) {
+      index_path = argv[++i];
+    } else if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+      count = strtoll(argv[++i], nullptr, 10);
+    } else if (strcmp(argv[i], "-m") == 0 && i + 1 < argc) {
+      queries.push_back(argv[++i]);
+    } else if (argv[i][0] == '-') {
+      usage();
+    } else {
+      arguments.push_back(argv[i]);
+      queries.push_back(phrase(argv[i]));
+    }
+  }
+  if (output.empty() == index_path.empty() ||
+      (!output.empty() &&
+       (arguments.empty() || queries.size() != arguments.size()))) {
+    usage();
+  }
+
+  sqlite3 *db;
+  if (sqlite3_open_v2(output.empty() ? index_path.c_str() : output.c_str(),
+                      &db,
+                      output.empty() ? SQLITE_OPEN_READONLY
+                                     : SQLITE_OPEN_READWRITE |
+                                           SQLITE_OPEN_CREATE,
+                      nullptr) != SQLITE_OK) {
+    sqlite_fail(db);
+  }
+  register_tokenizer(db);
+  if (!output.empty()) {
+    Corpus corpus;
+    for (const std::string &database : arguments) {
+      corpus.load(database);
+    }
+    corpus.finish();
+    write_index(db, corpus);
+    std::cout << output << ": " << corpus.symbols.size() << " symbols"
+              << std::endl;
+    sqlite3_close(db);
+    return 0;
+  }
+
+  sqlite3_stmt *stmt;
+  if (sqlite3_prepare_v2(db,
+                         "SELECT Library, Name, Size, Consumers FROM Symbols "
+                         "JOIN (SELECT rowid, rank FROM SymbolSearch "
+                         "      WHERE SymbolSearch MATCH ?1 "
+                         "      ORDER BY rank LIMIT ?2) AS Matches "
+                         "ON Symbols.Id = Matches.rowid ORDER BY rank",
+                         -1, &stmt, nullptr) != SQLITE_OK) {
+    sqlite_fail(db);
+  }
+  for (const std::string &query : queries) {
+    sqlite3_bind_text(stmt, 1, query.c_str(), query.size(), SQLITE_STATIC);
+    sqlite3_bind_int64(stmt, 2, count);
+    int rc;
+    while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+      std::cout << sqlite3_column_text(stmt, 0) << " "
+                << sqlite3_column_text(stmt, 1) << " "
+                << sqlite3_column_int64(stmt, 2) << " "
+                << sqlite3_column_int64(stmt, 3) << "\n";
+    }
+    if (rc != SQLITE_DONE) {
+      std::cerr << query << ": " << sqlite3_errmsg(db) << std::endl;
+    }
+    sqlite3_reset(stmt);
+  }
+  sqlite3_finalize(stmt);
+  sqlite3_close(db);
+  return 0;
+}
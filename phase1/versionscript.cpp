@@ -0,0 +1,205 @@
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <set>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+#include "corpus.h"
+#include "elffile.h"
+
+/**
+ * Generate a linker version script per library that keeps only the exports
+ * some program in the corpus actually bound to.
+ *
+ * The recorded Path of each library is opened to recover what the recording
+ * lost: mangled names (version scripts match those), the version node of
+ * every export so existing nodes and their inheritance are preserved, and
+ * the relocations that refer to each export. With --dynamic-list a dynamic
+ * list is emitted instead, which only controls preemption.
+ *
+ * A report of what relinking with the scripts would remove from .dynsym,
+ * .dynstr, .gnu.hash and .gnu.version is printed, with the dynamic
+ * relocations of the hidden exports: PLT slots, which go away, and the
+ * others, which become relative and so no longer look a symbol up.
+ */
+
+static void usage() {
+  std::cerr << "Usage: versionscript [-o dir] [--dynamic-list] [-l library]... "
+               "database.db..."
+            << std::endl;
+  exit(1);
+}
+
+struct Report {
+  std::string library;
+  size_t exports = 0;
+  size_t kept = 0;
+  size_t dynsym_bytes = 0;
+  size_t dynstr_bytes = 0;
+  size_t gnu_hash_bytes = 0;
+  size_t versym_bytes = 0;
+  size_t plt_relocations = 0;
+  size_t relative_relocations = 0;
+};
+
+int main(int argc, char **argv) {
+  std::string output = ".";
+  bool dynamic_list = false;
+  std::set<std::string> only;
+  std::vector<std::string> databases;
+  for (int i = 1; i < argc; ++i) {
+    if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+      output = argv[++i];
+    } else if (strcmp(argv[i], "-l") == 0 && i + 1 < argc) {
+      only.insert(argv[++i]);
+    } else if (strcmp(argv[i], "--dynamic-list") == 0) {
+      dynamic_list = true;
+    } else if (argv[i][0] == '-') {
+      usage();
+    } else {
+      databases.push_back(argv[i]);
+    }
+  }
+  if (databases.empty()) {
+    usage();
+  }
+
+  Corpus corpus;
+  for (const std::string &database : databases) {
+    corpus.load(database);
+  }
+  corpus.finish();
+  std::set<std::string> programs(corpus.programs.begin(),
+                                 corpus.programs.end());
+  std::vector<std::vector<uint32_t>> by_library = corpus.symbols_by_library();
+
+  std::vector<Report> reports;
+  for (uint32_t library = 0; library < corpus.libraries.size(); ++library) {
+    const Corpus::Library &recorded = corpus.libraries[library];
+    if (programs.count(recorded.name) || recorded.path.empty() ||
+        (!only.empty() && !only.count(recorded.name))) {
+      continue;
+    }
+    std::unordered_set<std::string> used;
+    for (uint32_t symbol : by_library[library]) {
+      if (!corpus.consumers[symbol].empty()) {
+        used.insert(corpus.symbols[symbol].name);
+      }
+    }
+
+    ElfFile elf;
+    if (!elf.open(recorded.path)) {
+      continue;
+    }
+    std::vector<ElfFile::VersionDefinition> versions =
+        elf.version_definitions();
+    std::set<std::string> version_names;
+    for (const auto &version : versions) {
+      version_names.insert(version.name);
+    }
+    std::vector<ElfFile::RelocationCounts> relocations =
+        elf.relocation_counts();
+
+    Report report;
+    report.library = recorded.name;
+    // Kept mangled names by version node; "" for unversioned exports.
+    std::map<std::string, std::set<std::string>> kept;
+    std::set<std::string> hidden;
+    size_t hashed = 0;
+    for (size_t i = 1; i < elf.dynamic_symbol_count(); ++i) {
+      const ElfW(Sym) &sym = elf.dynamic_symbols()[i];
+      if (sym.st_shndx == SHN_UNDEF) {
+        continue;
+      }
+      ++hashed;
+      std::string name = elf.symbol_name(sym);
+      // The linker defines a symbol for every version node.
+      if (sym.st_shndx == SHN_ABS && version_names.count(name)) {
+        continue;
+      }
+      ++report.exports;
+      if (used.count(demangle(name))) {
+        ++report.kept;
+        kept[elf.symbol_version(i)].insert(name);
+        continue;
+      }
+      hidden.insert(name);
+      report.dynsym_bytes += sizeof(ElfW(Sym));
+      report.dynstr_bytes += name.size() + 1;
+      report.versym_bytes += sizeof(ElfW(Half));
+      report.plt_relocations += relocations[i].plt;
+      report.relative_relocations += relocations[i].other;
+    }
+    if (elf.gnu_hash() != nullptr) {
+      size_t removed = report.exports - report.kept;
+      report.gnu_hash_bytes =
+          ElfFile::gnu_hash_layout(hashed).bytes(hashed) -
+          ElfFile::gnu_hash_layout(hashed - removed).bytes(hashed - removed);
+    }
+    if (elf.section(SHT_GNU_versym) == nullptr) {
+      report.versym_bytes = 0;
+    }
+    reports.push_back(report);
+
+    std::filesystem::path path =
+        std::filesystem::path(output) /
+        (recorded.name + (dynamic_list ? ".dynlist" : ".map"));
+    std::ofstream out(path);
+    if (!out) {
+      std::cerr << "Could not write " << path << std::endl;
+      return 1;
+    }
+    out << "/* Exports of " << recorded.name << " used by "
+        << corpus.programs.size() << " recorded programs. */\n";
+    if (dynamic_list) {
+      out << "{\n";
+      for (const auto &[version, names] : kept) {
+        for (const std::string &name : names) {
+          out << "  " << name << ";\n";
+        }
+      }
+      out << "};\n";
+      continue;
+    }
+
+    write_version_script(out, versions, kept, hidden);
+  }
+
+  size_t total_dynsym = 0, total_dynstr = 0, total_hash = 0,
+         total_versym = 0, total_plt = 0, total_relative = 0;
+  std::cout << std::left << std::setw(32) << "library" << std::right
+            << std::setw(9) << "exports" << std::setw(9) << "kept"
+            << std::setw(10) << "dynsym" << std::setw(10) << "dynstr"
+            << std::setw(10) << "gnu.hash" << std::setw(10) << "versym"
+            << std::setw(8) << "plt" << std::setw(10) << "relative"
+            << std::endl;
+  for (const Report &report : reports) {
+    std::cout << std::left << std::setw(32) << report.library << std::right
+              << std::setw(9) << report.exports << std::setw(9) << report.kept
+              << std::setw(10) << report.dynsym_bytes << std::setw(10)
+              << report.dynstr_bytes << std::setw(10) << report.gnu_hash_bytes
+              << std::setw(10) << report.versym_bytes << std::setw(8)
+              << report.plt_relocations << std::setw(10)
+              << report.relative_relocations << std::endl;
+    total_dynsym += report.dynsym_bytes;
+    total_dynstr += report.dynstr_bytes;
+    total_hash += report.gnu_hash_bytes;
+    total_versym += report.versym_bytes;
+    total_plt += report.plt_relocations;
+    total_relative += report.relative_relocations;
+  }
+  std::cout << "Removing unused exports saves " << total_dynsym
+            << " bytes of .dynsym, " << total_dynstr << " of .dynstr, "
+            << total_hash << " of .gnu.hash, " << total_versym
+            << " of .gnu.version and " << total_plt
+            << " PLT relocations; " << total_relative
+            << " other dynamic relocations become relative and no longer "
+               "look up a symbol."
+            << std::endl;
+  return 0;
+}